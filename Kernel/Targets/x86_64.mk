@@ -4,9 +4,13 @@ KERNEL_LIBC_ASM_SRCS += $(shell find Kernel/clib/src/ -name '*.asm' -a -path */a
 KERNEL_C_SRCS += $(shell find Kernel/src/ -name '*.c' -a -path */arches/x86_64/*)
 KERNEL_ASM_SRCS += $(shell find Kernel/src/ -name '*.asm' -a -path */arches/x86_64/*)
 
-KERNEL_LIBC_CFLAGS += --target=x86_64 -DBUILD_ARCH=BUILD_ARCH_X86_64 -mno-80387 -mno-mmx -mno-3dnow -mno-sse -mno-sse2
+KERNEL_LIBC_CFLAGS += --target=x86_64 -DBUILD_ARCH=BUILD_ARCH_X86_64 -mno-80387 -mno-mmx -mno-3dnow -mno-sse -mno-sse2 -mno-red-zone
 KERNEL_LIBC_ASMFLAGS += -f elf64 -i Kernel/clib/inc
 
-KERNEL_CFLAGS += --target=x86_64 -DBUILD_ARCH=BUILD_ARCH_X86_64 -mno-80387 -mno-mmx -mno-3dnow -mno-sse -mno-sse2
+KERNEL_CFLAGS += --target=x86_64 -DBUILD_ARCH=BUILD_ARCH_X86_64 -mno-80387 -mno-mmx -mno-3dnow -mno-sse -mno-sse2 -mno-red-zone
+# SSE2 is part of x86_64 so every processor can run the SIMD sections
+KERNEL_SIMD_CFLAGS += -msse -msse2
+KERNEL_SIMD_C_SRCS += Kernel/src/Graphics/GraphicsSIMD.c
 KERNEL_ASMFLAGS += -f elf64 -i Kernel/clib/inc -i Kernel/inc
-KERNEL_LDFLAGS +=
\ No newline at end of file
+KERNEL_LINKER_SCRIPT := Kernel/Targets/x86_64.ld
+KERNEL_LDFLAGS += -T $(KERNEL_LINKER_SCRIPT)
\ No newline at end of file
@@ -2,9 +2,11 @@
 
 #include <stdint.h>
 
-void     HandleACPITables(void* rsdpAddress);
-void*    GetLAPICAddress(void);
-void*    GetIOAPICAddress(void);
-uint8_t* GetLAPICIDs(uint8_t* lapicCount);
+#define ACPI_MAX_LAPICS 1024
 
-uint8_t GetProcessorID(void);
\ No newline at end of file
+void      HandleACPITables(void* rsdpAddress);
+void*     GetLAPICAddress(void);
+void*     GetIOAPICAddress(void);
+// Returns 0 when there is no PM timer, bits receives the width of its counter
+uint16_t  GetPMTimerPort(uint8_t* bits);
+uint32_t* GetLAPICIDs(uint32_t* lapicCount);
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CPU_MAX_COUNT 1024
+
+struct Thread;
+
+// Every processor reaches its own block through GS base, which the kernel keeps loaded while it runs so swapgs can bring in a user value later
+struct CPUData
+{
+	struct CPUData* Self;  // Must stay first, CPUGetData reads it from GS:0
+	uint32_t        ID;    // x2APIC ID, must stay at offset 8 for GetProcessorID
+	uint32_t        Index; // Position in the order the processors were brought up, must stay at offset 12 for CPUGetIndex
+	struct Thread*  CurrentThread;
+	void*           StackTop;
+
+	uint64_t Interrupts;
+	uint64_t PageFaults;
+};
+
+void            CPUInitBoot(void); // Sets up the boot processor, this needs no allocator and runs before anything else
+struct CPUData* CPUCreate(uint32_t id, void* stackTop);
+void            CPUInstall(struct CPUData* data);
+size_t          CPUGetCount(void);
+struct CPUData* CPUGetDataByIndex(size_t index);
+
+struct CPUData* CPUGetData(void);
+uint32_t        GetProcessorID(void);
+uint32_t        CPUGetIndex(void); // Dense index for per processor tables, unlike the sparse APIC ID
+uint64_t        CPUReadCycles(void); // Free running cycle counter, only meaningful for comparing readings
+uint64_t        CPUReadCyclesOrdered(void); // Only reads the counter once every earlier instruction has completed
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CLOCK_SYNC_ROUNDS 64 // Round trips between the boot processor and every other one when checking their counters
+
+enum ClockSource
+{
+	ClockSourceFallback, // Nothing reported or measured the frequency, it is assumed to be 1 GHz
+	ClockSourceCalibrated,
+	ClockSourceCPUID,
+	ClockSourceHypervisor
+};
+
+struct ClockStats
+{
+	uint64_t         Frequency;
+	enum ClockSource Source;
+	bool             Invariant;    // The counter keeps its rate through frequency and sleep state changes
+	bool             Synchronized; // No processor saw the counter of another one step backwards
+	uint64_t         MaxWarp;      // Largest backwards step seen between two processors, in cycles
+};
+
+// calibratedFrequency is used when the processor does not report the rate of its cycle counter, 0 if nothing was measured
+void     ClockInit(uint64_t calibratedFrequency);
+void     ClockGetStats(struct ClockStats* stats);
+uint64_t ClockGetTime(void);           // Monotonic nanoseconds since ClockInit, only reads the cycle counter and two constants
+uint64_t ClockToCycles(uint64_t time); // Cycle counter value at which ClockGetTime reaches time
+
+// The boot processor checks the counter of every other processor against its own, which have to be waiting in ClockSyncJoin
+bool ClockSyncCheck(size_t cpuCount);
+void ClockSyncJoin(void);
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ4_HASH_BITS 12
+#define LZ4_MAX_INPUT 0x1'0000 // Positions in the hash table are 16 bits wide
+
+struct LZ4State
+{
+	uint16_t Table[1 << LZ4_HASH_BITS];
+};
+
+// Both produce and consume raw LZ4 blocks without a frame header, 0 is returned when the output does not fit or the input is malformed
+size_t LZ4Compress(struct LZ4State* state, const void* source, size_t sourceSize, void* destination, size_t destinationCapacity);
+size_t LZ4Decompress(const void* source, size_t sourceSize, void* destination, size_t destinationCapacity);
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FPU_MAX_DEPTH 4 // Sections an interrupt may nest into, every level past the first needs a save area
+
+struct FPUStats
+{
+	uint64_t Features;  // XCR0 components in use, 0 when only FXSAVE is available
+	uint32_t StateSize; // Bytes of one save area
+	bool     XSaveOpt;
+	uint64_t Sections;
+	uint64_t NestedSaves; // Sections that had to save the section they interrupted
+};
+
+// Enables the vector units on the calling processor, the first call picks the components every processor uses
+bool FPUInitCPU(void);
+void FPUGetStats(struct FPUStats* stats);
+
+// Code built with SIMD flags may only run between these, returns false when the vector units cannot be used right now, FPUEnd must then not be called
+// Sections keep the thread from being preempted and must not yield, an interrupt that opens a section of its own saves the interrupted one first
+bool FPUBegin(void);
+void FPUEnd(void);
+// The scheduler does not switch away from a processor inside a section
+bool FPUIsActive(void);
\ No newline at end of file
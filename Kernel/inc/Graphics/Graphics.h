@@ -61,6 +61,7 @@ struct FontCharacterLUT
 };
 
 void LoadFont(struct FontHeader* font);
+bool GraphicsMapFramebuffer(struct Framebuffer* framebuffer);
 
 void GraphicsDrawRect(struct Framebuffer* framebuffer, struct GraphicsRect rect, struct LinearColor fillColor, struct LinearColor outlineColor);
 void GraphicsDrawLine(struct Framebuffer* framebuffer, struct GraphicsPoint a, struct GraphicsPoint b, struct LinearColor color);
@@ -2,4 +2,7 @@
 
 void DisableInterrupts(void);
 void EnableInterrupts(void);
+bool SaveAndDisableInterrupts(void); // Returns whether interrupts were enabled
+void RestoreInterrupts(bool enabled);
+void CPUWaitForInterrupt(void); // Enables interrupts and sleeps until the next one arrives
 void CPUHalt(void);
\ No newline at end of file
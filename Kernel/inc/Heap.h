@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+
+void HeapInit(void);
+
+void* HeapAlloc(size_t size);
+void* HeapAllocZeroed(size_t size);
+void  HeapFree(void* address);
\ No newline at end of file
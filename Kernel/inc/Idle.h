@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct IdleStats
+{
+	bool     MWait;     // Idle processors wait on their wake flag instead of halting
+	uint32_t MWaitHint; // C-state requested from MWAIT
+	uint64_t Sleeps;
+	uint64_t WakeWrites; // Wakeups that only had to write the flag
+	uint64_t WakeIPIs;   // Wakeups that had to interrupt a halted processor
+};
+
+void IdleInit(void);
+void IdleGetStats(struct IdleStats* stats);
+
+// Expects interrupts to be disabled and returns with them enabled, once woken or after any interrupt
+void IdleWait(void);
+void IdleWake(uint32_t index);
+// Wakes any one sleeping processor, so queued work that any processor can take gets picked up
+void IdleWakeOne(void);
+// Waits for another processor to clear the flag without spinning at full power
+void IdleWaitWhile(bool* flag);
\ No newline at end of file
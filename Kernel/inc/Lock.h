@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Zero initialized locks are unlocked, so the Init functions are only needed to reset a lock
+
+// Processors take a ticket and spin until it is served, so the lock is handed out in arrival order
+struct TicketLock
+{
+	uint32_t Next;
+	uint32_t Serving;
+};
+
+// Every waiter spins on its own node, so a release only touches the cache line of the next waiter
+struct MCSNode
+{
+	alignas(64) struct MCSNode* Next;
+	bool Locked;
+};
+
+struct MCSLock
+{
+	struct MCSNode* Tail;
+};
+
+// Readers share the lock, a waiting writer keeps new readers out so writers do not starve
+struct RWLock
+{
+	uint32_t State;
+};
+
+void TicketLockInit(struct TicketLock* lock);
+// Runs the SMP calls sent to this processor while it waits, so holders may wait on other processors
+void TicketLockAcquire(struct TicketLock* lock);
+bool TicketLockTryAcquire(struct TicketLock* lock);
+void TicketLockRelease(struct TicketLock* lock);
+// The IRQ variants disable interrupts while the lock is held and return whether they were enabled before
+bool TicketLockAcquireIRQSave(struct TicketLock* lock);
+void TicketLockReleaseIRQRestore(struct TicketLock* lock, bool interrupts);
+
+// The node has to stay alive and untouched until the matching release
+void MCSLockInit(struct MCSLock* lock);
+void MCSLockAcquire(struct MCSLock* lock, struct MCSNode* node);
+bool MCSLockTryAcquire(struct MCSLock* lock, struct MCSNode* node);
+void MCSLockRelease(struct MCSLock* lock, struct MCSNode* node);
+bool MCSLockAcquireIRQSave(struct MCSLock* lock, struct MCSNode* node);
+void MCSLockReleaseIRQRestore(struct MCSLock* lock, struct MCSNode* node, bool interrupts);
+
+void RWLockInit(struct RWLock* lock);
+void RWLockAcquireRead(struct RWLock* lock);
+void RWLockReleaseRead(struct RWLock* lock);
+void RWLockAcquireWrite(struct RWLock* lock);
+void RWLockReleaseWrite(struct RWLock* lock);
+bool RWLockAcquireReadIRQSave(struct RWLock* lock);
+void RWLockReleaseReadIRQRestore(struct RWLock* lock, bool interrupts);
+bool RWLockAcquireWriteIRQSave(struct RWLock* lock);
+void RWLockReleaseWriteIRQRestore(struct RWLock* lock, bool interrupts);
+
+// Contention benchmark, the boot processor sets the number of participants and every participant then calls LockBenchmarkRun
+void LockBenchmarkStart(uint32_t participants);
+void LockBenchmarkRun(void);
\ No newline at end of file
@@ -37,9 +37,22 @@ struct PMMMemoryStats
 	uint64_t LastAddress;
 	uint64_t PagesTaken;
 	uint64_t PagesFree;
+
+	uint64_t CompactionRuns;
+	uint64_t CompactionRegionsRecovered;
+	uint64_t CompactionPagesMigrated;
+
+	uint64_t EvictionRuns;
+	uint64_t PagesEvicted;
+	uint64_t EvictionStalls;       // Runs that evicted pages without returning a single frame
+	uint64_t EvictionReserveTaken; // Frames handed to allocations made by eviction itself
 };
 
 typedef bool (*PMMGetMemoryMapEntryFn)(void* userdata, size_t index, struct PMMMemoryMapEntry* entry);
+// Moves the movable pages in [firstAddress, lastAddress] to frames from PMMAllocMigrationTarget, returns the number of pages moved
+typedef size_t (*PMMMigrateFn)(uint64_t firstAddress, uint64_t lastAddress);
+// Frees up to count pages by pushing cold pages out of memory, returns the number of pages freed
+typedef size_t (*PMMEvictFn)(size_t count);
 
 void   PMMInit(size_t entryCount, PMMGetMemoryMapEntryFn getter, void* userdata);
 void   PMMReclaim(void);
@@ -50,4 +63,11 @@ void   PMMDebugPrint(void);
 void* PMMAlloc(size_t count);
 void* PMMAllocAligned(size_t count, uint8_t alignment);
 void* PMMAllocBelow(size_t count, uint64_t largestAddress);
-void  PMMFree(void* address, size_t count);
\ No newline at end of file
+void  PMMFree(void* address, size_t count);
+
+void   PMMSetMigrateHandler(PMMMigrateFn handler);
+size_t PMMCompact(size_t maxRegions);
+void*  PMMAllocMigrationTarget(void);
+
+void   PMMSetEvictHandler(PMMEvictFn handler);
+size_t PMMEvict(size_t count);
\ No newline at end of file
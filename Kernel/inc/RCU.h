@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Publishes a pointer once everything it points to is initialized, readers load it with RCU_DEREFERENCE
+#define RCU_ASSIGN_POINTER(pointer, value) __atomic_store_n(&(pointer), (value), __ATOMIC_RELEASE)
+#define RCU_DEREFERENCE(pointer)           __atomic_load_n(&(pointer), __ATOMIC_ACQUIRE)
+
+struct RCUHead;
+
+typedef void (*RCUCallback)(struct RCUHead* head);
+
+// Embedded into the object being retired, the callback usually frees the object around it
+struct RCUHead
+{
+	struct RCUHead* Next;
+	RCUCallback     Fn;
+	uint64_t        Epoch; // Epoch the object was retired in
+};
+
+struct RCUStats
+{
+	uint64_t Epoch;
+	uint64_t Completed; // Every processor passed a quiescent state after this epoch started
+	uint64_t Queued;
+	uint64_t Run;
+};
+
+// Processors are only waited on once they registered, the scheduler does this when it starts on a processor
+void RCUInitCPU(void);
+void RCUGetStats(struct RCUStats* stats);
+
+// Read-side critical sections nest, touch no shared cache lines and keep the thread from being preempted, they must not yield
+void RCUReadLock(void);
+void RCUReadUnlock(void);
+
+// Runs the callback from the timer interrupt once every reader that could still see the object has left its critical section
+void RCUCall(struct RCUHead* head, RCUCallback fn);
+// Waits for a full grace period, must not be called from within a read-side critical section
+void RCUSynchronize(void);
+
+// Called by the scheduler on context switches and in the idle loop, ignored while the current thread is inside a critical section
+void RCUQuiescentState(void);
+// Called from the scheduler tick with interrupts disabled, advances grace periods and runs the callbacks whose grace period ended
+void RCUTick(void);
+
+// Boot self-test run from a thread, waits for a grace period and for a queued callback to run
+bool RCUSelfTest(void);
\ No newline at end of file
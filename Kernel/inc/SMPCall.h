@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*SMPCallFn)(void* userdata);
+
+struct SMPCallStats
+{
+	uint64_t Sent;
+	uint64_t IPIs; // Calls queued behind one still pending share its interrupt
+	uint64_t Executed;
+	uint64_t Interrupts;
+};
+
+// Every processor that takes calls sets up its own slots, processors that never did are skipped by SMPCallAll
+bool SMPCallInitCPU(void);
+void SMPCallGetStats(struct SMPCallStats* stats);
+
+// Functions run in interrupt context on the target, they must not block and should return quickly
+// A call to the calling processor itself runs right away, a processor waiting on its calls still runs the calls sent to it
+bool SMPCallOn(uint32_t index, SMPCallFn fn, void* userdata, bool wait);
+void SMPCallMany(const uint32_t* indices, size_t count, SMPCallFn fn, void* userdata, bool wait); // Skips the calling processor
+void SMPCallAll(SMPCallFn fn, void* userdata, bool wait);                                         // Runs on every other processor
+void SMPCallHandleInterrupt(void);
+// Runs the calls sent to this processor, for code spinning with interrupts disabled on something the sender may hold
+void SMPCallPoll(void);
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCHEDULER_TIMESLICE_TICKS 4         // Ticks a thread runs before others on its queue get a turn
+#define SCHEDULER_BALANCE_TICKS   32        // Ticks between periodic load balancing passes
+#define SCHEDULER_TICK_NS         1'000'000 // Length of a tick
+#define SCHEDULER_COMPACT_TICKS   256       // Ticks an idle processor waits between physical memory compaction passes
+#define SCHEDULER_COMPACT_REGIONS 2         // 2 MiB regions a single idle compaction pass migrates at most
+
+typedef void (*ThreadFn)(void* userdata);
+
+enum ThreadState
+{
+	ThreadStateReady,
+	ThreadStateRunning,
+	ThreadStateDead
+};
+
+struct Thread
+{
+	void*            StackPointer; // Saved while the thread is switched out
+	void*            StackTop;
+	ThreadFn         Entry;
+	void*            Userdata;
+	enum ThreadState State;
+	uint32_t         CPU; // Index of the run queue the thread belongs to
+	bool             Idle;
+	uint32_t         RCUDepth; // Read-side critical sections the thread is in, it is not preempted while in any
+	struct Thread*   Next;
+};
+
+struct SchedulerStats
+{
+	uint64_t ThreadsCreated;
+	uint64_t ThreadsExited;
+	uint64_t ContextSwitches;
+	uint64_t Migrations; // Threads pulled over from another processor's run queue
+	uint64_t Ready;
+};
+
+void SchedulerInit(void);
+void SchedulerGetStats(struct SchedulerStats* stats);
+// Turns the calling context into the idle thread of its processor and starts scheduling there
+void SchedulerStart(void);
+// Called from the timer interrupt with interrupts disabled
+void SchedulerTick(void);
+
+// Threads start on the least loaded run queue
+struct Thread* ThreadCreate(ThreadFn entry, void* userdata);
+struct Thread* ThreadGetCurrent(void);
+void           ThreadYield(void);
+void           ThreadExit(void);
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Lock.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_MAX_CPUS 256 // Processors past this index bypass the magazine layer
+
+struct Slab;
+struct SlabMagazine;
+
+typedef void (*SlabObjectFn)(void* object);
+
+// Loaded and Previous follow Bonwick's magazine layer, the cache line alignment keeps processors from sharing lines
+struct SlabCPUCache
+{
+	alignas(64) struct SlabMagazine* Loaded;
+	struct SlabMagazine* Previous;
+};
+
+struct SlabCacheStats
+{
+	uint64_t SlabCount;
+	uint64_t EmptySlabCount;
+	uint64_t ObjectsInUse; // Includes objects held in magazines
+	uint64_t FullMagazines;
+	uint64_t EmptyMagazines;
+};
+
+struct SlabCache
+{
+	const char*  Name;
+	size_t       ObjectSize;
+	size_t       FirstObject;
+	size_t       ObjectsPerSlab;
+	SlabObjectFn Constructor; // Run when an object leaves the slab layer, magazines only hold constructed objects
+	SlabObjectFn Destructor;  // Run when an object returns to the slab layer
+	bool         UseMagazines;
+
+	struct TicketLock Lock;
+	struct Slab*      Partial;
+	struct Slab*      Full;
+	struct Slab*      Empty;
+	size_t            EmptyCount;
+
+	struct TicketLock    DepotLock;
+	struct SlabMagazine* FullMagazines;
+	struct SlabMagazine* EmptyMagazines;
+	size_t               FullMagazineCount;
+	size_t               EmptyMagazineCount;
+
+	struct SlabCacheStats Stats;
+	struct SlabCache*     Next;
+
+	struct SlabCPUCache CPUs[SLAB_MAX_CPUS];
+};
+
+bool              SlabCacheInit(struct SlabCache* cache, const char* name, size_t objectSize, size_t alignment, SlabObjectFn constructor, SlabObjectFn destructor);
+struct SlabCache* SlabCacheCreate(const char* name, size_t objectSize, size_t alignment, SlabObjectFn constructor, SlabObjectFn destructor);
+void              SlabCacheDestroy(struct SlabCache* cache); // Only for caches from SlabCacheCreate
+void              SlabCacheReap(struct SlabCache* cache);
+void              SlabCacheGetStats(struct SlabCache* cache, struct SlabCacheStats* stats);
+struct SlabCache* SlabGetCaches(void);
+
+void* SlabAlloc(struct SlabCache* cache);
+void  SlabFree(struct SlabCache* cache, void* object);
+
+struct SlabCache* SlabGetCache(void* object);
\ No newline at end of file
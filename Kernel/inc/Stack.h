@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STACK_PAGES        4   // Usable pages of each kernel stack
+#define STACK_MAX_CPUS     256 // Processors past this index go straight to the global free list
+#define STACK_CPU_CACHE    8   // Backed stacks each processor keeps ready
+#define STACK_REGION_SLOTS 512 // Slots reserved at a time, every slot is a guard page followed by the stack
+
+struct StackStats
+{
+	uint64_t Regions;
+	uint64_t SlotsUsed; // Slots that were ever backed, stacks are kept backed from then on
+	uint64_t InUse;
+	uint64_t Cached; // Backed stacks in the global free list
+	uint64_t CacheHits;
+	uint64_t CacheMisses;
+};
+
+void StackInit(void);
+void StackGetStats(struct StackStats* stats);
+
+// Returns the top of a STACK_PAGES * 4096 byte stack, overflowing it faults on its guard page
+void* StackAlloc(void);
+void  StackFree(void* stackTop);
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct SwapStats
+{
+	uint64_t StoredPages;
+	uint64_t CompressedBytes; // Sum of the compressed sizes of all stored pages
+	uint64_t PoolPages;       // Slab pages backing the compressed pool
+	uint64_t Stores;
+	uint64_t Loads;
+	uint64_t Rejected; // Pages that did not compress well enough to be worth storing
+};
+
+void SwapInit(void);
+void SwapGetStats(struct SwapStats* stats);
+
+// Compresses a 4 KiB page into the pool, returns the handle of the stored copy or nullptr when the page is kept resident
+void* SwapStore(const void* page);
+// Decompresses a stored copy into page and releases its handle
+bool  SwapLoad(void* handle, void* page);
+void  SwapRelease(void* handle);
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TASK_MAX_CPUS       256 // Processors past this index run their spawned tasks inline, they can still steal
+#define TASK_DEQUE_CAPACITY 64  // Must be a power of two, a spawn into a full deque runs the task inline
+
+typedef void (*TaskFn)(void* userdata);
+typedef void (*ParallelForFn)(size_t begin, size_t end, void* userdata);
+typedef uint64_t (*ParallelReduceFn)(size_t begin, size_t end, void* userdata);
+typedef uint64_t (*ParallelCombineFn)(uint64_t left, uint64_t right, void* userdata);
+
+// Tasks are caller provided and have to stay alive until the group they were spawned into has been waited on
+struct Task
+{
+	TaskFn            Fn;
+	void*             Userdata;
+	struct TaskGroup* Group;
+};
+
+struct TaskGroup
+{
+	size_t Pending;
+};
+
+struct TaskStats
+{
+	uint64_t Spawned;
+	uint64_t Inline; // Spawns that ran right away because the deque was full
+	uint64_t Executed;
+	uint64_t Stolen;
+};
+
+void TaskGetStats(struct TaskStats* stats);
+
+void TaskSpawn(struct TaskGroup* group, struct Task* task, TaskFn fn, void* userdata);
+// Runs queued tasks, preferring the calling processor's own, until every task of the group has finished
+void TaskGroupWait(struct TaskGroup* group);
+// Runs one queued task if there is any, the idle loop uses this to pick up work without a thread
+bool TaskRunOne(void);
+
+// Ranges are split in halves until they are at most grain long, the halves are spawned so idle processors can steal them
+void     ParallelFor(size_t begin, size_t end, size_t grain, ParallelForFn fn, void* userdata);
+uint64_t ParallelReduce(size_t begin, size_t end, size_t grain, uint64_t identity, ParallelReduceFn fn, ParallelCombineFn combine, void* userdata);
+
+// Boot self-test run from a thread, spawns a group of tasks and sums a range with ParallelFor
+bool TaskSelfTest(void);
\ No newline at end of file
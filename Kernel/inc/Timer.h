@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_BITS   6  // Every level of the wheel has 1 << TIMER_WHEEL_BITS slots
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_UNIT_SHIFT   10 // Level 0 slots are 1 << TIMER_UNIT_SHIFT ns wide, the hardware is still armed for the exact deadline
+
+typedef void (*TimerFn)(void* userdata);
+
+// Timers are caller provided and have to be zero initialized before they are armed the first time
+struct Timer
+{
+	uint64_t       Deadline; // On the ClockGetTime clock
+	TimerFn        Fn;
+	void*          Userdata;
+	struct Timer*  Next;
+	struct Timer** Link; // Whatever points at this timer while it is pending, nullptr otherwise
+	uint32_t       CPU;
+	uint16_t       Slot;
+};
+
+struct TimerStats
+{
+	uint64_t APICFrequency;
+	bool     TSCDeadline;
+	uint64_t Armed;
+	uint64_t Fired;
+	uint64_t Cancelled;
+};
+
+// Calibrates the timer hardware and the clock on the boot processor, ACPI tables and the local APIC have to be set up first
+void TimerInit(void);
+// Every processor arms its own timer and starts the scheduler tick on it
+bool TimerInitCPU(void);
+void TimerGetStats(struct TimerStats* stats);
+
+// Callbacks run in the timer interrupt of the processor the timer was armed on, with interrupts disabled
+void TimerArm(struct Timer* timer, uint64_t deadline, TimerFn fn, void* userdata);
+// Returns whether the timer was still pending, a callback already running on another processor is waited for
+bool TimerCancel(struct Timer* timer);
+void TimerHandleInterrupt(void);
+
+// Boot self-test run from a thread, one timer lands in level 0 and one has to cascade down from level 2
+bool TimerSelfTest(void);
\ No newline at end of file
@@ -7,7 +7,10 @@ enum VMMPageType
 {
 	VMM_PAGE_TYPE_4KIB = 0,
 	VMM_PAGE_TYPE_2MIB,
-	VMM_PAGE_TYPE_1GIB
+	VMM_PAGE_TYPE_1GIB,
+	VMM_PAGE_TYPE_AUTO,    // The VMM backs the range itself with the largest leaves alignment and the PMM allow, VMMFree returns the frames
+	VMM_PAGE_TYPE_ZERO,    // 4 KiB pages that read as the shared zero frame and get a private frame on their first write
+	VMM_PAGE_TYPE_PAGEABLE // 4 KiB write back pages the PMM may compress into the swap pool when memory runs low, they fault back in on access
 };
 
 enum VMMPageProtect
@@ -18,25 +21,65 @@ enum VMMPageProtect
 	VMM_PAGE_PROTECT_READ_WRITE_EXECUTE,
 };
 
+enum VMMMemoryType
+{
+	VMM_MEMORY_TYPE_WRITE_BACK = 0,
+	VMM_MEMORY_TYPE_WRITE_COMBINING,
+	VMM_MEMORY_TYPE_UNCACHED,
+	VMM_MEMORY_TYPE_WRITE_THROUGH
+};
+
 struct VMMMemoryStats
 {
 	uint64_t AllocatorFootprint;
 
 	uint64_t PagesAllocated;
+
+	uint64_t TablePages[5]; // Page tables in use per level, [0] holds the tables of 4 KiB leaves
+	uint64_t CachedTablePages;
+	uint64_t FreeEntriesUsed;
+	uint64_t FreeEntryPages;      // Slab pages of the free entry cache shared by all address spaces
+	uint64_t FreeEntriesCapacity; // Likewise shared by all address spaces
+
+	uint64_t Mapped4KiB;
+	uint64_t Mapped2MiB;
+	uint64_t Mapped1GiB;
+
+	uint64_t Fills;
+	uint64_t Frees;
+	uint64_t Translations;
+	uint64_t TranslationSteps; // Table levels visited by all translations
+	uint64_t ZeroFaults;       // Private frames allocated on writes to VMM_PAGE_TYPE_ZERO pages
+	uint64_t SwappedPages;     // VMM_PAGE_TYPE_PAGEABLE pages currently held in the swap pool
+	uint64_t SwapOuts;
+	uint64_t SwapIns;
 };
 
 void* VMMNewPageTable(void);
 void  VMMFreePageTable(void* pageTable);
 void  VMMGetMemoryStats(void* pageTable, struct VMMMemoryStats* stats);
+void  VMMSetGlobal(void* pageTable, bool global);
 
-void* VMMAlloc(void* pageTable, size_t count, uint8_t alignment, enum VMMPageType type, enum VMMPageProtect protect);
-void* VMMAllocAt(void* pageTable, uint64_t virtualAddress, size_t count, enum VMMPageType type, enum VMMPageProtect protect);
+// Defers TLB invalidation and the release of freed page tables until the matching VMMBatchCommit, batches may nest
+// Physical pages backing freed ranges must not be reused before the commit
+void  VMMBatchBegin(void* pageTable);
+void  VMMBatchCommit(void* pageTable);
+
+void* VMMAlloc(void* pageTable, size_t count, uint8_t alignment, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType);
+void* VMMAllocAt(void* pageTable, uint64_t virtualAddress, size_t count, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType);
 void  VMMFree(void* pageTable, void* virtualAddress, size_t count);
 
 void  VMMProtect(void* pageTable, void* virtualAddress, size_t count, enum VMMPageProtect protect);
-void  VMMMap(void* pageTable, void* virtualAddress, void* physicalAddress);
-void  VMMMapLinear(void* pageTable, void* virtualAddress, void* physicalAddress, size_t count);
+// Return false when part of the range is not allocated, the allocated rest is mapped regardless
+bool  VMMMap(void* pageTable, void* virtualAddress, void* physicalAddress);
+bool  VMMMapLinear(void* pageTable, void* virtualAddress, void* physicalAddress, size_t count, enum VMMMemoryType memoryType);
 void* VMMTranslate(void* pageTable, void* virtualAddress);
+bool  VMMHandlePageFault(void* pageTable, void* virtualAddress, bool write);
+
+// Moves the leaves of a range into a new range of the destination without copying any data, the source range is freed
+void* VMMTransfer(void* sourcePageTable, void* virtualAddress, size_t count, void* destinationPageTable);
+// Maps the frames of a range read-only into a new range of the destination, shared frames are freed with their last mapping
+void* VMMShare(void* sourcePageTable, void* virtualAddress, size_t count, void* destinationPageTable);
 
 void  VMMActivate(void* pageTable);
 void* VMMGetRootTable(void* pageTable, uint8_t* levels, bool* use1GiB);
\ No newline at end of file
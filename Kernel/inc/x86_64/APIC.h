@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#define APIC_ICR_INIT_ASSERT   0xC500 // INIT, level triggered, assert
+#define APIC_ICR_INIT_DEASSERT 0x8500 // INIT, level triggered, de-assert, only valid in xAPIC mode
+#define APIC_ICR_STARTUP       0x0600 // Startup IPI, the low byte holds the page number of the start address
+#define APIC_ICR_FIXED         0x4000 // Fixed delivery, edge triggered, the low byte holds the vector
+
+#define APIC_TIMER_VECTOR    0x30
+#define APIC_WAKEUP_VECTOR   0x31
+#define APIC_CALL_VECTOR     0x32
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+#define APIC_TIMER_ONE_SHOT     0x0'0000
+#define APIC_TIMER_MASKED       0x1'0000
+#define APIC_TIMER_TSC_DEADLINE 0x4'0000 // Fires once the TSC reaches the value written by x86_64APICTimerArmDeadline
+
+// Picks x2APIC mode whenever the processor supports it, xAPIC registers are mapped from lapicAddress otherwise
+bool x86_64APICInit(void* lapicAddress);
+// Every processor has to switch its own local APIC into the mode x86_64APICInit picked
+void x86_64APICEnable(void);
+bool x86_64APICIsX2APIC(void);
+
+void x86_64APICEndOfInterrupt(void);
+
+// The timer counts bus clocks undivided, every processor sets the mode of its own timer
+void     x86_64APICTimerSetMode(uint8_t vector, uint32_t mode);
+void     x86_64APICTimerArmCount(uint32_t count); // A count of 0 stops the one-shot timer
+void     x86_64APICTimerArmDeadline(uint64_t deadline); // A deadline of 0 stops the TSC-deadline timer
+uint32_t x86_64APICTimerReadCount(void);
+
+void x86_64APICSendIPI(uint32_t destination, uint32_t command);
\ No newline at end of file
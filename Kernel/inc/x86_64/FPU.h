@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+#define FPU_XCR0_X87    0x01
+#define FPU_XCR0_SSE    0x02
+#define FPU_XCR0_AVX    0x04
+#define FPU_XCR0_AVX512 0xE0 // Opmask, ZMM_Hi256 and Hi16_ZMM, only usable together
+
+// Sets up CR0 and CR4 for SSE, and XCR0 with the given components when it is not 0
+void x86_64FPUEnable(uint64_t xcr0);
+// Drops the x87 and MXCSR state back to their defaults
+void x86_64FPUReset(void);
+// Clears the upper halves of the vector registers, so SSE code that follows pays no transition penalty
+void x86_64FPUClearUpper(void);
+
+// Areas have to be 64 byte aligned for XSAVE and 16 byte aligned for FXSAVE
+void x86_64FPUXSave(void* area, uint64_t mask);
+void x86_64FPUXSaveOpt(void* area, uint64_t mask);
+void x86_64FPUXRestore(const void* area, uint64_t mask);
+void x86_64FPUFXSave(void* area);
+void x86_64FPUFXRestore(const void* area);
\ No newline at end of file
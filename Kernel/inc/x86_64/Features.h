@@ -1,3 +1,10 @@
 #pragma once
 
-bool x86_64FeatureEnable(void);
\ No newline at end of file
+#include <stdint.h>
+
+bool x86_64FeatureEnable(void);
+bool x86_64FeatureHasX2APIC(void);
+bool x86_64FeatureHasTSCDeadline(void);
+
+// Stores EAX, EBX, ECX and EDX of the leaf into registers
+void x86_64CPUID(uint32_t leaf, uint32_t subleaf, uint32_t* registers);
\ No newline at end of file
@@ -2,11 +2,16 @@
 
 #include <stdint.h>
 
+#define X86_64_GDT_ENTRIES   4096
+#define X86_64_GDT_TSS_FIRST 6 // Every processor gets a 16 byte TSS descriptor from here on, in the order of their indices
+
 bool x86_64GDTClearDescriptors(void);
 bool x86_64GDTSetNullDescriptor(uint16_t descriptor);
 bool x86_64GDTSetCodeDescriptor(uint16_t descriptor, uint8_t privilege, bool conforming);
 bool x86_64GDTSetDataDescriptor(uint16_t descriptor);
+bool x86_64GDTSetTSSDescriptor(uint16_t descriptor, void* tss, uint32_t limit); // Takes up descriptor and the one after it
 
 void  x86_64LoadGDT(uint16_t initalCS, uint64_t initialDS);
 void  x86_64LoadLDT(uint16_t segment);
+void  x86_64LoadTR(uint16_t segment);
 void* x86_64GetGDT(void);
\ No newline at end of file
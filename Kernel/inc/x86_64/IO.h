@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdint.h>
+
+uint32_t x86_64PortRead32(uint16_t port);
\ No newline at end of file
@@ -11,8 +11,30 @@ struct x86_64InterruptState
 	uint16_t ss;
 };
 
+void        x86_64NMIHandler(const struct x86_64InterruptState* state);
+extern void x86_64NMIHandlerWrapper(void);
+
+void        x86_64DoubleFaultHandler(const struct x86_64InterruptState* state, uint16_t code);
+extern void x86_64DoubleFaultHandlerWrapper(void);
+
 void        x86_64GPExceptionHandler(const struct x86_64InterruptState* state, uint16_t code);
 extern void x86_64GPExceptionHandlerWrapper(void);
 
+void        x86_64PageFaultHandler(const struct x86_64InterruptState* state, uint16_t code);
+extern void x86_64PageFaultHandlerWrapper(void);
+
 void        x86_64TestInterruptHandler(const struct x86_64InterruptState* state);
-extern void x86_64TestInterruptHandlerWrapper(void);
\ No newline at end of file
+extern void x86_64TestInterruptHandlerWrapper(void);
+
+void        x86_64TimerInterruptHandler(const struct x86_64InterruptState* state);
+extern void x86_64TimerInterruptHandlerWrapper(void);
+
+void        x86_64WakeupInterruptHandler(const struct x86_64InterruptState* state);
+extern void x86_64WakeupInterruptHandlerWrapper(void);
+
+void        x86_64CallInterruptHandler(const struct x86_64InterruptState* state);
+extern void x86_64CallInterruptHandlerWrapper(void);
+
+extern void x86_64SpuriousInterruptHandlerWrapper(void);
+
+uint64_t x86_64ReadCR2(void);
\ No newline at end of file
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+uint64_t x86_64ReadMSR(uint32_t msr);
+void     x86_64WriteMSR(uint32_t msr, uint64_t value);
\ No newline at end of file
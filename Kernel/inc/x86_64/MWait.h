@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+void x86_64Monitor(const void* address);
+void x86_64MWait(uint32_t hint);
+// Enables interrupts right before waiting, an interrupt pending in between still ends the wait like with sti; hlt
+void x86_64MWaitEnableInterrupts(uint32_t hint);
\ No newline at end of file
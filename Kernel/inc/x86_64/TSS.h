@@ -0,0 +1,14 @@
+#pragma once
+
+#include "CPU.h"
+
+#include <stdint.h>
+
+// Interrupt stack table slots, faults that may hit a broken stack get a known good one
+#define X86_64_IST_DOUBLE_FAULT 1
+#define X86_64_IST_NMI          2
+#define X86_64_IST_PAGE_FAULT   3
+
+// The boot processor creates the TSS of every processor up front, so loading it needs no allocator
+bool x86_64TSSCreate(struct CPUData* cpu);
+bool x86_64TSSLoad(void);
\ No newline at end of file
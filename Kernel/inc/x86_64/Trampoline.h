@@ -2,16 +2,24 @@
 
 #include <stdint.h>
 
+struct x86_64TrampolineSlot
+{
+	uint32_t ID; // Local APIC ID of the core the slot belongs to
+	uint32_t Reserved;
+	uint64_t StackTop;
+	uint64_t CPUData;
+};
+
 extern struct x86_64TrampolineSettings
 {
 	uint64_t PageTable;
 	uint64_t PageTableSettings;
 	uint64_t CPUTrampolineFn;
-	uint64_t StackAllocFn;
+	uint64_t Slots;
+	uint64_t SlotCount;
 } g_x86_64TrampolineSettings;
 extern struct x86_64TrampolineStats
 {
-	uint8_t Alive;
-	uint8_t Ack;
+	uint32_t Alive; // Cores that reached the trampoline
 } g_x86_64TrampolineStats;
 extern void x86_64Trampoline(void);
\ No newline at end of file
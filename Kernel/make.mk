@@ -8,8 +8,11 @@ KERNEL_LIBC_CFLAGS := -std=c23 -fno-builtin -nostdinc -nostdlib -IKernel/clib/in
 KERNEL_LIBC_ASMFLAGS :=
 
 KERNEL_CFLAGS := -std=c23 -fno-builtin -nostdinc -nostdlib -isystem Kernel/clib/inc -IKernel/inc/
+KERNEL_SIMD_C_SRCS :=
+KERNEL_SIMD_CFLAGS :=
 KERNEL_ASMFLAGS :=
 KERNEL_LDFLAGS := -e kernel_entry
+KERNEL_LINKER_SCRIPT :=
 
 include Kernel/Targets/$(TARGET).mk
 
@@ -17,6 +20,7 @@ KERNEL_LIBC_C_OBJS := $(KERNEL_LIBC_C_SRCS:%=Bin-Int/$(CONFIG)/%.o)
 KERNEL_LIBC_ASM_OBJS := $(KERNEL_LIBC_ASM_SRCS:%=Bin-Int/$(CONFIG)/%.o)
 KERNEL_C_OBJS := $(KERNEL_C_SRCS:%=Bin-Int/$(CONFIG)/%.o)
 KERNEL_ASM_OBJS := $(KERNEL_ASM_SRCS:%=Bin-Int/$(CONFIG)/%.o)
+KERNEL_SIMD_C_OBJS := $(KERNEL_SIMD_C_SRCS:%=Bin-Int/$(CONFIG)/%.o)
 
 KERNEL_OBJS := $(KERNEL_LIBC_C_OBJS) $(KERNEL_LIBC_ASM_OBJS) $(KERNEL_C_OBJS) $(KERNEL_ASM_OBJS)
 
@@ -44,6 +48,9 @@ $(KERNEL_LIBC_ASM_OBJS): Bin-Int/$(CONFIG)/%.o: %
 	$(ASM) $(KERNEL_LIBC_ASMFLAGS) -o $@ $<
 	echo Assembled $<
 
+# The compiler may use vector registers anywhere in these units, so their code may only run between FPUBegin and FPUEnd
+$(KERNEL_SIMD_C_OBJS): KERNEL_CFLAGS += $(KERNEL_SIMD_CFLAGS)
+
 $(KERNEL_C_OBJS): Bin-Int/$(CONFIG)/%.o: %
 	mkdir -p $(dir $@)
 	$(CC) $(KERNEL_CFLAGS) -c -o $@ $<
@@ -54,7 +61,7 @@ $(KERNEL_ASM_OBJS): Bin-Int/$(CONFIG)/%.o: %
 	$(ASM) $(KERNEL_ASMFLAGS) -o $@ $<
 	echo Assembled $<
 
-Bin/$(CONFIG)/UEFI/secure-os/kernel.elf: $(KERNEL_OBJS)
+Bin/$(CONFIG)/UEFI/secure-os/kernel.elf: $(KERNEL_OBJS) $(KERNEL_LINKER_SCRIPT)
 	mkdir -p $(dir $@)
 	$(LD) $(KERNEL_LDFLAGS) -o $@ $(KERNEL_OBJS)
 	echo Linked Kernel
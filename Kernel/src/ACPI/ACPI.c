@@ -10,10 +10,13 @@ struct ACPIState
 	void* RootTable;
 	bool  IsXSDT;
 
-	void*   LAPICAddress;
-	void*   IOAPICAddress;
-	uint8_t LapicCount;
-	uint8_t LAPICIDs[256];
+	void*    LAPICAddress;
+	void*    IOAPICAddress;
+	uint32_t LapicCount;
+	uint32_t LAPICIDs[ACPI_MAX_LAPICS];
+
+	uint16_t PMTimerPort;
+	uint8_t  PMTimerBits;
 };
 
 struct ACPIState g_ACPIState;
@@ -55,6 +58,22 @@ static void VisitMADT_BIO_PIC(struct ACPI_MADT_BIO_PIC* bpic, uint32_t index);
 static void VisitMADT_LPC_PIC(struct ACPI_MADT_LPC_PIC* lpic, uint32_t index);
 static void VisitDescriptionTable(struct ACPI_DESC_HEADER* header, uint32_t index);
 
+static void ACPIAddLAPIC(uint32_t id)
+{
+	// Firmware may list a processor both as a local APIC and as a local x2APIC
+	for (uint32_t i = 0; i < g_ACPIState.LapicCount; ++i)
+	{
+		if (g_ACPIState.LAPICIDs[i] == id)
+			return;
+	}
+	if (g_ACPIState.LapicCount == ACPI_MAX_LAPICS)
+	{
+		LogWarnFormatted("ACPI", "   -> Ignored, more than %u Local APICs", ACPI_MAX_LAPICS);
+		return;
+	}
+	g_ACPIState.LAPICIDs[g_ACPIState.LapicCount++] = id;
+}
+
 void HandleACPITables(void* rsdpAddress)
 {
 	g_ACPIState = (struct ACPIState) {
@@ -62,7 +81,9 @@ void HandleACPITables(void* rsdpAddress)
 		.IsXSDT        = false,
 		.LAPICAddress  = nullptr,
 		.IOAPICAddress = nullptr,
-		.LapicCount    = 0
+		.LapicCount    = 0,
+		.PMTimerPort   = 0,
+		.PMTimerBits   = 0
 	};
 
 	LogLock();
@@ -143,7 +164,7 @@ void HandleACPITables(void* rsdpAddress)
 	}
 
 	LogDebugFormatted("ACPI",
-					  "Detected %hhu Local APICs, IO APIC Address 0x%016lX, Local APIC Address 0x%016lX",
+					  "Detected %u Local APICs, IO APIC Address 0x%016lX, Local APIC Address 0x%016lX",
 					  g_ACPIState.LapicCount,
 					  (uint64_t) g_ACPIState.IOAPICAddress,
 					  (uint64_t) g_ACPIState.LAPICAddress);
@@ -160,7 +181,14 @@ void* GetIOAPICAddress(void)
 	return g_ACPIState.IOAPICAddress;
 }
 
-uint8_t* GetLAPICIDs(uint8_t* lapicCount)
+uint16_t GetPMTimerPort(uint8_t* bits)
+{
+	if (bits)
+		*bits = g_ACPIState.PMTimerBits;
+	return g_ACPIState.PMTimerPort;
+}
+
+uint32_t* GetLAPICIDs(uint32_t* lapicCount)
 {
 	if (!lapicCount)
 		return nullptr;
@@ -224,6 +252,14 @@ void VisitFADT(struct ACPI_FADT* fadt, uint32_t index)
 {
 	struct ACPI_FACS* facs = (struct ACPI_FACS*) (fadt->XFirmwareControl ? fadt->XFirmwareControl : (uint64_t) fadt->FirmwareControl);
 	struct ACPI_DSDT* dsdt = (struct ACPI_DSDT*) (fadt->XDSDT ? fadt->XDSDT : (uint64_t) fadt->DSDT);
+	// ACPI 1.0 tables end before the extended blocks, the extended PM timer block only counts when it lives in I/O space
+	if (fadt->Header.Length >= offsetof(struct ACPI_FADT, XPMTimerBlock) + sizeof(struct ACPI_GAS) &&
+		fadt->XPMTimerBlock.AddressSpaceID == 1 &&
+		fadt->XPMTimerBlock.Address != 0)
+		g_ACPIState.PMTimerPort = (uint16_t) fadt->XPMTimerBlock.Address;
+	else
+		g_ACPIState.PMTimerPort = (uint16_t) fadt->PMTimerBlock;
+	g_ACPIState.PMTimerBits = fadt->Flags & ACPI_FADT_TIMER_VAL_EXTENDED_MASK ? 32 : 24;
 	LogDebugFormatted("ACPI",
 					  c_FADTStr,
 					  fadt->Flags & ACPI_FADT_WBINVD_MASK,
@@ -369,7 +405,7 @@ void VisitMADT_LAPIC(struct ACPI_MADT_LAPIC* lapic, uint32_t index)
 	case 0: LogDebugFormatted("ACPI", "   -> Not usable"); break;
 	case ACPI_MADT_LAPIC_ENABLED_MASK:
 		LogDebugFormatted("ACPI", "   -> Enabled");
-		g_ACPIState.LAPICIDs[g_ACPIState.LapicCount++] = lapic->APICID;
+		ACPIAddLAPIC(lapic->APICID);
 		break;
 	case ACPI_MADT_LAPIC_ONLINE_CAPABLE_MASK: LogDebugFormatted("ACPI", "   -> Can be Enabled"); break;
 	case ACPI_MADT_LAPIC_ENABLED_MASK | ACPI_MADT_LAPIC_ONLINE_CAPABLE_MASK: LogDebugFormatted("ACPI", "   -> Weird quasi state"); break;
@@ -518,8 +554,8 @@ void VisitMADT_PIS(struct ACPI_MADT_PIS* pis, uint32_t index)
 static const char* c_Lx2APICStr = "   Flags:\n"
 								  "    Enabled:        %b\n"
 								  "    Online Capable: %b\n"
-								  "   Processor UID: %08X '%.*s'\n"
-								  "   X2 ID:         %02hhX";
+								  "   Processor UID: %08X\n"
+								  "   X2 ID:         %08X";
 
 void VisitMADT_Lx2APIC(struct ACPI_MADT_Lx2APIC* lx2apic, uint32_t index)
 {
@@ -529,6 +565,17 @@ void VisitMADT_Lx2APIC(struct ACPI_MADT_Lx2APIC* lx2apic, uint32_t index)
 					  lx2apic->Flags & ACPI_MADT_LAPIC_ONLINE_CAPABLE_MASK,
 					  lx2apic->ACPIProcessorUID,
 					  lx2apic->X2APICID);
+
+	switch (lx2apic->Flags & (ACPI_MADT_LAPIC_ENABLED_MASK | ACPI_MADT_LAPIC_ONLINE_CAPABLE_MASK))
+	{
+	case 0: LogDebugFormatted("ACPI", "   -> Not usable"); break;
+	case ACPI_MADT_LAPIC_ENABLED_MASK:
+		LogDebugFormatted("ACPI", "   -> Enabled");
+		ACPIAddLAPIC(lx2apic->X2APICID);
+		break;
+	case ACPI_MADT_LAPIC_ONLINE_CAPABLE_MASK: LogDebugFormatted("ACPI", "   -> Can be Enabled"); break;
+	case ACPI_MADT_LAPIC_ENABLED_MASK | ACPI_MADT_LAPIC_ONLINE_CAPABLE_MASK: LogDebugFormatted("ACPI", "   -> Weird quasi state"); break;
+	}
 }
 
 static const char* c_Lx2APIC_NMIStr = "   Flags:\n"
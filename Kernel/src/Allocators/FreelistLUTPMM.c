@@ -5,10 +5,18 @@
 // TODO(MarcasRealAccount): Implement allocator selection as a runtime option through the commandline
 #if PMM_USE_FREELIST_LUT
 
+	#include "CPU.h"
+	#include "Halt.h"
+	#include "Lock.h"
 	#include "PMM.h"
 
 	#include <string.h>
 
+	#define PMM_COMPACT_MIN_FREE 384 // Free pages a 2 MiB region needs before migrating the rest out of it is worthwhile
+	#define PMM_COMPACT_ATTEMPTS 4   // Regions compacted when an aligned allocation fails
+	#define PMM_EVICT_BATCH      32  // Pages evicted at least when an allocation fails, so the next failures are further apart
+	#define PMM_EVICT_RESERVE    16  // Frames kept for eviction itself, enough slab pages for a whole batch of the largest swap class
+
 struct PMMFreeHeader
 {
 	int64_t               Count;
@@ -18,6 +26,7 @@ struct PMMFreeHeader
 
 struct PMMState
 {
+	struct MCSLock        Lock; // Guards everything but the handlers, which run without it as they call back into the PMM
 	struct PMMMemoryStats Stats;
 
 	size_t                    MemoryMapCount;
@@ -26,6 +35,17 @@ struct PMMState
 	uint64_t*             Bitmap;
 	struct PMMFreeHeader* Last;
 	struct PMMFreeHeader* LUT[255];
+
+	PMMMigrateFn MigrateHandler;
+	bool         Compacting;
+	uint64_t     CompactCursor;    // Next 2 MiB region considered for compaction
+	uint64_t     CompactFirstPage; // Region being compacted, migration targets are taken from outside of it
+	uint64_t     CompactLastPage;
+
+	PMMEvictFn EvictHandler;
+	uint32_t   Evicting;     // Index + 1 of the evicting processor, 0 while nobody evicts
+	uint64_t*  EvictReserve; // Frames only the evicting processor may take, [0] links to the next one
+	size_t     EvictReserveCount;
 };
 
 struct PMMState* g_PMM;
@@ -210,13 +230,45 @@ static struct PMMFreeHeader* PMMTakeAlignedRange(uint64_t count, uint8_t alignme
 
 	uint64_t alignmentVal  = 1UL << (alignment - 12);
 	uint64_t alignmentMask = alignmentVal - 1;
-	while (cur && (((uint64_t) cur / 4096 + alignmentMask) & ~alignmentMask) > ((uint64_t) cur / 4096 + cur->Count))
+	while (cur && (((uint64_t) cur / 4096 + alignmentMask) & ~alignmentMask) + count > ((uint64_t) cur / 4096 + cur->Count))
 		cur = cur->Next;
 	if (cur)
 		PMMEraseFreeRange(cur);
 	return cur;
 }
 
+// Takes [firstPage, lastPage] out of the free range starting at header
+static void PMMTakePages(struct PMMFreeHeader* header, uint64_t firstPage, uint64_t lastPage)
+{
+	uint64_t headerPage    = (uint64_t) header / 4096;
+	uint64_t lastRangePage = headerPage + header->Count - 1;
+	PMMEraseFreeRange(header);
+
+	g_PMM->Stats.PagesFree -= lastPage - firstPage + 1;
+	if (firstPage != lastPage)
+		PMMBitmapSetRange(firstPage, lastPage, false);
+	else
+		PMMBitmapSetEntry(firstPage, false);
+	if (headerPage != firstPage)
+	{
+		PMMFillFreePages(headerPage, firstPage - 1);
+		PMMInsertFreeRange(header);
+	}
+	if (lastPage != lastRangePage)
+	{
+		PMMFillFreePages(lastPage + 1, lastRangePage);
+		PMMInsertFreeRange((struct PMMFreeHeader*) ((lastPage + 1) * 4096));
+	}
+}
+
+static uint16_t PMMRegionFreeCount(uint64_t region)
+{
+	uint16_t freeCount = 0;
+	for (uint8_t i = 0; i < 8; ++i)
+		freeCount += __builtin_popcountll(g_PMM->Bitmap[region * 8 + i]);
+	return freeCount;
+}
+
 void PMMInit(size_t entryCount, PMMGetMemoryMapEntryFn getter, void* userdata)
 {
 	struct PMMMemoryMapEntry tempMemoryMapEntry;
@@ -265,10 +317,18 @@ void PMMInit(size_t entryCount, PMMGetMemoryMapEntryFn getter, void* userdata)
 		.PagesTaken         = 0,
 		.PagesFree          = 0
 	};
-	g_PMM->MemoryMapCount = 0;
-	g_PMM->MemoryMap      = nullptr;
-	g_PMM->Bitmap         = (uint64_t*) ((uint8_t*) g_PMM + sizeof(struct PMMState));
-	g_PMM->Last           = nullptr;
+	MCSLockInit(&g_PMM->Lock);
+	g_PMM->MemoryMapCount    = 0;
+	g_PMM->MemoryMap         = nullptr;
+	g_PMM->Bitmap            = (uint64_t*) ((uint8_t*) g_PMM + sizeof(struct PMMState));
+	g_PMM->Last              = nullptr;
+	g_PMM->MigrateHandler    = nullptr;
+	g_PMM->Compacting        = false;
+	g_PMM->CompactCursor     = 0;
+	g_PMM->EvictHandler      = nullptr;
+	g_PMM->Evicting          = 0;
+	g_PMM->EvictReserve      = nullptr;
+	g_PMM->EvictReserveCount = 0;
 	memset(g_PMM->Bitmap, 0, lastUsableAddress / 32768);
 	memset(g_PMM->LUT, 0, sizeof(g_PMM->LUT));
 
@@ -375,8 +435,13 @@ void PMMReclaim(void)
 
 void PMMGetMemoryStats(struct PMMMemoryStats* stats)
 {
-	if (stats)
-		*stats = g_PMM->Stats;
+	if (!stats)
+		return;
+
+	struct MCSNode node;
+	bool           interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+	*stats                    = g_PMM->Stats;
+	MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
 }
 
 size_t PMMGetMemoryMap(const struct PMMMemoryMapEntry** entries)
@@ -389,7 +454,9 @@ size_t PMMGetMemoryMap(const struct PMMMemoryMapEntry** entries)
 
 void PMMDebugPrint(void)
 {
+	struct MCSNode node;
 	LogLock();
+	bool interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
 	LogDebug("PMM", "Memory Map:");
 	for (size_t i = 0; i < g_PMM->MemoryMapCount; ++i)
 	{
@@ -447,17 +514,74 @@ void PMMDebugPrint(void)
 		LogDebugFormatted("PMM", "  %u -> 254: 0x%016lX -> 0x%016lX(%lu)", pI, (uint64_t) cur, (uint64_t) cur + cur->Count * 4096, cur->Count);
 	else
 		LogDebugFormatted("PMM", "  %u -> 254: nullptr", pI);
+	MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
 	LogUnlock();
 }
 
+// Expects the lock to be held
+static void PMMFillEvictReserve(size_t maxCount)
+{
+	for (; maxCount > 0 && g_PMM->EvictReserveCount < PMM_EVICT_RESERVE; --maxCount)
+	{
+		struct PMMFreeHeader* header = PMMTakeFreeRange(1);
+		if (!header)
+			break;
+
+		g_PMM->Stats.PagesFree -= 1;
+		uint64_t page           = (uint64_t) header / 4096;
+		PMMBitmapSetEntry(page, false);
+		if (header->Count > 1)
+		{
+			PMMFillFreePages(page + 1, page + header->Count - 1);
+			PMMInsertFreeRange((struct PMMFreeHeader*) ((page + 1) * 4096));
+		}
+		uint64_t* frame     = (uint64_t*) header;
+		frame[0]            = (uint64_t) g_PMM->EvictReserve;
+		g_PMM->EvictReserve = frame;
+		++g_PMM->EvictReserveCount;
+	}
+}
+
+// Expects the lock to be held, only the evicting processor gets a frame
+static void* PMMTakeEvictReserve(void)
+{
+	uint32_t evicting = __atomic_load_n(&g_PMM->Evicting, __ATOMIC_RELAXED);
+	if (!evicting || evicting != CPUGetIndex() + 1 || !g_PMM->EvictReserve)
+		return nullptr;
+
+	uint64_t* frame     = g_PMM->EvictReserve;
+	g_PMM->EvictReserve = (uint64_t*) frame[0];
+	--g_PMM->EvictReserveCount;
+	++g_PMM->Stats.EvictionReserveTaken;
+	return frame;
+}
+
 void* PMMAlloc(size_t count)
 {
 	if (count == 0)
 		return nullptr;
 
-	struct PMMFreeHeader* header = PMMTakeFreeRange(count);
+	struct MCSNode        node;
+	bool                  interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+	struct PMMFreeHeader* header     = PMMTakeFreeRange(count);
 	if (!header)
-		return nullptr;
+	{
+		// Storing evicted pages needs memory too, which would otherwise only come back once they are stored
+		void* frame = count == 1 ? PMMTakeEvictReserve() : nullptr;
+		MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
+		if (frame)
+			return frame;
+		// Evicted pages are scattered, they mostly help single page allocations
+		if (PMMEvict(count > PMM_EVICT_BATCH ? count : PMM_EVICT_BATCH) == 0)
+			return nullptr;
+		interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+		header     = PMMTakeFreeRange(count);
+		if (!header)
+		{
+			MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
+			return nullptr;
+		}
+	}
 
 	g_PMM->Stats.PagesFree -= count;
 	uint64_t firstPage      = (uint64_t) header / 4096;
@@ -470,6 +594,7 @@ void* PMMAlloc(size_t count)
 		PMMFillFreePages(firstPage + count, firstPage + header->Count - 1);
 		PMMInsertFreeRange((struct PMMFreeHeader*) ((firstPage + count) * 4096));
 	}
+	MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
 	return (void*) (firstPage * 4096);
 }
 
@@ -483,12 +608,24 @@ void* PMMAllocAligned(size_t count, uint8_t alignment)
 	uint64_t alignmentVal  = 1UL << (alignment - 12);
 	uint64_t alignmentMask = alignmentVal - 1;
 
-	struct PMMFreeHeader* header = PMMTakeFreeRange(count + alignmentVal);
+	struct MCSNode        node;
+	bool                  interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+	struct PMMFreeHeader* header     = PMMTakeFreeRange(count + alignmentVal);
 	if (!header)
-	{
 		header = PMMTakeAlignedRange(count, alignment);
+	if (!header)
+	{
+		MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
+		// Fragmentation can leave plenty of free memory without a single aligned block, compaction may recover one
+		if (count > 512 || alignment > 21 || PMMCompact(PMM_COMPACT_ATTEMPTS) == 0)
+			return nullptr;
+		interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+		header     = PMMTakeAlignedRange(count, alignment);
 		if (!header)
+		{
+			MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
 			return nullptr;
+		}
 	}
 
 	g_PMM->Stats.PagesFree -= count;
@@ -510,6 +647,7 @@ void* PMMAllocAligned(size_t count, uint8_t alignment)
 		PMMFillFreePages(lastPage + 1, lastRangePage);
 		PMMInsertFreeRange((struct PMMFreeHeader*) ((lastPage + 1) * 4096));
 	}
+	MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
 	return (void*) (firstPage * 4096);
 }
 
@@ -522,11 +660,16 @@ void* PMMAllocBelow(size_t count, uint64_t largestAddress)
 
 	uint64_t highestAddress = largestAddress - count * 4096;
 
-	struct PMMFreeHeader* cur = g_PMM->LUT[0];
+	struct MCSNode        node;
+	bool                  interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+	struct PMMFreeHeader* cur        = g_PMM->LUT[0];
 	while (cur && (cur->Count < count || (uint64_t) cur > highestAddress))
 		cur = cur->Next;
 	if (!cur)
+	{
+		MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
 		return nullptr;
+	}
 
 	PMMEraseFreeRange(cur);
 	g_PMM->Stats.PagesFree -= count;
@@ -540,6 +683,7 @@ void* PMMAllocBelow(size_t count, uint64_t largestAddress)
 		PMMFillFreePages(firstPage + count, firstPage + cur->Count - 1);
 		PMMInsertFreeRange((struct PMMFreeHeader*) ((firstPage + count) * 4096));
 	}
+	MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
 	return (void*) (firstPage * 4096);
 }
 
@@ -549,9 +693,14 @@ void PMMFree(void* address, size_t count)
 		count == 0)
 		return;
 
-	uint64_t firstPage = (uint64_t) address / 4096;
+	struct MCSNode node;
+	bool           interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+	uint64_t       firstPage  = (uint64_t) address / 4096;
 	if (PMMBitmapGetEntry(firstPage))
+	{
+		MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
 		return;
+	}
 	g_PMM->Stats.PagesFree += count;
 	if (count > 1)
 		PMMBitmapSetRange(firstPage, firstPage + count - 1, true);
@@ -575,6 +724,132 @@ void PMMFree(void* address, size_t count)
 	}
 	PMMFillFreePages(bottomPage, bottomPage + totalCount - 1);
 	PMMInsertFreeRange((struct PMMFreeHeader*) (bottomPage * 4096));
+	MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
+}
+
+void PMMSetMigrateHandler(PMMMigrateFn handler)
+{
+	g_PMM->MigrateHandler = handler;
+}
+
+size_t PMMCompact(size_t maxRegions)
+{
+	// Only one processor compacts at a time, the flag also keeps the migrate handler from recursing into compaction
+	if (!g_PMM->MigrateHandler || __atomic_exchange_n(&g_PMM->Compacting, true, __ATOMIC_ACQUIRE))
+		return 0;
+
+	uint64_t regionCount = g_PMM->Stats.LastUsableAddress / 0x20'0000;
+	if (regionCount == 0)
+	{
+		__atomic_store_n(&g_PMM->Compacting, false, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	struct MCSNode node;
+	bool           interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+	++g_PMM->Stats.CompactionRuns;
+	size_t recovered = 0;
+	for (uint64_t i = 0; i < regionCount && maxRegions > 0; ++i)
+	{
+		uint64_t region      = g_PMM->CompactCursor;
+		g_PMM->CompactCursor = (region + 1) % regionCount;
+
+		uint16_t freeCount = PMMRegionFreeCount(region);
+		if (freeCount == 512 || freeCount < PMM_COMPACT_MIN_FREE)
+			continue;
+
+		--maxRegions;
+		g_PMM->CompactFirstPage = region * 512;
+		g_PMM->CompactLastPage  = region * 512 + 511;
+		MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
+		size_t migrated = g_PMM->MigrateHandler(g_PMM->CompactFirstPage * 4096, g_PMM->CompactLastPage * 4096 + 4095);
+		interrupts      = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+
+		g_PMM->Stats.CompactionPagesMigrated += migrated;
+		if (PMMRegionFreeCount(region) == 512)
+		{
+			++g_PMM->Stats.CompactionRegionsRecovered;
+			++recovered;
+		}
+	}
+	MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
+	__atomic_store_n(&g_PMM->Compacting, false, __ATOMIC_RELEASE);
+	return recovered;
+}
+
+void* PMMAllocMigrationTarget(void)
+{
+	if (!__atomic_load_n(&g_PMM->Compacting, __ATOMIC_ACQUIRE))
+		return PMMAlloc(1);
+
+	struct MCSNode        node;
+	bool                  interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+	void*                 target     = nullptr;
+	struct PMMFreeHeader* cur        = g_PMM->LUT[0];
+	while (cur)
+	{
+		uint64_t firstPage = (uint64_t) cur / 4096;
+		uint64_t lastPage  = firstPage + cur->Count - 1;
+		if (firstPage < g_PMM->CompactFirstPage || firstPage > g_PMM->CompactLastPage)
+		{
+			PMMTakePages(cur, firstPage, firstPage);
+			target = (void*) (firstPage * 4096);
+			break;
+		}
+		if (lastPage > g_PMM->CompactLastPage)
+		{
+			PMMTakePages(cur, lastPage, lastPage);
+			target = (void*) (lastPage * 4096);
+			break;
+		}
+		cur = cur->Next;
+	}
+	MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
+	return target;
+}
+
+void PMMSetEvictHandler(PMMEvictFn handler)
+{
+	struct MCSNode node;
+	bool           interrupts = MCSLockAcquireIRQSave(&g_PMM->Lock, &node);
+	g_PMM->EvictHandler       = handler;
+	PMMFillEvictReserve(PMM_EVICT_RESERVE);
+	MCSLockReleaseIRQRestore(&g_PMM->Lock, &node, interrupts);
+}
+
+size_t PMMEvict(size_t count)
+{
+	// Eviction allocates as well, those allocations must not recurse into it, and only one processor evicts at a time
+	// Interrupts stay disabled throughout, so the processor index identifies the allocations made on behalf of eviction
+	if (!g_PMM->EvictHandler || count == 0)
+		return 0;
+	bool     interrupts = SaveAndDisableInterrupts();
+	uint32_t noOne      = 0;
+	if (!__atomic_compare_exchange_n(&g_PMM->Evicting, &noOne, CPUGetIndex() + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+		RestoreInterrupts(interrupts);
+		return 0;
+	}
+
+	struct MCSNode node;
+	MCSLockAcquire(&g_PMM->Lock, &node);
+	uint64_t freeBefore = g_PMM->Stats.PagesFree;
+	MCSLockRelease(&g_PMM->Lock, &node);
+	size_t evicted = g_PMM->EvictHandler(count);
+	__atomic_store_n(&g_PMM->Evicting, 0, __ATOMIC_RELEASE);
+
+	MCSLockAcquire(&g_PMM->Lock, &node);
+	++g_PMM->Stats.EvictionRuns;
+	g_PMM->Stats.PagesEvicted += evicted;
+	// Evicted frames are only returned once every processor dropped them, a run that returned none leaves the caller without memory
+	uint64_t freed = g_PMM->Stats.PagesFree > freeBefore ? g_PMM->Stats.PagesFree - freeBefore : 0;
+	if (evicted && freed == 0)
+		++g_PMM->Stats.EvictionStalls;
+	// The reserve takes back at most half of what came free, the rest is left for the allocation that is waiting
+	PMMFillEvictReserve(freed / 2);
+	MCSLockRelease(&g_PMM->Lock, &node);
+	RestoreInterrupts(interrupts);
+	return evicted;
 }
 
 #endif
\ No newline at end of file
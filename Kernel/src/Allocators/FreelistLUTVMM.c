@@ -4,10 +4,30 @@
 #if VMM_USE_FREELIST_LUT
 
 	#include "VMM.h"
+	#include "Build.h"
+	#include "CPU.h"
+	#include "Halt.h"
+	#include "Lock.h"
 	#include "PMM.h"
+	#include "SMPCall.h"
+	#include "Slab.h"
+	#include "Swap.h"
 
 	#include <string.h>
 
+	#define VMM_TABLE_CACHE_BATCH 16          // Table pairs requested from the PMM per refill
+	#define VMM_TABLE_CACHE_HIGH  64          // Cached table pairs above which the cache is drained back to half
+	#define VMM_BATCH_MAX_RANGES  16          // Pending ranges tracked before a batch falls back to a full flush
+	#define VMM_BATCH_MAX_PAGES   32          // Pending pages above which a full flush is cheaper than INVLPG per page
+	#define VMM_BATCH_MAX_FRAMES  32          // Released frame runs held by a batch before it shoots down early to return them
+	#define VMM_ZERO_LEAF         0b100       // Free entry flag of owned 4 KiB leaves still mapping the zero frame, bits 3-4 hold their real protection
+	#define VMM_PAGEABLE_LEAF     0b10'0000   // Free entry flag of owned 4 KiB leaves the eviction clock may push into the swap pool
+	#define VMM_SWAPPED_LEAF      0b100'0000  // Free entry flag of pageable leaves held in the swap pool, the page table entry holds the swap handle and bits 3-4 the protection
+	#define VMM_SHARED_LEAF       0b1000'0000 // Free entry flag of owned leaves mapped by several tables, bits 8 and up hold their struct VMMSharedFrame
+	#define VMM_CLOCK_SWEEPS      2           // Full clock revolutions per eviction, the first may only take away second chances
+	#define VMM_EVICT_CHUNK       16          // Leaves the eviction clock unmaps before one shootdown lets it compress all of them
+	#define VMM_MIGRATE_CHUNK     16          // Leaves migration write protects before one shootdown lets it copy all of them
+
 struct VMMFreeEntry
 {
 	uint64_t             Start;
@@ -16,35 +36,150 @@ struct VMMFreeEntry
 	struct VMMFreeEntry* Next;
 };
 
-struct VMMFreePage
+// Frames of shared leaves are returned once the last leaf referencing them is freed
+struct VMMSharedFrame
+{
+	uint64_t Frame;
+	uint64_t PageCount;
+	uint64_t References;
+};
+
+// Leaves the eviction clock unmapped, they are only compressed once no processor can write to their frames anymore
+struct VMMEvictChunk
+{
+	size_t    Count;
+	uint64_t* PageTableEntries[VMM_EVICT_CHUNK];
+	uint64_t* FreeTableEntries[VMM_EVICT_CHUNK];
+	uint64_t  Entries[VMM_EVICT_CHUNK]; // Page table entries from before the leaves were unmapped
+};
+
+// Leaves migration write protected, they are only copied once no processor can write to their old frames anymore
+struct VMMMigrateChunk
+{
+	size_t    Count;
+	uint64_t  Pages[VMM_MIGRATE_CHUNK];
+	uint64_t* PageTableEntries[VMM_MIGRATE_CHUNK];
+	uint64_t  Entries[VMM_MIGRATE_CHUNK]; // Page table entries from before the leaves were write protected
+	void*     Targets[VMM_MIGRATE_CHUNK];
+};
+
+// Recursive per processor and held with interrupts disabled, an address space is edited from page faults and PMM handlers as well
+struct VMMLock
+{
+	struct TicketLock Lock;
+	uint32_t          Owner; // Index + 1 of the holding processor, 0 while free
+	uint32_t          Depth;
+	bool              Interrupts; // Restored once the outermost hold is released
+};
+
+struct VMMBatch
 {
-	uint64_t            Bitmap[2];
-	struct VMMFreePage* PrevFreePage;
-	struct VMMFreePage* NextFreePage;
-	struct VMMFreeEntry Entries[127];
+	uint32_t Depth;
+	uint32_t RangeCount;
+	uint32_t FrameCount;
+	bool     FlushAll;
+	uint64_t PageCount;
+	uint64_t Ranges[VMM_BATCH_MAX_RANGES][2]; // First and last page of each pending range
+	uint64_t Frames[VMM_BATCH_MAX_FRAMES][2]; // Address and page count of each run of owned frames released during the batch
+
+	uint64_t* DeferredTables; // Free tables released during the batch, [0] links to the next one and [1] holds its paired page table
 };
 
 struct VMMState
 {
+	struct VMMLock        Lock; // Taken by every public function, open batches keep holding it
 	struct VMMMemoryStats Stats;
 
 	uint8_t   Levels;
 	bool      Supports1GiB;
+	bool      GlobalPages;
 	uint64_t* PageTableRoot;
 	uint64_t* FreeTableRoot;
 
-	struct VMMFreePage* FirstFreePage;
-	struct VMMFreePage* LastFreePage;
+	uint64_t* TableCache; // Zeroed page table pages, [0] links to the next cached page table and [1] holds its paired free table
+	size_t    TableCacheCount;
+
+	struct VMMBatch Batch;
+
+	uint64_t ClockHand; // Next page the eviction clock looks at
+
+	struct VMMState* PrevState; // All address spaces are linked so the PMM can migrate their owned frames
+	struct VMMState* NextState;
 
 	struct VMMFreeEntry* Last;
 	struct VMMFreeEntry* LUT[255];
 };
 
-extern uint64_t  VMMArchConstructPageTableEntry(uint64_t physicalAddress, enum VMMPageType type, enum VMMPageProtect protect);
+// Free entries are shared by all address spaces, free tables rely on them being 32 byte aligned
+static struct SlabCache g_VMMFreeEntryCache;
+static struct SlabCache g_VMMSharedFrameCache;
+static struct VMMState* g_VMMStates    = nullptr;
+static struct VMMLock   g_VMMStatesLock; // Taken after the lock of an address space, never while waiting for one
+static uint64_t         g_VMMZeroFrame = 0;
+
+extern uint64_t  VMMArchConstructPageTableEntry(uint64_t physicalAddress, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType, bool global);
 extern uint64_t  VMMArchConstructPageTablePointer(uint64_t* subTableAddress);
-extern void      VMMArchGetPageTableEntry(uint64_t entry, uint8_t level, uint64_t* physicalAddress, enum VMMPageType* type, enum VMMPageProtect* protect);
+extern void      VMMArchGetPageTableEntry(uint64_t entry, uint8_t level, uint64_t* physicalAddress, enum VMMPageType* type, enum VMMPageProtect* protect, enum VMMMemoryType* memoryType);
 extern uint64_t* VMMArchGetPageTablePointer(uint64_t entry);
 extern void      VMMArchActivate(uint64_t* pageTableRoot, uint8_t levels, bool use1GiB);
+extern bool      VMMArchIsActive(uint64_t* pageTableRoot);
+extern void      VMMArchInvalidatePage(uint64_t virtualAddress);
+extern void      VMMArchFlushAll(void);
+extern bool      VMMArchClearAccessed(uint64_t* entry);
+extern uint64_t  VMMArchConstructSwapEntry(void* handle);
+extern void*     VMMArchGetSwapEntry(uint64_t entry);
+
+static void VMMLockAcquire(struct VMMLock* lock)
+{
+	bool     interrupts = SaveAndDisableInterrupts();
+	uint32_t self       = CPUGetIndex() + 1;
+	if (__atomic_load_n(&lock->Owner, __ATOMIC_RELAXED) == self)
+	{
+		++lock->Depth;
+		return;
+	}
+	// The holder may be waiting on this processor to flush a batch, so the calls sent here keep running while it spins
+	while (!TicketLockTryAcquire(&lock->Lock))
+	{
+		SMPCallPoll();
+	#if BUILD_IS_ARCH_X86_64
+		__builtin_ia32_pause();
+	#endif
+	}
+	__atomic_store_n(&lock->Owner, self, __ATOMIC_RELAXED);
+	lock->Depth      = 1;
+	lock->Interrupts = interrupts;
+}
+
+static bool VMMLockTryAcquire(struct VMMLock* lock)
+{
+	bool     interrupts = SaveAndDisableInterrupts();
+	uint32_t self       = CPUGetIndex() + 1;
+	if (__atomic_load_n(&lock->Owner, __ATOMIC_RELAXED) == self)
+	{
+		++lock->Depth;
+		return true;
+	}
+	if (!TicketLockTryAcquire(&lock->Lock))
+	{
+		RestoreInterrupts(interrupts);
+		return false;
+	}
+	__atomic_store_n(&lock->Owner, self, __ATOMIC_RELAXED);
+	lock->Depth      = 1;
+	lock->Interrupts = interrupts;
+	return true;
+}
+
+static void VMMLockRelease(struct VMMLock* lock)
+{
+	if (--lock->Depth > 0)
+		return;
+	bool interrupts = lock->Interrupts;
+	__atomic_store_n(&lock->Owner, 0, __ATOMIC_RELAXED);
+	TicketLockRelease(&lock->Lock);
+	RestoreInterrupts(interrupts);
+}
 
 static uint64_t VMMGetLUTValue(uint8_t index)
 {
@@ -67,27 +202,325 @@ static uint8_t VMMGetLUTCeilIndex(uint64_t value)
 	return (255 - __builtin_clzll(value - 193));
 }
 
-static void VMMPageTableFreeRecursively(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint8_t level)
+static void VMMStatsAddLeaves(struct VMMState* state, uint8_t level, int64_t count)
+{
+	switch (level)
+	{
+	case 0: state->Stats.Mapped4KiB += count; break;
+	case 1: state->Stats.Mapped2MiB += count; break;
+	case 2: state->Stats.Mapped1GiB += count; break;
+	}
+}
+
+static struct VMMSharedFrame* VMMGetSharedFrame(uint64_t freeEntry)
+{
+	return (struct VMMSharedFrame*) (freeEntry >> 8);
+}
+
+// Zero leaves are mapped without write access until their first write
+static enum VMMPageProtect VMMZeroProtect(enum VMMPageProtect protect)
+{
+	switch (protect)
+	{
+	case VMM_PAGE_PROTECT_READ_WRITE: return VMM_PAGE_PROTECT_READ_ONLY;
+	case VMM_PAGE_PROTECT_READ_WRITE_EXECUTE: return VMM_PAGE_PROTECT_READ_EXECUTE;
+	default: return protect;
+	}
+}
+
+static void VMMTableCachePush(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable)
+{
+	pageTable[0]      = (uint64_t) state->TableCache;
+	pageTable[1]      = (uint64_t) freeTable;
+	state->TableCache = pageTable;
+	++state->TableCacheCount;
+}
+
+static void VMMTableCacheRefill(struct VMMState* state)
+{
+	uint64_t* batch = (uint64_t*) PMMAlloc(2 * VMM_TABLE_CACHE_BATCH);
+	if (batch)
+	{
+		memset(batch, 0, 2 * VMM_TABLE_CACHE_BATCH * 4096);
+		for (size_t i = 0; i < VMM_TABLE_CACHE_BATCH; ++i)
+			VMMTableCachePush(state, batch + i * 1024, batch + i * 1024 + 512);
+		state->Stats.AllocatorFootprint += 2 * VMM_TABLE_CACHE_BATCH * 4096;
+		return;
+	}
+
+	for (size_t i = 0; i < VMM_TABLE_CACHE_BATCH; ++i)
+	{
+		uint64_t* pageTable = (uint64_t*) PMMAlloc(2);
+		uint64_t* freeTable = nullptr;
+		if (pageTable)
+		{
+			freeTable = pageTable + 512;
+		}
+		else
+		{
+			pageTable = (uint64_t*) PMMAlloc(1);
+			if (!pageTable)
+				return;
+			freeTable = (uint64_t*) PMMAlloc(1);
+			if (!freeTable)
+			{
+				PMMFree(pageTable, 1);
+				return;
+			}
+		}
+		memset(pageTable, 0, 4096);
+		memset(freeTable, 0, 4096);
+		VMMTableCachePush(state, pageTable, freeTable);
+		state->Stats.AllocatorFootprint += 8192;
+	}
+}
+
+static bool VMMTableCacheTake(struct VMMState* state, uint64_t** pageTable, uint64_t** freeTable)
+{
+	if (!state->TableCache)
+	{
+		VMMTableCacheRefill(state);
+		if (!state->TableCache)
+			return false;
+	}
+
+	uint64_t* table   = state->TableCache;
+	state->TableCache = (uint64_t*) table[0];
+	--state->TableCacheCount;
+	*pageTable = table;
+	*freeTable = (uint64_t*) table[1];
+	table[0]   = 0;
+	table[1]   = 0;
+	return true;
+}
+
+static void VMMTableCacheDrain(struct VMMState* state, size_t keep)
+{
+	while (state->TableCacheCount > keep)
+	{
+		uint64_t* table   = state->TableCache;
+		state->TableCache = (uint64_t*) table[0];
+		--state->TableCacheCount;
+		PMMFree((void*) table[1], 1);
+		PMMFree(table, 1);
+		state->Stats.AllocatorFootprint -= 8192;
+	}
+}
+
+static void VMMTableCacheGive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable)
+{
+	memset(pageTable, 0, 4096);
+	memset(freeTable, 0, 4096);
+	VMMTableCachePush(state, pageTable, freeTable);
+	if (state->TableCacheCount > VMM_TABLE_CACHE_HIGH)
+		VMMTableCacheDrain(state, VMM_TABLE_CACHE_HIGH / 2);
+}
+
+static void VMMTableRelease(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint8_t level)
+{
+	--state->Stats.TablePages[level];
+	if (state->Batch.Depth == 0)
+	{
+		VMMTableCacheGive(state, pageTable, freeTable);
+		return;
+	}
+
+	// The page table may still be cached by the MMU until the batch is flushed, so it is left untouched and linked through its free table instead
+	freeTable[0]                = (uint64_t) state->Batch.DeferredTables;
+	freeTable[1]                = (uint64_t) pageTable;
+	state->Batch.DeferredTables = freeTable;
+}
+
+static void VMMBatchAddRange(struct VMMState* state, uint64_t firstPage, uint64_t lastPage)
+{
+	struct VMMBatch* batch = &state->Batch;
+	if (batch->FlushAll)
+		return;
+
+	batch->PageCount += lastPage - firstPage + 1;
+	if (batch->PageCount > VMM_BATCH_MAX_PAGES)
+	{
+		batch->FlushAll = true;
+		return;
+	}
+
+	if (batch->RangeCount > 0)
+	{
+		uint64_t* last = batch->Ranges[batch->RangeCount - 1];
+		if (firstPage <= last[1] + 1 && lastPage + 1 >= last[0])
+		{
+			last[0] = firstPage < last[0] ? firstPage : last[0];
+			last[1] = lastPage > last[1] ? lastPage : last[1];
+			return;
+		}
+	}
+	if (batch->RangeCount == VMM_BATCH_MAX_RANGES)
+	{
+		batch->FlushAll = true;
+		return;
+	}
+	batch->Ranges[batch->RangeCount][0] = firstPage;
+	batch->Ranges[batch->RangeCount][1] = lastPage;
+	++batch->RangeCount;
+}
+
+// Runs on every processor, the flushing one waits for all of them before it touches the batch again
+static void VMMBatchInvalidate(void* userdata)
+{
+	struct VMMState* state = (struct VMMState*) userdata;
+	struct VMMBatch* batch = &state->Batch;
+	if (!VMMArchIsActive(state->PageTableRoot))
+		return;
+
+	if (batch->FlushAll)
+	{
+		VMMArchFlushAll();
+	}
+	else if (batch->RangeCount > 0)
+	{
+		for (uint32_t i = 0; i < batch->RangeCount; ++i)
+		{
+			for (uint64_t page = batch->Ranges[i][0]; page <= batch->Ranges[i][1]; ++page)
+				VMMArchInvalidatePage(page * 4096);
+		}
+	}
+	else
+	{
+		// INVLPG drops every paging-structure cache entry regardless of address, which is all freed tables need
+		VMMArchInvalidatePage(0);
+	}
+}
+
+// Invalidates the pending ranges everywhere and returns the released frames, the ranges stay pending as their leaves may still change
+static void VMMBatchShootdown(struct VMMState* state)
+{
+	struct VMMBatch* batch = &state->Batch;
+	// The whole batch goes out as one call, so other processors take a single interrupt however many pages changed
+	VMMBatchInvalidate(state);
+	SMPCallAll(VMMBatchInvalidate, state, true);
+
+	for (uint32_t i = 0; i < batch->FrameCount; ++i)
+		PMMFree((void*) batch->Frames[i][0], batch->Frames[i][1]);
+	batch->FrameCount = 0;
+}
+
+static void VMMBatchFlush(struct VMMState* state)
+{
+	struct VMMBatch* batch = &state->Batch;
+	if (!batch->FlushAll && batch->RangeCount == 0 && !batch->DeferredTables && batch->FrameCount == 0)
+		return;
+
+	VMMBatchShootdown(state);
+	while (batch->DeferredTables)
+	{
+		uint64_t* freeTable   = batch->DeferredTables;
+		uint64_t* pageTable   = (uint64_t*) freeTable[1];
+		batch->DeferredTables = (uint64_t*) freeTable[0];
+		if (state->TableCacheCount < VMM_TABLE_CACHE_HIGH)
+		{
+			VMMTableCacheGive(state, pageTable, freeTable);
+		}
+		else
+		{
+			// Zeroing tables that go straight back to the PMM is wasted bandwidth
+			PMMFree(freeTable, 1);
+			PMMFree(pageTable, 1);
+			state->Stats.AllocatorFootprint -= 8192;
+		}
+	}
+
+	batch->RangeCount = 0;
+	batch->PageCount  = 0;
+	batch->FlushAll   = false;
+}
+
+// Expects the range mapping the frames to be cleared and pending already, a full batch may return them before the commit
+static void VMMBatchDeferFrames(struct VMMState* state, uint64_t physicalAddress, uint64_t count)
+{
+	// Stale translations may still write to the frames until the shootdown, so nothing is kept in the frames themselves
+	struct VMMBatch* batch = &state->Batch;
+	if (batch->FrameCount > 0)
+	{
+		uint64_t* last = batch->Frames[batch->FrameCount - 1];
+		if (last[0] + last[1] * 4096 == physicalAddress)
+		{
+			last[1] += count;
+			return;
+		}
+	}
+	if (batch->FrameCount == VMM_BATCH_MAX_FRAMES)
+		VMMBatchShootdown(state);
+	batch->Frames[batch->FrameCount][0] = physicalAddress;
+	batch->Frames[batch->FrameCount][1] = count;
+	++batch->FrameCount;
+}
+
+// Gives up what an owned leaf holds on to and leaves it unowned and unmapped, its frames are returned after the next shootdown
+static void VMMPageTableReleaseLeaf(struct VMMState* state, uint64_t* pageTableEntry, uint64_t* freeTableEntry, uint8_t level)
+{
+	uint64_t freeEntry = *freeTableEntry;
+	*freeTableEntry    = 0b11;
+	if (freeEntry & VMM_ZERO_LEAF)
+		return;
+	if (freeEntry & VMM_SWAPPED_LEAF)
+	{
+		SwapRelease(VMMArchGetSwapEntry(*pageTableEntry));
+		*pageTableEntry = 0;
+		--state->Stats.SwappedPages;
+		return;
+	}
+	if (freeEntry & VMM_SHARED_LEAF)
+	{
+		struct VMMSharedFrame* shared = VMMGetSharedFrame(freeEntry);
+		*pageTableEntry               = 0;
+		if (--shared->References == 0)
+		{
+			VMMBatchDeferFrames(state, shared->Frame, shared->PageCount);
+			SlabFree(&g_VMMSharedFrameCache, shared);
+		}
+		return;
+	}
+	uint64_t physicalAddress;
+	VMMArchGetPageTableEntry(*pageTableEntry, level, &physicalAddress, nullptr, nullptr, nullptr);
+	*pageTableEntry = 0;
+	if (physicalAddress)
+		VMMBatchDeferFrames(state, physicalAddress, 1UL << (9 * level));
+}
+
+static void VMMPageTableFreeChildren(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint8_t level)
 {
 	for (uint16_t i = 0; i < 512; ++i)
 	{
 		uint64_t freeEntry = freeTable[i];
-		switch (freeEntry)
+		switch (freeEntry & 3)
 		{
 		case 0b00: break;
 		case 0b01:
-			VMMPageTableFreeRecursively(state, (uint64_t*) (pageTable[i] & 0xF'FFFF'FFFF'F000UL), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), level - 1);
+		{
+			uint64_t* subPageTable = VMMArchGetPageTablePointer(pageTable[i]);
+			uint64_t* subFreeTable = (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL);
+			VMMPageTableFreeChildren(state, subPageTable, subFreeTable, level - 1);
+			VMMTableRelease(state, subPageTable, subFreeTable, level - 1);
 			break;
+		}
 		case 0b10:
-		case 0b11: break;
+			VMMPageTableReleaseLeaf(state, &pageTable[i], &freeTable[i], level);
+			VMMStatsAddLeaves(state, level, -1);
+			break;
+		case 0b11:
+			VMMStatsAddLeaves(state, level, -1);
+			break;
 		}
 	}
-	PMMFree(pageTable, 1);
-	PMMFree(freeTable, 1);
-	state->Stats.AllocatorFootprint -= 8192;
 }
 
-static void VMMPageTableMap(struct VMMState* state, uint64_t page, uint64_t physicalAddress)
+static void VMMPageTableFreeRecursively(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint8_t level)
+{
+	VMMPageTableFreeChildren(state, pageTable, freeTable, level);
+	VMMTableRelease(state, pageTable, freeTable, level);
+}
+
+static bool VMMPageTableMap(struct VMMState* state, uint64_t page, uint64_t physicalAddress)
 {
 	uint64_t* pageTable = state->PageTableRoot;
 	uint64_t* freeTable = state->FreeTableRoot;
@@ -97,23 +530,33 @@ static void VMMPageTableMap(struct VMMState* state, uint64_t page, uint64_t phys
 		uint64_t freeEntry = freeTable[entry];
 		switch (freeEntry & 3)
 		{
-		case 0b00: return;
+		case 0b00: return false;
 		case 0b01:
 			pageTable = VMMArchGetPageTablePointer(pageTable[entry]);
 			freeTable = (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL);
 			break;
 		case 0b10:
 		case 0b11:
+			uint64_t            oldPhysicalAddress;
 			enum VMMPageType    type;
 			enum VMMPageProtect protect;
-			VMMArchGetPageTableEntry(pageTable[entry], i, nullptr, &type, &protect);
-			pageTable[entry] = VMMArchConstructPageTableEntry(physicalAddress, type, protect);
-			return;
+			enum VMMMemoryType  memoryType;
+			VMMArchGetPageTableEntry(pageTable[entry], i, &oldPhysicalAddress, &type, &protect, &memoryType);
+			// Other processors may still cache the old translation, swapped entries were never present
+			if (oldPhysicalAddress && !(freeEntry & VMM_SWAPPED_LEAF))
+			{
+				uint64_t leafPage = page & ~((1UL << (9 * i)) - 1);
+				VMMBatchAddRange(state, leafPage, leafPage + (1UL << (9 * i)) - 1);
+			}
+			pageTable[entry] = VMMArchConstructPageTableEntry(physicalAddress, type, protect, memoryType, state->GlobalPages);
+			return true;
 		}
 	}
+	return false;
 }
 
-static uint64_t VMMPageTableMapLinearRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t firstPage, uint64_t lastPage, uint64_t physicalAddress, uint8_t level)
+// Clears mapped when part of the range is not allocated, those pages are skipped
+static uint64_t VMMPageTableMapLinearRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t basePage, uint64_t firstPage, uint64_t lastPage, uint64_t physicalAddress, enum VMMMemoryType memoryType, uint8_t level, bool* mapped)
 {
 	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
 	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
@@ -122,22 +565,31 @@ static uint64_t VMMPageTableMapLinearRecursive(struct VMMState* state, uint64_t*
 		uint64_t freeEntry = freeTable[i];
 		switch (freeEntry & 3)
 		{
-		case 0b00: break;
+		case 0b00:
+			*mapped = false;
+			break;
 		case 0b01:
 		{
 			uint64_t firstSubPage = i == firstEntry ? firstPage - (i << (9 * level)) : 0;
 			uint64_t lastSubPage  = i != lastEntry ? (1 << (9 * level)) - 1 : lastPage - (i << (9 * level));
-			physicalAddress       = VMMPageTableMapLinearRecursive(state, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F0UL), firstSubPage, lastSubPage, physicalAddress, level - 1);
+			physicalAddress       = VMMPageTableMapLinearRecursive(state, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), basePage + ((uint64_t) i << (9 * level)), firstSubPage, lastSubPage, physicalAddress, memoryType, level - 1, mapped);
 			break;
 		}
 		case 0b10:
 		case 0b11:
 		{
+			uint64_t            oldPhysicalAddress;
 			enum VMMPageType    type;
 			enum VMMPageProtect protect;
-			VMMArchGetPageTableEntry(pageTable[i], level, nullptr, &type, &protect);
-			pageTable[i]     = VMMArchConstructPageTableEntry(physicalAddress, type, protect);
-			physicalAddress += 4096 << (9 * level);
+			VMMArchGetPageTableEntry(pageTable[i], level, &oldPhysicalAddress, &type, &protect, nullptr);
+			// Like in VMMPageTableMap
+			if (oldPhysicalAddress && !(freeEntry & VMM_SWAPPED_LEAF))
+			{
+				uint64_t leafPage = basePage + ((uint64_t) i << (9 * level));
+				VMMBatchAddRange(state, leafPage, leafPage + (1UL << (9 * level)) - 1);
+			}
+			pageTable[i]     = VMMArchConstructPageTableEntry(physicalAddress, type, protect, memoryType, state->GlobalPages);
+			physicalAddress += 4096UL << (9 * level);
 			break;
 		}
 		}
@@ -145,9 +597,11 @@ static uint64_t VMMPageTableMapLinearRecursive(struct VMMState* state, uint64_t*
 	return physicalAddress;
 }
 
-static void VMMPageTableMapLinear(struct VMMState* state, uint64_t firstPage, uint64_t lastPage, uint64_t physicalAddress)
+static bool VMMPageTableMapLinear(struct VMMState* state, uint64_t firstPage, uint64_t lastPage, uint64_t physicalAddress, enum VMMMemoryType memoryType)
 {
-	VMMPageTableMapLinearRecursive(state, state->PageTableRoot, state->FreeTableRoot, firstPage, lastPage, physicalAddress, state->Levels - 1);
+	bool mapped = true;
+	VMMPageTableMapLinearRecursive(state, state->PageTableRoot, state->FreeTableRoot, 0, firstPage, lastPage, physicalAddress, memoryType, state->Levels - 1, &mapped);
+	return mapped;
 }
 
 static void* VMMPageTableGetPhysicalAddress(struct VMMState* state, uint64_t page)
@@ -156,140 +610,851 @@ static void* VMMPageTableGetPhysicalAddress(struct VMMState* state, uint64_t pag
 	uint64_t* freeTable = state->FreeTableRoot;
 	for (uint8_t i = state->Levels; i-- > 0;)
 	{
-		uint16_t entry     = (page >> (9 * i)) & 511;
-		uint64_t freeEntry = freeTable[entry];
+		++state->Stats.TranslationSteps;
+		uint16_t entry     = (page >> (9 * i)) & 511;
+		uint64_t freeEntry = freeTable[entry];
+		switch (freeEntry & 3)
+		{
+		case 0b00: return nullptr;
+		case 0b01:
+			pageTable = VMMArchGetPageTablePointer(pageTable[entry]);
+			freeTable = (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL);
+			break;
+		case 0b10:
+		case 0b11:
+			if (freeEntry & VMM_SWAPPED_LEAF)
+				return nullptr;
+			uint64_t physicalAddress;
+			VMMArchGetPageTableEntry(pageTable[entry], i, &physicalAddress, nullptr, nullptr, nullptr);
+			return (void*) physicalAddress;
+		}
+	}
+	return nullptr;
+}
+
+static void VMMPageTableFillProtectRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t firstPage, uint64_t lastPage, enum VMMPageProtect protect, uint8_t level)
+{
+	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
+	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
+	for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+	{
+		uint64_t freeEntry = freeTable[i];
+		switch (freeEntry & 3)
+		{
+		case 0b00: break;
+		case 0b01:
+		{
+			uint64_t firstSubPage = i == firstEntry ? firstPage - (i << (9 * level)) : 0;
+			uint64_t lastSubPage  = i != lastEntry ? (1 << (9 * level)) - 1 : lastPage - (i << (9 * level));
+			VMMPageTableFillProtectRecursive(state, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F0UL), firstSubPage, lastSubPage, protect, level - 1);
+			break;
+		}
+		case 0b10:
+		case 0b11:
+		{
+			if (freeEntry & VMM_SWAPPED_LEAF)
+			{
+				freeTable[i] = (freeEntry & ~0b1'1000UL) | ((uint64_t) protect << 3);
+				break;
+			}
+
+			uint64_t           physicalAddress;
+			enum VMMPageType   type;
+			enum VMMMemoryType memoryType;
+			VMMArchGetPageTableEntry(pageTable[i], level, &physicalAddress, &type, nullptr, &memoryType);
+			if (freeEntry & VMM_ZERO_LEAF)
+			{
+				freeTable[i] = (freeEntry & 0b111) | ((uint64_t) protect << 3);
+				pageTable[i] = VMMArchConstructPageTableEntry(physicalAddress, type, VMMZeroProtect(protect), memoryType, state->GlobalPages);
+			}
+			else
+			{
+				pageTable[i] = VMMArchConstructPageTableEntry(physicalAddress, type, protect, memoryType, state->GlobalPages);
+			}
+			break;
+		}
+		}
+	}
+}
+
+static void VMMPageTableFillProtect(struct VMMState* state, uint64_t firstPage, uint64_t lastPage, enum VMMPageProtect protect)
+{
+	VMMPageTableFillProtectRecursive(state, state->PageTableRoot, state->FreeTableRoot, firstPage, lastPage, protect, state->Levels - 1);
+}
+
+static void VMMPageTableFillUsedRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t firstPage, uint64_t lastPage, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType, bool owned, uint8_t level)
+{
+	uint8_t minLevel = 0;
+	switch (type)
+	{
+	case VMM_PAGE_TYPE_4KIB:
+	case VMM_PAGE_TYPE_AUTO:
+	case VMM_PAGE_TYPE_ZERO:
+	case VMM_PAGE_TYPE_PAGEABLE: minLevel = 0; break;
+	case VMM_PAGE_TYPE_2MIB: minLevel = 1; break;
+	case VMM_PAGE_TYPE_1GIB: minLevel = 2; break;
+	}
+
+	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
+	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
+	if (level == minLevel)
+	{
+		for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+		{
+			pageTable[i] = VMMArchConstructPageTableEntry(0, type, protect, memoryType, state->GlobalPages);
+			freeTable[i] = owned ? 2 : 3; // Owned leaves have their frames returned by VMMFree
+		}
+		VMMStatsAddLeaves(state, level, lastEntry - firstEntry + 1);
+	}
+	else
+	{
+		for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+		{
+			uint64_t  freeEntry     = freeTable[i];
+			uint64_t* nextPageTable = nullptr;
+			uint64_t* nextFreeTable = nullptr;
+			if (freeEntry & 1)
+			{
+				nextPageTable = VMMArchGetPageTablePointer(pageTable[i]);
+				nextFreeTable = (uint64_t*) (freeTable[i] & 0xF'FFFF'FFFF'F000UL);
+			}
+			else
+			{
+				if (!VMMTableCacheTake(state, &nextPageTable, &nextFreeTable))
+				{
+					// TODO(MarcasRealAccount): PANIC
+					return;
+				}
+
+				pageTable[i] = VMMArchConstructPageTablePointer(nextPageTable);
+				freeTable[i] = 1 | ((uint64_t) nextFreeTable & 0xF'FFFF'FFFF'F000UL);
+				++state->Stats.TablePages[level - 1];
+			}
+
+			uint64_t firstSubPage = i == firstEntry ? firstPage - (i << (9 * level)) : 0;
+			uint64_t lastSubPage  = i != lastEntry ? (1 << (9 * level)) - 1 : lastPage - (i << (9 * level));
+			VMMPageTableFillUsedRecursive(state, nextPageTable, nextFreeTable, firstSubPage, lastSubPage, type, protect, memoryType, owned, level - 1);
+		}
+	}
+}
+
+static void VMMPageTableFillUsed(struct VMMState* state, uint64_t firstPage, uint64_t lastPage, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType, bool owned)
+{
+	++state->Stats.Fills;
+	VMMPageTableFillUsedRecursive(state, state->PageTableRoot, state->FreeTableRoot, firstPage, lastPage, type, protect, memoryType, owned, state->Levels - 1);
+}
+
+static bool VMMPageTableFillOwned(struct VMMState* state, uint64_t firstPage, uint64_t lastPage, enum VMMPageProtect protect, enum VMMMemoryType memoryType)
+{
+	uint64_t page = firstPage;
+	while (page <= lastPage)
+	{
+		uint64_t remaining = lastPage - page + 1;
+		if (state->Supports1GiB && (page & 0x3'FFFF) == 0 && remaining >= 0x4'0000)
+		{
+			void* frame = PMMAllocAligned(0x4'0000, 30);
+			if (frame)
+			{
+				VMMPageTableFillUsed(state, page, page + 0x3'FFFF, VMM_PAGE_TYPE_1GIB, protect, memoryType, true);
+				VMMPageTableMapLinear(state, page, page + 0x3'FFFF, (uint64_t) frame, memoryType);
+				page += 0x4'0000;
+				continue;
+			}
+		}
+		if ((page & 511) == 0 && remaining >= 512)
+		{
+			void* frame = PMMAllocAligned(512, 21);
+			if (frame)
+			{
+				VMMPageTableFillUsed(state, page, page + 511, VMM_PAGE_TYPE_2MIB, protect, memoryType, true);
+				VMMPageTableMapLinear(state, page, page + 511, (uint64_t) frame, memoryType);
+				page += 512;
+				continue;
+			}
+		}
+
+		// Fall back to 4 KiB leaves up to the next 2 MiB boundary
+		uint64_t run = 512 - (page & 511);
+		if (run > remaining)
+			run = remaining;
+		VMMPageTableFillUsed(state, page, page + run - 1, VMM_PAGE_TYPE_4KIB, protect, memoryType, true);
+		for (uint64_t i = 0; i < run; ++i)
+		{
+			void* frame = PMMAlloc(1);
+			if (!frame)
+			{
+				if (page + run <= lastPage)
+					VMMPageTableFillUsed(state, page + run, lastPage, VMM_PAGE_TYPE_4KIB, protect, memoryType, true);
+				return false;
+			}
+			VMMPageTableMap(state, page + i, (uint64_t) frame);
+		}
+		page += run;
+	}
+	return true;
+}
+
+static void VMMPageTableMapZeroRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t firstPage, uint64_t lastPage, enum VMMPageProtect protect, enum VMMMemoryType memoryType, uint8_t level)
+{
+	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
+	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
+	for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+	{
+		uint64_t freeEntry = freeTable[i];
+		switch (freeEntry & 3)
+		{
+		case 0b00: break;
+		case 0b01:
+		{
+			uint64_t firstSubPage = i == firstEntry ? firstPage - (i << (9 * level)) : 0;
+			uint64_t lastSubPage  = i != lastEntry ? (1 << (9 * level)) - 1 : lastPage - (i << (9 * level));
+			VMMPageTableMapZeroRecursive(state, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), firstSubPage, lastSubPage, protect, memoryType, level - 1);
+			break;
+		}
+		case 0b10:
+		case 0b11:
+			pageTable[i] = VMMArchConstructPageTableEntry(g_VMMZeroFrame, VMM_PAGE_TYPE_4KIB, VMMZeroProtect(protect), memoryType, state->GlobalPages);
+			freeTable[i] = 0b10 | VMM_ZERO_LEAF | ((uint64_t) protect << 3);
+			break;
+		}
+	}
+}
+
+static bool VMMPageTableFillZero(struct VMMState* state, uint64_t firstPage, uint64_t lastPage, enum VMMPageProtect protect, enum VMMMemoryType memoryType)
+{
+	if (!g_VMMZeroFrame)
+	{
+		void* frame = PMMAlloc(1);
+		if (!frame)
+			return false;
+		memset(frame, 0, 4096);
+		g_VMMZeroFrame = (uint64_t) frame;
+	}
+
+	VMMPageTableFillUsed(state, firstPage, lastPage, VMM_PAGE_TYPE_4KIB, protect, memoryType, true);
+	VMMPageTableMapZeroRecursive(state, state->PageTableRoot, state->FreeTableRoot, firstPage, lastPage, protect, memoryType, state->Levels - 1);
+	return true;
+}
+
+static bool VMMPageTableMapPageableRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t firstPage, uint64_t lastPage, enum VMMPageProtect protect, enum VMMMemoryType memoryType, uint8_t level)
+{
+	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
+	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
+	for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+	{
+		uint64_t freeEntry = freeTable[i];
+		switch (freeEntry & 3)
+		{
+		case 0b00: break;
+		case 0b01:
+		{
+			uint64_t firstSubPage = i == firstEntry ? firstPage - (i << (9 * level)) : 0;
+			uint64_t lastSubPage  = i != lastEntry ? (1 << (9 * level)) - 1 : lastPage - (i << (9 * level));
+			if (!VMMPageTableMapPageableRecursive(state, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), firstSubPage, lastSubPage, protect, memoryType, level - 1))
+				return false;
+			break;
+		}
+		case 0b10:
+		case 0b11:
+		{
+			void* frame = PMMAlloc(1);
+			if (!frame)
+				return false;
+			pageTable[i] = VMMArchConstructPageTableEntry((uint64_t) frame, VMM_PAGE_TYPE_4KIB, protect, memoryType, state->GlobalPages);
+			freeTable[i] = 0b10 | VMM_PAGEABLE_LEAF;
+			break;
+		}
+		}
+	}
+	return true;
+}
+
+static bool VMMPageTableFillPageable(struct VMMState* state, uint64_t firstPage, uint64_t lastPage, enum VMMPageProtect protect, enum VMMMemoryType memoryType)
+{
+	// Leaves left without a frame stay owned but unmapped, VMMFree skips them
+	VMMPageTableFillUsed(state, firstPage, lastPage, VMM_PAGE_TYPE_4KIB, protect, memoryType, true);
+	return VMMPageTableMapPageableRecursive(state, state->PageTableRoot, state->FreeTableRoot, firstPage, lastPage, protect, memoryType, state->Levels - 1);
+}
+
+static bool VMMPageTableSwapIn(struct VMMState* state, uint64_t* pageTableEntry, uint64_t* freeTableEntry)
+{
+	void* frame = PMMAlloc(1);
+	if (!frame)
+		return false;
+	if (!SwapLoad(VMMArchGetSwapEntry(*pageTableEntry), frame))
+	{
+		PMMFree(frame, 1);
+		return false;
+	}
+
+	// Only write back leaves are evicted, and non-present entries are never cached, so no invalidation is needed
+	enum VMMPageProtect protect = (enum VMMPageProtect) ((*freeTableEntry >> 3) & 3);
+	*pageTableEntry             = VMMArchConstructPageTableEntry((uint64_t) frame, VMM_PAGE_TYPE_4KIB, protect, VMM_MEMORY_TYPE_WRITE_BACK, state->GlobalPages);
+	*freeTableEntry             = 0b10 | VMM_PAGEABLE_LEAF;
+	--state->Stats.SwappedPages;
+	++state->Stats.SwapIns;
+	return true;
+}
+
+static bool VMMPageTableUnzero(struct VMMState* state, uint64_t* pageTableEntry, uint64_t* freeTableEntry, uint64_t page)
+{
+	enum VMMMemoryType memoryType;
+	VMMArchGetPageTableEntry(*pageTableEntry, 0, nullptr, nullptr, nullptr, &memoryType);
+	void* frame = PMMAlloc(1);
+	if (!frame)
+		return false;
+	memset(frame, 0, 4096);
+
+	enum VMMPageProtect protect = (enum VMMPageProtect) ((*freeTableEntry >> 3) & 3);
+	*pageTableEntry             = VMMArchConstructPageTableEntry((uint64_t) frame, VMM_PAGE_TYPE_4KIB, protect, memoryType, state->GlobalPages);
+	*freeTableEntry             = 0b10;
+	++state->Stats.ZeroFaults;
+	// Other processors may still read the zero frame through their read only translation
+	VMMBatchAddRange(state, page, page);
+	return true;
+}
+
+static bool VMMPageTableHandleFault(struct VMMState* state, uint64_t page, bool write)
+{
+	uint64_t* pageTable = state->PageTableRoot;
+	uint64_t* freeTable = state->FreeTableRoot;
+	for (uint8_t i = state->Levels; i-- > 0;)
+	{
+		uint16_t entry     = (page >> (9 * i)) & 511;
+		uint64_t freeEntry = freeTable[entry];
+		switch (freeEntry & 3)
+		{
+		case 0b00: return false;
+		case 0b01:
+			pageTable = VMMArchGetPageTablePointer(pageTable[entry]);
+			freeTable = (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL);
+			break;
+		case 0b10:
+		case 0b11:
+		{
+			if (freeEntry & VMM_SWAPPED_LEAF)
+				return VMMPageTableSwapIn(state, &pageTable[entry], &freeTable[entry]);
+
+			uint64_t            physicalAddress;
+			enum VMMPageProtect protect;
+			VMMArchGetPageTableEntry(pageTable[entry], i, &physicalAddress, nullptr, &protect, nullptr);
+			if (!(freeEntry & VMM_ZERO_LEAF) || !write)
+			{
+				// Another processor may have resolved the fault already, leaving only a stale TLB entry here
+				if (!physicalAddress || (write && protect != VMM_PAGE_PROTECT_READ_WRITE && protect != VMM_PAGE_PROTECT_READ_WRITE_EXECUTE))
+					return false;
+				VMMArchInvalidatePage(page * 4096);
+				return true;
+			}
+
+			protect = (enum VMMPageProtect) ((freeEntry >> 3) & 3);
+			if (protect != VMM_PAGE_PROTECT_READ_WRITE && protect != VMM_PAGE_PROTECT_READ_WRITE_EXECUTE)
+				return false;
+			return VMMPageTableUnzero(state, &pageTable[entry], &freeTable[entry], page);
+		}
+		}
+	}
+	return false;
+}
+
+// Splits huge leaves until a leaf starts at page, so range operations never spill past their bounds
+// Returns false when no table is left for a split, the leaves split until then map the same pages as before
+static bool VMMPageTableSplitAt(struct VMMState* state, uint64_t page)
+{
+	uint64_t* pageTable = state->PageTableRoot;
+	uint64_t* freeTable = state->FreeTableRoot;
+	for (uint8_t level = state->Levels; level-- > 1;)
+	{
+		uint16_t entry     = (page >> (9 * level)) & 511;
+		uint64_t freeEntry = freeTable[entry];
+		switch (freeEntry & 3)
+		{
+		case 0b00: return true;
+		case 0b01: break;
+		case 0b10:
+		case 0b11:
+		{
+			uint64_t leafMask = (1UL << (9 * level)) - 1;
+			if ((page & leafMask) == 0)
+				return true;
+
+			uint64_t* subPageTable = nullptr;
+			uint64_t* subFreeTable = nullptr;
+			if (!VMMTableCacheTake(state, &subPageTable, &subFreeTable))
+				return false;
+
+			uint64_t            physicalAddress;
+			enum VMMPageProtect protect;
+			enum VMMMemoryType  memoryType;
+			VMMArchGetPageTableEntry(pageTable[entry], level, &physicalAddress, nullptr, &protect, &memoryType);
+			enum VMMPageType subType = level == 2 ? VMM_PAGE_TYPE_2MIB : VMM_PAGE_TYPE_4KIB;
+			uint64_t         subSize = 4096UL << (9 * (level - 1));
+			// Every sub leaf of a shared leaf holds a reference of its own
+			uint64_t subEntry = freeEntry & VMM_SHARED_LEAF ? freeEntry : freeEntry & 3;
+			if (freeEntry & VMM_SHARED_LEAF)
+				VMMGetSharedFrame(freeEntry)->References += 511;
+			for (uint16_t i = 0; i < 512; ++i)
+			{
+				subPageTable[i] = VMMArchConstructPageTableEntry(physicalAddress ? physicalAddress + i * subSize : 0, subType, protect, memoryType, state->GlobalPages);
+				subFreeTable[i] = subEntry;
+			}
+			pageTable[entry] = VMMArchConstructPageTablePointer(subPageTable);
+			freeTable[entry] = 1 | ((uint64_t) subFreeTable & 0xF'FFFF'FFFF'F000UL);
+			++state->Stats.TablePages[level - 1];
+			VMMStatsAddLeaves(state, level, -1);
+			VMMStatsAddLeaves(state, level - 1, 512);
+			// A single INVLPG anywhere in the old leaf drops its TLB entry
+			VMMBatchAddRange(state, page & ~leafMask, page & ~leafMask);
+			break;
+		}
+		}
+		pageTable = VMMArchGetPageTablePointer(pageTable[entry]);
+		freeTable = (uint64_t*) (freeTable[entry] & 0xF'FFFF'FFFF'F000UL);
+	}
+	return true;
+}
+
+static void VMMPageTableReleaseOwnedRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t firstPage, uint64_t lastPage, uint8_t level)
+{
+	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
+	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
+	for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+	{
+		uint64_t freeEntry = freeTable[i];
+		switch (freeEntry & 3)
+		{
+		case 0b00: break;
+		case 0b01:
+		{
+			uint64_t firstSubPage = i == firstEntry ? firstPage - (i << (9 * level)) : 0;
+			uint64_t lastSubPage  = i != lastEntry ? (1 << (9 * level)) - 1 : lastPage - (i << (9 * level));
+			VMMPageTableReleaseOwnedRecursive(state, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), firstSubPage, lastSubPage, level - 1);
+			break;
+		}
+		case 0b10:
+			// Until the range is filled free the leaf counts as unowned, which also keeps the eviction clock away from it
+			VMMPageTableReleaseLeaf(state, &pageTable[i], &freeTable[i], level);
+			break;
+		case 0b11: break;
+		}
+	}
+}
+
+static void VMMPageTableReleaseOwned(struct VMMState* state, uint64_t firstPage, uint64_t lastPage)
+{
+	VMMPageTableReleaseOwnedRecursive(state, state->PageTableRoot, state->FreeTableRoot, firstPage, lastPage, state->Levels - 1);
+}
+
+// Shoots down the write protected leaves of a chunk, then copies them to their new frames and maps those
+static void VMMMigrateChunkCopy(struct VMMState* state, struct VMMMigrateChunk* chunk)
+{
+	if (chunk->Count == 0)
+		return;
+
+	VMMBatchFlush(state);
+	for (size_t i = 0; i < chunk->Count; ++i)
+	{
+		uint64_t            physicalAddress;
+		enum VMMPageProtect protect;
+		enum VMMMemoryType  memoryType;
+		VMMArchGetPageTableEntry(chunk->Entries[i], 0, &physicalAddress, nullptr, &protect, &memoryType);
+		memcpy(chunk->Targets[i], (void*) physicalAddress, 4096);
+		*chunk->PageTableEntries[i] = VMMArchConstructPageTableEntry((uint64_t) chunk->Targets[i], VMM_PAGE_TYPE_4KIB, protect, memoryType, state->GlobalPages);
+		// Readers keep the old frame until the batch is committed
+		VMMBatchAddRange(state, chunk->Pages[i], chunk->Pages[i]);
+		VMMBatchDeferFrames(state, physicalAddress, 1);
+	}
+	chunk->Count = 0;
+}
+
+// Moves owned 4 KiB leaves backed by frames in [firstAddress, lastAddress] to new frames, returns false once no target frames are left
+static bool VMMPageTableMigrateRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t basePage, uint64_t firstAddress, uint64_t lastAddress, uint8_t level, struct VMMMigrateChunk* chunk, size_t* migrated)
+{
+	for (uint16_t i = 0; i < 512; ++i)
+	{
+		uint64_t freeEntry = freeTable[i];
+		if ((freeEntry & 3) == 0b01)
+		{
+			if (!VMMPageTableMigrateRecursive(state, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), basePage + ((uint64_t) i << (9 * level)), firstAddress, lastAddress, level - 1, chunk, migrated))
+				return false;
+			continue;
+		}
+		if (level != 0 || (freeEntry & 3) != 0b10 || (freeEntry & (VMM_ZERO_LEAF | VMM_SWAPPED_LEAF | VMM_SHARED_LEAF)))
+			continue;
+
+		uint64_t            physicalAddress;
+		enum VMMPageProtect protect;
+		enum VMMMemoryType  memoryType;
+		VMMArchGetPageTableEntry(pageTable[i], 0, &physicalAddress, nullptr, &protect, &memoryType);
+		if (physicalAddress < firstAddress || physicalAddress > lastAddress)
+			continue;
+
+		void* frame = PMMAllocMigrationTarget();
+		if (!frame)
+			return false;
+		// Writes on other processors would be lost after the copy, so the leaf stays write protected until the chunk is shot down and copied
+		chunk->Pages[chunk->Count]            = basePage + i;
+		chunk->PageTableEntries[chunk->Count] = &pageTable[i];
+		chunk->Entries[chunk->Count]          = pageTable[i];
+		chunk->Targets[chunk->Count]          = frame;
+		++chunk->Count;
+		pageTable[i] = VMMArchConstructPageTableEntry(physicalAddress, VMM_PAGE_TYPE_4KIB, VMMZeroProtect(protect), memoryType, state->GlobalPages);
+		VMMBatchAddRange(state, basePage + i, basePage + i);
+		if (chunk->Count == VMM_MIGRATE_CHUNK)
+			VMMMigrateChunkCopy(state, chunk);
+		++*migrated;
+	}
+	return true;
+}
+
+static size_t VMMMigrate(uint64_t firstAddress, uint64_t lastAddress)
+{
+	size_t migrated = 0;
+	VMMLockAcquire(&g_VMMStatesLock);
+	for (struct VMMState* state = g_VMMStates; state; state = state->NextState)
+	{
+		// The holder of a busy address space may be the one waiting on the PMM, so it is skipped instead of waited for
+		if (!VMMLockTryAcquire(&state->Lock))
+			continue;
+		// One this processor is in the middle of editing is skipped too, its tables may be half rewritten and the frames
+		// moved out of it would stay deferred to the open batch until well after the allocation retried
+		if (state->Lock.Depth > 1)
+		{
+			VMMLockRelease(&state->Lock);
+			continue;
+		}
+		struct VMMMigrateChunk chunk;
+		chunk.Count = 0;
+		VMMBatchBegin(state);
+		bool more = VMMPageTableMigrateRecursive(state, state->PageTableRoot, state->FreeTableRoot, 0, firstAddress, lastAddress, state->Levels - 1, &chunk, &migrated);
+		VMMMigrateChunkCopy(state, &chunk);
+		VMMBatchCommit(state);
+		VMMLockRelease(&state->Lock);
+		if (!more)
+			break;
+	}
+	VMMLockRelease(&g_VMMStatesLock);
+	return migrated;
+}
+
+// Shoots down the leaves of a chunk and moves them into the swap pool, the leaves the pool rejects are mapped again
+static void VMMEvictChunkStore(struct VMMState* state, struct VMMEvictChunk* chunk, size_t* evicted)
+{
+	if (chunk->Count == 0)
+		return;
+
+	VMMBatchFlush(state);
+	for (size_t i = 0; i < chunk->Count; ++i)
+	{
+		uint64_t            physicalAddress;
+		enum VMMPageProtect protect;
+		VMMArchGetPageTableEntry(chunk->Entries[i], 0, &physicalAddress, nullptr, &protect, nullptr);
+		void* handle = SwapStore((void*) physicalAddress);
+		if (!handle)
+		{
+			// Non-present entries are never cached, so neither putting the entry back nor the swap entry below needs an invalidation
+			*chunk->PageTableEntries[i] = chunk->Entries[i];
+			continue;
+		}
+
+		*chunk->PageTableEntries[i] = VMMArchConstructSwapEntry(handle);
+		*chunk->FreeTableEntries[i] = 0b10 | VMM_PAGEABLE_LEAF | VMM_SWAPPED_LEAF | ((uint64_t) protect << 3);
+		PMMFree((void*) physicalAddress, 1);
+		++state->Stats.SwappedPages;
+		++state->Stats.SwapOuts;
+		++*evicted;
+	}
+	chunk->Count = 0;
+}
+
+// Runs the clock over the pageable leaves in [firstPage, lastPage] and unmaps the ones it picks into chunk, returns false once count leaves are picked
+static bool VMMPageTableEvictRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t basePage, uint64_t firstPage, uint64_t lastPage, uint8_t level, size_t count, struct VMMEvictChunk* chunk, size_t* evicted)
+{
+	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
+	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
+	for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+	{
+		uint64_t freeEntry = freeTable[i];
+		uint64_t page      = basePage + ((uint64_t) i << (9 * level));
+		if ((freeEntry & 3) == 0b01)
+		{
+			uint64_t firstSubPage = i == firstEntry ? firstPage - ((uint64_t) i << (9 * level)) : 0;
+			uint64_t lastSubPage  = i != lastEntry ? (1UL << (9 * level)) - 1 : lastPage - ((uint64_t) i << (9 * level));
+			if (!VMMPageTableEvictRecursive(state, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), page, firstSubPage, lastSubPage, level - 1, count, chunk, evicted))
+				return false;
+			continue;
+		}
+		if (level != 0 || (freeEntry & 3) != 0b10 || (freeEntry & (VMM_PAGEABLE_LEAF | VMM_SWAPPED_LEAF)) != VMM_PAGEABLE_LEAF)
+			continue;
+
+		state->ClockHand = page + 1;
+		if (VMMArchClearAccessed(&pageTable[i]))
+		{
+			// Accesses through a cached TLB entry would never set the bit again
+			if (VMMArchIsActive(state->PageTableRoot))
+				VMMArchInvalidatePage(page * 4096);
+			continue;
+		}
+
+		uint64_t           physicalAddress;
+		enum VMMMemoryType memoryType;
+		VMMArchGetPageTableEntry(pageTable[i], 0, &physicalAddress, nullptr, nullptr, &memoryType);
+		// Leaves already in the chunk are unmapped, which keeps the second sweep from picking them again
+		if (!physicalAddress || memoryType != VMM_MEMORY_TYPE_WRITE_BACK)
+			continue;
+
+		// Writers on other processors could change the frame while it is compressed, so it is only stored once the chunk is shot down
+		chunk->PageTableEntries[chunk->Count] = &pageTable[i];
+		chunk->FreeTableEntries[chunk->Count] = &freeTable[i];
+		chunk->Entries[chunk->Count]          = __atomic_exchange_n(&pageTable[i], 0, __ATOMIC_RELAXED);
+		++chunk->Count;
+		VMMBatchAddRange(state, page, page);
+		if (chunk->Count == VMM_EVICT_CHUNK)
+			VMMEvictChunkStore(state, chunk, evicted);
+		if (*evicted + chunk->Count >= count)
+			return false;
+	}
+	return true;
+}
+
+static size_t VMMEvict(size_t count)
+{
+	size_t evicted = 0;
+	VMMLockAcquire(&g_VMMStatesLock);
+	for (struct VMMState* state = g_VMMStates; state && evicted < count; state = state->NextState)
+	{
+		// Skipped like in VMMMigrate
+		if (!VMMLockTryAcquire(&state->Lock))
+			continue;
+		if (state->Lock.Depth > 1)
+		{
+			VMMLockRelease(&state->Lock);
+			continue;
+		}
+		struct VMMEvictChunk chunk;
+		chunk.Count       = 0;
+		uint64_t lastPage = (1UL << (9 * state->Levels)) - 1;
+		for (uint8_t sweep = 0; sweep < VMM_CLOCK_SWEEPS && evicted < count; ++sweep)
+		{
+			uint64_t hand = state->ClockHand <= lastPage ? state->ClockHand : 0;
+			if (VMMPageTableEvictRecursive(state, state->PageTableRoot, state->FreeTableRoot, 0, hand, lastPage, state->Levels - 1, count, &chunk, &evicted) && hand > 0)
+				VMMPageTableEvictRecursive(state, state->PageTableRoot, state->FreeTableRoot, 0, 0, hand - 1, state->Levels - 1, count, &chunk, &evicted);
+			// Leaves the swap pool rejects do not count, so the next sweep may still have to look for more
+			VMMEvictChunkStore(state, &chunk, &evicted);
+		}
+		VMMLockRelease(&state->Lock);
+	}
+	VMMLockRelease(&g_VMMStatesLock);
+	return evicted;
+}
+
+// Finds the entries covering page at level, returns false when a leaf or free range above level covers it instead
+static bool VMMPageTableGetEntryAt(struct VMMState* state, uint64_t page, uint8_t level, uint64_t** pageTableEntry, uint64_t** freeTableEntry)
+{
+	uint64_t* pageTable = state->PageTableRoot;
+	uint64_t* freeTable = state->FreeTableRoot;
+	for (uint8_t i = state->Levels - 1; i > level; --i)
+	{
+		uint16_t entry = (page >> (9 * i)) & 511;
+		if ((freeTable[entry] & 3) != 0b01)
+			return false;
+		pageTable = VMMArchGetPageTablePointer(pageTable[entry]);
+		freeTable = (uint64_t*) (freeTable[entry] & 0xF'FFFF'FFFF'F000UL);
+	}
+
+	uint16_t entry  = (page >> (9 * level)) & 511;
+	*pageTableEntry = &pageTable[entry];
+	*freeTableEntry = &freeTable[entry];
+	return true;
+}
+
+// Installs a leaf over the 4 KiB leaves of a range reserved by VMMAlloc, replacing their table when the leaf is larger
+static bool VMMPageTableSetLeaf(struct VMMState* state, uint64_t page, uint8_t level, uint64_t pageTableEntry, uint64_t freeTableEntry)
+{
+	uint64_t* pageTableSlot;
+	uint64_t* freeTableSlot;
+	if (!VMMPageTableGetEntryAt(state, page, level, &pageTableSlot, &freeTableSlot))
+		return false;
+
+	if ((*freeTableSlot & 3) == 0b01)
+	{
+		VMMPageTableFreeRecursively(state, VMMArchGetPageTablePointer(*pageTableSlot), (uint64_t*) (*freeTableSlot & 0xF'FFFF'FFFF'F000UL), level - 1);
+		VMMStatsAddLeaves(state, level, 1);
+	}
+	*pageTableSlot = pageTableEntry;
+	*freeTableSlot = freeTableEntry;
+	return true;
+}
+
+// Checks that [firstPage, lastPage] is allocated throughout and holds no 1 GiB leaf destination could not take over whole
+static bool VMMPageTableCanCopyRecursive(struct VMMState* destination, uint64_t* freeTable, uint64_t firstPage, uint64_t lastPage, uint8_t level)
+{
+	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
+	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
+	for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+	{
+		uint64_t freeEntry    = freeTable[i];
+		uint64_t firstSubPage = i == firstEntry ? firstPage - ((uint64_t) i << (9 * level)) : 0;
+		uint64_t lastSubPage  = i != lastEntry ? (1UL << (9 * level)) - 1 : lastPage - ((uint64_t) i << (9 * level));
 		switch (freeEntry & 3)
 		{
-		case 0b00: return nullptr;
+		case 0b00: return false;
 		case 0b01:
-			pageTable = VMMArchGetPageTablePointer(pageTable[entry]);
-			freeTable = (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL);
+			if (!VMMPageTableCanCopyRecursive(destination, (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), firstSubPage, lastSubPage, level - 1))
+				return false;
+			break;
+		default:
+			// Leaves only partly in the range are split before the copy
+			if (level == 2 && !destination->Supports1GiB && firstSubPage == 0 && lastSubPage == (1UL << 18) - 1)
+				return false;
 			break;
-		case 0b10:
-		case 0b11:
-			uint64_t physicalAddress;
-			VMMArchGetPageTableEntry(pageTable[entry], i, &physicalAddress, nullptr, nullptr);
-			return (void*) physicalAddress;
 		}
 	}
-	return nullptr;
+	return true;
 }
 
-static void VMMPageTableFillProtectRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t firstPage, uint64_t lastPage, enum VMMPageProtect protect, uint8_t level)
+// Gives the leaves in [firstPage, lastPage] of source to destination at page + delta, moved leaves are left unowned in source for VMMFree to drop
+static bool VMMPageTableCopyLeavesRecursive(struct VMMState* source, struct VMMState* destination, uint64_t* pageTable, uint64_t* freeTable, uint64_t basePage, uint64_t firstPage, uint64_t lastPage, uint64_t delta, bool share, uint8_t level)
 {
 	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
 	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
 	for (uint16_t i = firstEntry; i <= lastEntry; ++i)
 	{
 		uint64_t freeEntry = freeTable[i];
+		uint64_t page      = basePage + ((uint64_t) i << (9 * level));
 		switch (freeEntry & 3)
 		{
 		case 0b00: break;
 		case 0b01:
 		{
-			uint64_t firstSubPage = i == firstEntry ? firstPage - (i << (9 * level)) : 0;
-			uint64_t lastSubPage  = i != lastEntry ? (1 << (9 * level)) - 1 : lastPage - (i << (9 * level));
-			VMMPageTableFillProtectRecursive(state, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F0UL), firstSubPage, lastSubPage, protect, level - 1);
+			uint64_t firstSubPage = i == firstEntry ? firstPage - ((uint64_t) i << (9 * level)) : 0;
+			uint64_t lastSubPage  = i != lastEntry ? (1UL << (9 * level)) - 1 : lastPage - ((uint64_t) i << (9 * level));
+			if (!VMMPageTableCopyLeavesRecursive(source, destination, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), page, firstSubPage, lastSubPage, delta, share, level - 1))
+				return false;
 			break;
 		}
 		case 0b10:
 		case 0b11:
 		{
-			uint64_t         physicalAddress;
-			enum VMMPageType type;
-			VMMArchGetPageTableEntry(pageTable[i], level, &physicalAddress, &type, nullptr);
-			pageTable[i] = VMMArchConstructPageTableEntry(physicalAddress, type, protect);
+			if (!share)
+			{
+				uint64_t destinationEntry = pageTable[i];
+				if (freeEntry & VMM_SWAPPED_LEAF)
+				{
+					--source->Stats.SwappedPages;
+					++destination->Stats.SwappedPages;
+				}
+				else
+				{
+					uint64_t            physicalAddress;
+					enum VMMPageType    type;
+					enum VMMPageProtect protect;
+					enum VMMMemoryType  memoryType;
+					VMMArchGetPageTableEntry(pageTable[i], level, &physicalAddress, &type, &protect, &memoryType);
+					destinationEntry = VMMArchConstructPageTableEntry(physicalAddress, type, protect, memoryType, destination->GlobalPages);
+				}
+				if (!VMMPageTableSetLeaf(destination, page + delta, level, destinationEntry, freeEntry))
+					return false;
+				pageTable[i] = 0;
+				freeTable[i] = 0b11;
+				break;
+			}
+
+			// Shared frames have to stay put, so zero and swapped leaves get their own frame first
+			if ((freeEntry & VMM_SWAPPED_LEAF) && !VMMPageTableSwapIn(source, &pageTable[i], &freeTable[i]))
+				return false;
+			if ((freeEntry & VMM_ZERO_LEAF) && !VMMPageTableUnzero(source, &pageTable[i], &freeTable[i], page))
+				return false;
+			freeEntry = freeTable[i];
+
+			uint64_t            physicalAddress;
+			enum VMMPageType    type;
+			enum VMMMemoryType  memoryType;
+			VMMArchGetPageTableEntry(pageTable[i], level, &physicalAddress, &type, nullptr, &memoryType);
+			if ((freeEntry & 3) == 0b10 && physicalAddress)
+			{
+				struct VMMSharedFrame* shared = nullptr;
+				if (freeEntry & VMM_SHARED_LEAF)
+				{
+					shared = VMMGetSharedFrame(freeEntry);
+				}
+				else
+				{
+					shared = (struct VMMSharedFrame*) SlabAlloc(&g_VMMSharedFrameCache);
+					if (!shared)
+						return false;
+					shared->Frame      = physicalAddress;
+					shared->PageCount  = 1UL << (9 * level);
+					shared->References = 1;
+					freeEntry          = 0b10 | VMM_SHARED_LEAF | ((uint64_t) shared << 8);
+					freeTable[i]       = freeEntry;
+				}
+				++shared->References;
+			}
+			else
+			{
+				freeEntry = 0b11;
+			}
+			if (!VMMPageTableSetLeaf(destination, page + delta, level, VMMArchConstructPageTableEntry(physicalAddress, type, VMM_PAGE_PROTECT_READ_ONLY, memoryType, destination->GlobalPages), freeEntry))
+				return false;
 			break;
 		}
 		}
 	}
+	return true;
 }
 
-static void VMMPageTableFillProtect(struct VMMState* state, uint64_t firstPage, uint64_t lastPage, enum VMMPageProtect protect)
-{
-	VMMPageTableFillProtectRecursive(state, state->PageTableRoot, state->FreeTableRoot, firstPage, lastPage, protect, state->Levels - 1);
-}
-
-static void VMMPageTableFillUsedRecursive(struct VMMState* state, uint64_t* pageTable, uint64_t* freeTable, uint64_t firstPage, uint64_t lastPage, enum VMMPageType type, enum VMMPageProtect protect, uint8_t level)
+// Undoes a transfer that failed halfway, leaves already moved from [firstPage, lastPage] of source are taken back from destination
+static void VMMPageTableRestoreLeavesRecursive(struct VMMState* source, struct VMMState* destination, uint64_t* pageTable, uint64_t* freeTable, uint64_t basePage, uint64_t firstPage, uint64_t lastPage, uint64_t delta, uint8_t level)
 {
-	uint8_t minLevel = 0;
-	switch (type)
-	{
-	case VMM_PAGE_TYPE_4KIB: minLevel = 0; break;
-	case VMM_PAGE_TYPE_2MIB: minLevel = 1; break;
-	case VMM_PAGE_TYPE_1GIB: minLevel = 2; break;
-	}
-
 	uint16_t firstEntry = (firstPage >> (9 * level)) & 511;
 	uint16_t lastEntry  = (lastPage >> (9 * level)) & 511;
-	if (level == minLevel)
+	for (uint16_t i = firstEntry; i <= lastEntry; ++i)
 	{
-		for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+		uint64_t freeEntry = freeTable[i];
+		uint64_t page      = basePage + ((uint64_t) i << (9 * level));
+		if ((freeEntry & 3) == 0b01)
 		{
-			pageTable[i] = VMMArchConstructPageTableEntry(0, type, protect);
-			freeTable[i] = 3; // TODO(MarcasRealAccount): Perhaps store allocated page information?
+			uint64_t firstSubPage = i == firstEntry ? firstPage - ((uint64_t) i << (9 * level)) : 0;
+			uint64_t lastSubPage  = i != lastEntry ? (1UL << (9 * level)) - 1 : lastPage - ((uint64_t) i << (9 * level));
+			VMMPageTableRestoreLeavesRecursive(source, destination, VMMArchGetPageTablePointer(pageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), page, firstSubPage, lastSubPage, delta, level - 1);
+			continue;
 		}
-	}
-	else
-	{
-		for (uint16_t i = firstEntry; i <= lastEntry; ++i)
+		// Moved leaves are the only ones left unowned and unmapped
+		if (freeEntry != 0b11 || pageTable[i] != 0)
+			continue;
+
+		uint64_t* destinationPageTableEntry;
+		uint64_t* destinationFreeTableEntry;
+		if (!VMMPageTableGetEntryAt(destination, page + delta, level, &destinationPageTableEntry, &destinationFreeTableEntry))
+			continue;
+		uint64_t movedEntry = *destinationFreeTableEntry;
+		if ((movedEntry & 3) != 0b10 && (movedEntry & 3) != 0b11)
+			continue;
+
+		uint64_t sourceEntry = *destinationPageTableEntry;
+		if (movedEntry & VMM_SWAPPED_LEAF)
 		{
-			uint64_t  freeEntry     = freeTable[i];
-			uint64_t* nextPageTable = nullptr;
-			uint64_t* nextFreeTable = nullptr;
-			if (freeEntry & 1)
-			{
-				nextPageTable = VMMArchGetPageTablePointer(pageTable[i]);
-				nextFreeTable = (uint64_t*) (freeTable[i] & 0xF'FFFF'FFFF'F000UL);
-			}
-			else
-			{
-				void* tablePages = PMMAlloc(2);
-				if (tablePages)
-				{
-					memset(tablePages, 0, 8192);
-
-					nextPageTable = (uint64_t*) tablePages;
-					nextFreeTable = (uint64_t*) tablePages + 512;
-					pageTable[i]  = VMMArchConstructPageTablePointer(nextPageTable);
-					freeTable[i]  = 1 | ((uint64_t) nextFreeTable & 0xF'FFFF'FFFF'F000UL);
-				}
-				else
-				{
-					nextPageTable = (uint64_t*) PMMAlloc(1);
-					if (!nextPageTable)
-					{
-						// TODO(MarcasRealAccount): PANIC
-						return;
-					}
-					nextFreeTable = (uint64_t*) PMMAlloc(1);
-					if (!nextFreeTable)
-					{
-						PMMFree(nextPageTable, 1);
-						// TODO(MarcasRealAccount): PANIC
-						return;
-					}
-					memset(nextPageTable, 0, 4096);
-					memset(nextFreeTable, 0, 4096);
-
-					pageTable[i] = VMMArchConstructPageTablePointer(nextPageTable);
-					freeTable[i] = 1 | ((uint64_t) nextFreeTable & 0xF'FFFF'FFFF'F000UL);
-				}
-				state->Stats.AllocatorFootprint += 8192;
-			}
-
-			uint64_t firstSubPage = i == firstEntry ? firstPage - (i << (9 * level)) : 0;
-			uint64_t lastSubPage  = i != lastEntry ? (1 << (9 * level)) - 1 : lastPage - (i << (9 * level));
-			VMMPageTableFillUsedRecursive(state, nextPageTable, nextFreeTable, firstSubPage, lastSubPage, type, protect, level - 1);
+			++source->Stats.SwappedPages;
+			--destination->Stats.SwappedPages;
+		}
+		else
+		{
+			uint64_t            physicalAddress;
+			enum VMMPageType    type;
+			enum VMMPageProtect protect;
+			enum VMMMemoryType  memoryType;
+			VMMArchGetPageTableEntry(sourceEntry, level, &physicalAddress, &type, &protect, &memoryType);
+			sourceEntry = VMMArchConstructPageTableEntry(physicalAddress, type, protect, memoryType, source->GlobalPages);
 		}
+		pageTable[i]               = sourceEntry;
+		freeTable[i]               = movedEntry;
+		*destinationPageTableEntry = 0;
+		*destinationFreeTableEntry = 0b11;
+		VMMBatchAddRange(destination, page + delta, page + delta + (1UL << (9 * level)) - 1);
 	}
 }
 
-static void VMMPageTableFillUsed(struct VMMState* state, uint64_t firstPage, uint64_t lastPage, enum VMMPageType type, enum VMMPageProtect protect)
-{
-	VMMPageTableFillUsedRecursive(state, state->PageTableRoot, state->FreeTableRoot, firstPage, lastPage, type, protect, state->Levels - 1);
-}
-
 static void VMMPageTableFillFree(struct VMMState* state, struct VMMFreeEntry* entry)
 {
 	uint64_t* firstPageTable = state->PageTableRoot;
@@ -303,12 +1468,12 @@ static void VMMPageTableFillFree(struct VMMState* state, struct VMMFreeEntry* en
 	{
 		uint16_t firstEntry    = (firstPage >> (9 * level)) & 511;
 		uint16_t lastEntry     = (lastPage >> (9 * level)) & 511;
-		uint64_t remMask       = ~0UL >> (64 - (9 * level));
+		uint64_t remMask       = (1UL << (9 * level)) - 1;
 		uint64_t remFirstEntry = firstPage & remMask;
 		uint64_t remLastEntry  = lastPage & remMask;
 
 		int16_t layerFillStart = remFirstEntry == 0 ? firstEntry : firstEntry + 1;
-		int16_t layerFillEnd   = remFirstEntry == remMask ? lastEntry : lastEntry - 1;
+		int16_t layerFillEnd   = remLastEntry == remMask ? lastEntry : lastEntry - 1;
 
 		if (firstFreeTable == lastFreeTable)
 		{
@@ -320,6 +1485,8 @@ static void VMMPageTableFillFree(struct VMMState* state, struct VMMFreeEntry* en
 				uint64_t freeEntry = firstFreeTable[i];
 				if ((freeEntry & 3) == 1)
 					VMMPageTableFreeRecursively(state, VMMArchGetPageTablePointer(firstPageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), level - 1);
+				else if (freeEntry & 2)
+					VMMStatsAddLeaves(state, level, -1);
 				firstPageTable[i] = 0;
 				firstFreeTable[i] = (uint64_t) entry & 0xF'FFFF'FFFF'FFE0UL;
 			}
@@ -333,6 +1500,8 @@ static void VMMPageTableFillFree(struct VMMState* state, struct VMMFreeEntry* en
 					uint64_t freeEntry = firstFreeTable[i];
 					if ((freeEntry & 3) == 1)
 						VMMPageTableFreeRecursively(state, VMMArchGetPageTablePointer(firstPageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), level - 1);
+					else if (freeEntry & 2)
+						VMMStatsAddLeaves(state, level, -1);
 					firstPageTable[i] = 0;
 					firstFreeTable[i] = (uint64_t) entry & 0xF'FFFF'FFFF'FFE0UL;
 				}
@@ -344,6 +1513,8 @@ static void VMMPageTableFillFree(struct VMMState* state, struct VMMFreeEntry* en
 					uint64_t freeEntry = lastFreeTable[i];
 					if ((freeEntry & 3) == 1)
 						VMMPageTableFreeRecursively(state, VMMArchGetPageTablePointer(lastPageTable[i]), (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL), level - 1);
+					else if (freeEntry & 2)
+						VMMStatsAddLeaves(state, level, -1);
 					lastPageTable[i] = 0;
 					lastFreeTable[i] = (uint64_t) entry & 0xF'FFFF'FFFF'FFE0UL;
 				}
@@ -373,6 +1544,7 @@ static void VMMPageTableFillFree(struct VMMState* state, struct VMMFreeEntry* en
 					break;
 				case 0b10:
 				case 0b11:
+					VMMStatsAddLeaves(state, level, -1);
 					firstPageTable[firstEntry] = 0;
 					firstFreeTable[firstEntry] = (uint64_t) entry & 0xF'FFFF'FFFF'FFE0UL;
 					firstPageTable             = nullptr;
@@ -404,6 +1576,7 @@ static void VMMPageTableFillFree(struct VMMState* state, struct VMMFreeEntry* en
 					break;
 				case 0b10:
 				case 0b11:
+					VMMStatsAddLeaves(state, level, -1);
 					lastPageTable[lastEntry] = 0;
 					lastFreeTable[lastEntry] = (uint64_t) entry & 0xF'FFFF'FFFF'FFE0UL;
 					lastPageTable            = nullptr;
@@ -415,104 +1588,29 @@ static void VMMPageTableFillFree(struct VMMState* state, struct VMMFreeEntry* en
 	}
 }
 
-static uint8_t VMMFreePageGetFree(struct VMMFreePage* freePage)
-{
-	if (freePage->Bitmap[0] == 0)
-	{
-		if (freePage->Bitmap[1] == 0)
-			return 128;
-		else
-			return __builtin_clzll(freePage->Bitmap[1]);
-	}
-	else
-	{
-		return __builtin_clzll(freePage->Bitmap[0]);
-	}
-}
-
 static struct VMMFreeEntry* VMMFreeEntryNew(struct VMMState* state)
 {
-	if (!state->FirstFreePage)
-	{
-		state->FirstFreePage = (struct VMMFreePage*) PMMAlloc(1);
-		state->LastFreePage  = state->FirstFreePage;
-		memset(state->FirstFreePage, 0, 4096);
-		state->FirstFreePage->Bitmap[0]  = ~0UL;
-		state->FirstFreePage->Bitmap[1]  = ~0UL;
-		state->Stats.AllocatorFootprint += 4096;
-	}
-	struct VMMFreePage* freePage  = state->FirstFreePage;
-	uint8_t             freeEntry = VMMFreePageGetFree(freePage);
-	if (freeEntry == 128)
-	{
-		freePage = (struct VMMFreePage*) PMMAlloc(1);
-		memset(freePage, 0, 4096);
-		freePage->Bitmap[0]                = ~0UL;
-		freePage->Bitmap[1]                = ~0UL;
-		freePage->NextFreePage             = state->FirstFreePage;
-		state->FirstFreePage->PrevFreePage = freePage;
-		state->FirstFreePage               = freePage;
-		freeEntry                          = 0;
-		state->Stats.AllocatorFootprint   += 4096;
-	}
-
-	freePage->Bitmap[freeEntry / 64] |= 1UL << (freeEntry & 63);
-	struct VMMFreeEntry* entry        = &freePage->Entries[freeEntry];
-
-	freeEntry = VMMFreePageGetFree(freePage);
-	if (freeEntry == 128)
-	{
-		if (freePage->PrevFreePage)
-			freePage->PrevFreePage->NextFreePage = freePage->NextFreePage;
-		if (freePage->NextFreePage)
-			freePage->NextFreePage->PrevFreePage = freePage->PrevFreePage;
-		if (state->LastFreePage != freePage)
-		{
-			state->LastFreePage->NextFreePage = freePage;
-			freePage->PrevFreePage            = state->LastFreePage;
-		}
-		freePage->NextFreePage = nullptr;
-		state->LastFreePage    = freePage;
-	}
+	struct VMMFreeEntry* entry = (struct VMMFreeEntry*) SlabAlloc(&g_VMMFreeEntryCache);
+	if (!entry)
+		return nullptr;
+	state->Stats.AllocatorFootprint += sizeof(struct VMMFreeEntry);
+	++state->Stats.FreeEntriesUsed;
 	return entry;
 }
 
 static void VMMFreeEntryFree(struct VMMState* state, struct VMMFreeEntry* entry)
 {
-	struct VMMFreePage* freePage      = (struct VMMFreePage*) ((uint64_t) entry & ~0xFFFUL);
-	uint8_t             freeEntry     = (uint8_t) (entry - freePage->Entries);
-	freePage->Bitmap[freeEntry / 64] &= ~(1UL << (freeEntry & 63));
-
-	if (state->LastFreePage == freePage)
-		state->LastFreePage = freePage->PrevFreePage;
-	if (state->FirstFreePage == freePage)
-		state->FirstFreePage = freePage->NextFreePage;
-	if (freePage->PrevFreePage)
-		freePage->PrevFreePage->NextFreePage = freePage->NextFreePage;
-	if (freePage->NextFreePage)
-		freePage->NextFreePage->PrevFreePage = freePage->PrevFreePage;
-
-	if (freePage->Bitmap[0] != 0 || freePage->Bitmap[1] != 0)
-	{
-		freePage->PrevFreePage = nullptr;
-		freePage->NextFreePage = state->FirstFreePage;
-		if (state->FirstFreePage)
-			state->FirstFreePage->PrevFreePage = freePage;
-		state->FirstFreePage = freePage;
-	}
-	else
-	{
-		PMMFree(freePage, 1);
-		state->Stats.AllocatorFootprint -= 4096;
-	}
+	SlabFree(&g_VMMFreeEntryCache, entry);
+	state->Stats.AllocatorFootprint -= sizeof(struct VMMFreeEntry);
+	--state->Stats.FreeEntriesUsed;
 }
 
-static struct VMMFreeEntry* VMMInsertFreeRange(struct VMMState* state, uint64_t firstPage, uint64_t lastPage)
+// Takes an entry from VMMFreeEntryNew, callers get theirs before changing anything so running out of entries leaves nothing to undo
+static void VMMInsertFreeRange(struct VMMState* state, struct VMMFreeEntry* entry, uint64_t firstPage, uint64_t lastPage)
 {
-	struct VMMFreeEntry* entry = VMMFreeEntryNew(state);
-	entry->Start               = firstPage;
-	entry->Count               = lastPage - firstPage + 1;
-	uint8_t index              = VMMGetLUTIndex(entry->Count);
+	entry->Start  = firstPage;
+	entry->Count  = lastPage - firstPage + 1;
+	uint8_t index = VMMGetLUTIndex(entry->Count);
 	if (state->LUT[index])
 	{
 		struct VMMFreeEntry* other = state->LUT[index];
@@ -527,7 +1625,7 @@ static struct VMMFreeEntry* VMMInsertFreeRange(struct VMMState* state, uint64_t
 				break;
 			state->LUT[i] = entry;
 		}
-		return entry;
+		return;
 	}
 
 	for (uint8_t i = index + 1; i-- > 0;)
@@ -541,7 +1639,6 @@ static struct VMMFreeEntry* VMMInsertFreeRange(struct VMMState* state, uint64_t
 	entry->Prev = state->Last;
 	entry->Next = nullptr;
 	state->Last = entry;
-	return entry;
 }
 
 static void VMMEraseFreeRange(struct VMMState* state, struct VMMFreeEntry* entry)
@@ -587,14 +1684,15 @@ static struct VMMFreeEntry* VMMGetFreeRangeAt(struct VMMState* state, uint64_t p
 	for (uint8_t i = state->Levels; i-- > 0;)
 	{
 		uint64_t freeEntry = freeTable[(page >> (9 * i)) & 511];
-		if (freeEntry & 1)
+		if ((freeEntry & 3) == 0b01)
 		{
 			freeTable = (uint64_t*) (freeEntry & 0xF'FFFF'FFFF'F000UL);
-			if (!freeTable)
-				return nullptr;
 		}
 		else
 		{
+			// Leaf flags would otherwise be taken for a free entry pointer
+			if (freeEntry & 3)
+				return nullptr;
 			struct VMMFreeEntry* entry = (struct VMMFreeEntry*) (freeEntry & 0xF'FFFF'FFFF'FFE0UL);
 			return entry && (entry->Start + entry->Count >= page + count) ? entry : nullptr;
 		}
@@ -614,8 +1712,83 @@ static struct VMMFreeEntry* VMMGetAlignedRange(struct VMMState* state, uint64_t
 	return cur;
 }
 
+static void* VMMCopyLeavesLocked(struct VMMState* source, uint64_t firstPage, size_t count, struct VMMState* destination, bool share)
+{
+	uint64_t lastPage = firstPage + count - 1;
+	if (count == 0 || lastPage < firstPage || (lastPage >> (9 * source->Levels)) != 0)
+		return nullptr;
+	// Rejected up front, so a copy only fails halfway when it runs out of memory
+	if (!VMMPageTableCanCopyRecursive(destination, source->FreeTableRoot, firstPage, lastPage, source->Levels - 1))
+		return nullptr;
+
+	// Splitting the source first leaves nothing to undo when it runs out of tables
+	VMMBatchBegin(source);
+	if (!VMMPageTableSplitAt(source, firstPage) || !VMMPageTableSplitAt(source, lastPage + 1))
+	{
+		VMMBatchCommit(source);
+		return nullptr;
+	}
+
+	// The destination keeps the offset of the source within huge pages, so huge leaves move over as they are
+	uint8_t alignment = 12;
+	if (destination->Supports1GiB && count >= 0x4'0000)
+		alignment = 30;
+	else if (count >= 512)
+		alignment = 21;
+	uint64_t offset   = firstPage & ((1UL << (alignment - 12)) - 1);
+	uint8_t* reserved = (uint8_t*) VMMAlloc(destination, count + offset, alignment, VMM_PAGE_TYPE_4KIB, VMM_PAGE_PROTECT_READ_ONLY, VMM_MEMORY_TYPE_WRITE_BACK);
+	if (!reserved)
+	{
+		VMMBatchCommit(source);
+		return nullptr;
+	}
+	if (offset)
+		VMMFree(destination, reserved, offset);
+
+	uint64_t destinationPage = (uint64_t) reserved / 4096 + offset;
+	VMMBatchBegin(destination);
+	bool copied = VMMPageTableCopyLeavesRecursive(source, destination, source->PageTableRoot, source->FreeTableRoot, 0, firstPage, lastPage, destinationPage - firstPage, share, source->Levels - 1);
+	// Freeing the reservation would release the frames of the leaves moved so far, so they go back to the source first
+	if (!copied && !share)
+		VMMPageTableRestoreLeavesRecursive(source, destination, source->PageTableRoot, source->FreeTableRoot, 0, firstPage, lastPage, destinationPage - firstPage, source->Levels - 1);
+	VMMBatchCommit(destination);
+	// Freeing the source range queues its invalidation, the commit flushes it before the call returns
+	if (copied && !share)
+		VMMFree(source, (void*) (firstPage * 4096), count);
+	VMMBatchCommit(source);
+	if (!copied)
+	{
+		VMMFree(destination, (void*) (destinationPage * 4096), count);
+		return nullptr;
+	}
+	return (void*) (destinationPage * 4096);
+}
+
+static void* VMMCopyLeaves(struct VMMState* source, uint64_t firstPage, size_t count, struct VMMState* destination, bool share)
+{
+	// Both address spaces are locked in address order, so two copies in opposite directions cannot deadlock
+	struct VMMState* first  = source < destination ? source : destination;
+	struct VMMState* second = source < destination ? destination : source;
+	VMMLockAcquire(&first->Lock);
+	VMMLockAcquire(&second->Lock);
+	void* result = VMMCopyLeavesLocked(source, firstPage, count, destination, share);
+	VMMLockRelease(&second->Lock);
+	VMMLockRelease(&first->Lock);
+	return result;
+}
+
 void* VMMNewPageTable(void)
 {
+	if (g_VMMFreeEntryCache.ObjectSize == 0)
+	{
+		if (!SlabCacheInit(&g_VMMFreeEntryCache, "VMM free entry", sizeof(struct VMMFreeEntry), 32, nullptr, nullptr))
+			return nullptr;
+		if (!SlabCacheInit(&g_VMMSharedFrameCache, "VMM shared frame", sizeof(struct VMMSharedFrame), 8, nullptr, nullptr))
+			return nullptr;
+		PMMSetMigrateHandler(VMMMigrate);
+		PMMSetEvictHandler(VMMEvict);
+	}
+
 	struct VMMState* state = (struct VMMState*) PMMAlloc(3);
 	if (!state)
 		return nullptr;
@@ -629,8 +1802,22 @@ void* VMMNewPageTable(void)
 	state->Supports1GiB        = false;
 	state->PageTableRoot       = (uint64_t*) state + 512;
 	state->FreeTableRoot       = (uint64_t*) state + 1024;
-	struct VMMFreeEntry* entry = VMMInsertFreeRange(state, 1, 0xF'FFFF'FFFE);
+	struct VMMFreeEntry* entry = VMMFreeEntryNew(state);
+	if (!entry)
+	{
+		PMMFree(state, 3);
+		return nullptr;
+	}
+	VMMInsertFreeRange(state, entry, 1, 0xF'FFFF'FFFE);
 	VMMPageTableFillFree(state, entry);
+	state->Stats.TablePages[state->Levels - 1] = 1;
+
+	VMMLockAcquire(&g_VMMStatesLock);
+	state->NextState = g_VMMStates;
+	if (g_VMMStates)
+		g_VMMStates->PrevState = state;
+	g_VMMStates = state;
+	VMMLockRelease(&g_VMMStatesLock);
 	return state;
 }
 
@@ -640,15 +1827,31 @@ void VMMFreePageTable(void* pageTable)
 		return;
 	struct VMMState* state = (struct VMMState*) pageTable;
 
-	VMMPageTableFreeRecursively(state, state->PageTableRoot, state->FreeTableRoot, state->Levels - 1);
-	struct VMMFreePage* curFreePage = state->FirstFreePage;
-	while (curFreePage)
+	VMMLockAcquire(&state->Lock);
+	VMMLockAcquire(&g_VMMStatesLock);
+	if (state->PrevState)
+		state->PrevState->NextState = state->NextState;
+	else
+		g_VMMStates = state->NextState;
+	if (state->NextState)
+		state->NextState->PrevState = state->PrevState;
+	VMMLockRelease(&g_VMMStatesLock);
+
+	// Owned frames and the tables go out through one last batch, so no processor still caches a translation to them
+	state->Batch.Depth = 1;
+	VMMPageTableFreeChildren(state, state->PageTableRoot, state->FreeTableRoot, state->Levels - 1);
+	state->Batch.Depth = 0;
+	VMMBatchFlush(state);
+	VMMTableCacheDrain(state, 0);
+	struct VMMFreeEntry* entry = state->Last;
+	while (entry)
 	{
-		struct VMMFreePage* nextFreePage = curFreePage->NextFreePage;
-		PMMFree(curFreePage, 1);
-		curFreePage = nextFreePage;
+		struct VMMFreeEntry* prev = entry->Prev;
+		SlabFree(&g_VMMFreeEntryCache, entry);
+		entry = prev;
 	}
-	PMMFree(state, 1);
+	VMMLockRelease(&state->Lock);
+	PMMFree(state, 3);
 }
 
 void VMMGetMemoryStats(void* pageTable, struct VMMMemoryStats* stats)
@@ -657,10 +1860,50 @@ void VMMGetMemoryStats(void* pageTable, struct VMMMemoryStats* stats)
 		return;
 
 	struct VMMState* state = (struct VMMState*) pageTable;
-	*stats                 = state->Stats;
+	VMMLockAcquire(&state->Lock);
+	*stats                  = state->Stats;
+	stats->CachedTablePages = state->TableCacheCount;
+	VMMLockRelease(&state->Lock);
+
+	struct SlabCacheStats entryStats;
+	SlabCacheGetStats(&g_VMMFreeEntryCache, &entryStats);
+	stats->FreeEntryPages      = entryStats.SlabCount;
+	stats->FreeEntriesCapacity = entryStats.SlabCount * g_VMMFreeEntryCache.ObjectsPerSlab;
+}
+
+void VMMSetGlobal(void* pageTable, bool global)
+{
+	if (!pageTable)
+		return;
+
+	struct VMMState* state = (struct VMMState*) pageTable;
+	state->GlobalPages     = global;
+}
+
+void VMMBatchBegin(void* pageTable)
+{
+	if (!pageTable)
+		return;
+
+	struct VMMState* state = (struct VMMState*) pageTable;
+	VMMLockAcquire(&state->Lock);
+	++state->Batch.Depth;
+}
+
+void VMMBatchCommit(void* pageTable)
+{
+	if (!pageTable)
+		return;
+
+	struct VMMState* state = (struct VMMState*) pageTable;
+	if (state->Batch.Depth == 0)
+		return;
+	if (--state->Batch.Depth == 0)
+		VMMBatchFlush(state);
+	VMMLockRelease(&state->Lock);
 }
 
-void* VMMAlloc(void* pageTable, size_t count, uint8_t alignment, enum VMMPageType type, enum VMMPageProtect protect)
+static void* VMMAllocLocked(void* pageTable, size_t count, uint8_t alignment, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType)
 {
 	if (!pageTable || count == 0)
 		return nullptr;
@@ -676,6 +1919,17 @@ void* VMMAlloc(void* pageTable, size_t count, uint8_t alignment, enum VMMPageTyp
 		if (!state->Supports1GiB)
 			type = VMM_PAGE_TYPE_2MIB;
 		break;
+	case VMM_PAGE_TYPE_AUTO:
+		// Align large requests so they span whole huge pages
+		if (state->Supports1GiB && count >= 0x4'0000)
+			alignment = alignment < 30 ? 30 : alignment;
+		else if (count >= 512)
+			alignment = alignment < 21 ? 21 : alignment;
+		else
+			alignment = alignment < 12 ? 12 : alignment;
+		break;
+	case VMM_PAGE_TYPE_ZERO:
+	case VMM_PAGE_TYPE_PAGEABLE: alignment = alignment < 12 ? 12 : alignment; break;
 	}
 
 	uint64_t alignmentVal  = 1UL << (alignment - 12);
@@ -689,28 +1943,54 @@ void* VMMAlloc(void* pageTable, size_t count, uint8_t alignment, enum VMMPageTyp
 			return nullptr;
 	}
 
-	state->Stats.PagesAllocated += count;
-	uint64_t entryPage           = entry->Start;
-	uint64_t lastRangePage       = entryPage + entry->Count - 1;
-	uint64_t firstPage           = (entryPage + alignmentMask) & ~alignmentMask;
-	uint64_t lastPage            = firstPage + count - 1;
+	uint64_t entryPage     = entry->Start;
+	uint64_t lastRangePage = entryPage + entry->Count - 1;
+	uint64_t firstPage     = (entryPage + alignmentMask) & ~alignmentMask;
+	uint64_t lastPage      = firstPage + count - 1;
+
+	// The leftovers below and above need free entries of their own, the allocation fails before anything changes without them
+	struct VMMFreeEntry* firstEntry = entryPage != firstPage ? VMMFreeEntryNew(state) : nullptr;
+	struct VMMFreeEntry* lastEntry  = lastPage != lastRangePage ? VMMFreeEntryNew(state) : nullptr;
+	if ((entryPage != firstPage && !firstEntry) || (lastPage != lastRangePage && !lastEntry))
+	{
+		if (firstEntry)
+			VMMFreeEntryFree(state, firstEntry);
+		if (lastEntry)
+			VMMFreeEntryFree(state, lastEntry);
+		return nullptr;
+	}
 
+	state->Stats.PagesAllocated += count;
+	VMMBatchBegin(state);
 	VMMEraseFreeRange(state, entry);
-	VMMPageTableFillUsed(state, firstPage, lastPage, type, protect);
-	if (entryPage != firstPage)
+	bool backed = true;
+	switch (type)
+	{
+	case VMM_PAGE_TYPE_AUTO: backed = VMMPageTableFillOwned(state, firstPage, lastPage, protect, memoryType); break;
+	case VMM_PAGE_TYPE_ZERO: backed = VMMPageTableFillZero(state, firstPage, lastPage, protect, memoryType); break;
+	case VMM_PAGE_TYPE_PAGEABLE: backed = VMMPageTableFillPageable(state, firstPage, lastPage, protect, memoryType); break;
+	default: VMMPageTableFillUsed(state, firstPage, lastPage, type, protect, memoryType, false); break;
+	}
+	if (firstEntry)
 	{
-		struct VMMFreeEntry* firstEntry = VMMInsertFreeRange(state, entryPage, firstPage - 1);
+		VMMInsertFreeRange(state, firstEntry, entryPage, firstPage - 1);
 		VMMPageTableFillFree(state, firstEntry);
 	}
-	if (lastPage != lastRangePage)
+	if (lastEntry)
 	{
-		struct VMMFreeEntry* lastEntry = VMMInsertFreeRange(state, lastPage + 1, lastRangePage);
+		VMMInsertFreeRange(state, lastEntry, lastPage + 1, lastRangePage);
 		VMMPageTableFillFree(state, lastEntry);
 	}
+	VMMBatchCommit(state);
+	if (!backed)
+	{
+		VMMFree(state, (void*) (firstPage * 4096), count);
+		return nullptr;
+	}
 	return (void*) (firstPage * 4096);
 }
 
-void* VMMAllocAt(void* pageTable, uint64_t virtualAddress, size_t count, enum VMMPageType type, enum VMMPageProtect protect)
+static void* VMMAllocAtLocked(void* pageTable, uint64_t virtualAddress, size_t count, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType)
 {
 	if (!pageTable || count == 0)
 		return nullptr;
@@ -724,27 +2004,53 @@ void* VMMAllocAt(void* pageTable, uint64_t virtualAddress, size_t count, enum VM
 	if (!entry)
 		return nullptr;
 
-	state->Stats.PagesAllocated += count;
-	uint64_t entryPage           = entry->Start;
-	uint64_t lastRangePage       = entryPage + entry->Count - 1;
-	uint64_t lastPage            = firstPage + count - 1;
+	uint64_t entryPage     = entry->Start;
+	uint64_t lastRangePage = entryPage + entry->Count - 1;
+	uint64_t lastPage      = firstPage + count - 1;
+
+	// Like in VMMAllocLocked
+	struct VMMFreeEntry* firstEntry = entryPage != firstPage ? VMMFreeEntryNew(state) : nullptr;
+	struct VMMFreeEntry* lastEntry  = lastPage != lastRangePage ? VMMFreeEntryNew(state) : nullptr;
+	if ((entryPage != firstPage && !firstEntry) || (lastPage != lastRangePage && !lastEntry))
+	{
+		if (firstEntry)
+			VMMFreeEntryFree(state, firstEntry);
+		if (lastEntry)
+			VMMFreeEntryFree(state, lastEntry);
+		return nullptr;
+	}
 
+	state->Stats.PagesAllocated += count;
+	VMMBatchBegin(state);
 	VMMEraseFreeRange(state, entry);
-	VMMPageTableFillUsed(state, firstPage, lastPage, type, protect);
-	if (entryPage != firstPage)
+	bool backed = true;
+	switch (type)
+	{
+	case VMM_PAGE_TYPE_AUTO: backed = VMMPageTableFillOwned(state, firstPage, lastPage, protect, memoryType); break;
+	case VMM_PAGE_TYPE_ZERO: backed = VMMPageTableFillZero(state, firstPage, lastPage, protect, memoryType); break;
+	case VMM_PAGE_TYPE_PAGEABLE: backed = VMMPageTableFillPageable(state, firstPage, lastPage, protect, memoryType); break;
+	default: VMMPageTableFillUsed(state, firstPage, lastPage, type, protect, memoryType, false); break;
+	}
+	if (firstEntry)
 	{
-		struct VMMFreeEntry* firstEntry = VMMInsertFreeRange(state, entryPage, firstPage - 1);
+		VMMInsertFreeRange(state, firstEntry, entryPage, firstPage - 1);
 		VMMPageTableFillFree(state, firstEntry);
 	}
-	if (lastPage != lastRangePage)
+	if (lastEntry)
 	{
-		struct VMMFreeEntry* lastEntry = VMMInsertFreeRange(state, lastPage + 1, lastRangePage);
+		VMMInsertFreeRange(state, lastEntry, lastPage + 1, lastRangePage);
 		VMMPageTableFillFree(state, lastEntry);
 	}
+	VMMBatchCommit(state);
+	if (!backed)
+	{
+		VMMFree(state, (void*) (firstPage * 4096), count);
+		return nullptr;
+	}
 	return (void*) (firstPage * 4096);
 }
 
-void VMMFree(void* pageTable, void* virtualAddress, size_t count)
+static void VMMFreeLocked(void* pageTable, void* virtualAddress, size_t count)
 {
 	if (!pageTable)
 		return;
@@ -755,7 +2061,24 @@ void VMMFree(void* pageTable, void* virtualAddress, size_t count)
 	if (VMMGetFreeRangeAt(state, firstPage, 1))
 		return;
 
+	VMMBatchBegin(state);
+	// The range stays allocated when a huge leaf across its bounds cannot be split
+	if (!VMMPageTableSplitAt(state, firstPage) || !VMMPageTableSplitAt(state, firstPage + count))
+	{
+		VMMBatchCommit(state);
+		return;
+	}
+	// Without a free entry for the merged range the pages stay allocated, like when a split fails
+	struct VMMFreeEntry* entry = VMMFreeEntryNew(state);
+	if (!entry)
+	{
+		VMMBatchCommit(state);
+		return;
+	}
 	state->Stats.PagesAllocated -= count;
+	++state->Stats.Frees;
+	VMMBatchAddRange(state, firstPage, firstPage + count - 1);
+	VMMPageTableReleaseOwned(state, firstPage, firstPage + count - 1);
 
 	uint64_t bottomPage = firstPage;
 	uint64_t totalCount = count;
@@ -773,36 +2096,91 @@ void VMMFree(void* pageTable, void* virtualAddress, size_t count)
 		totalCount += entryAbove->Count;
 		VMMEraseFreeRange(state, entryAbove);
 	}
-	struct VMMFreeEntry* entry = VMMInsertFreeRange(state, bottomPage, bottomPage + totalCount - 1);
+	VMMInsertFreeRange(state, entry, bottomPage, bottomPage + totalCount - 1);
 	VMMPageTableFillFree(state, entry);
+	VMMBatchCommit(state);
 }
 
-void VMMProtect(void* pageTable, void* virtualAddress, size_t count, enum VMMPageProtect protect)
+void* VMMAlloc(void* pageTable, size_t count, uint8_t alignment, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType)
 {
 	if (!pageTable)
-		return;
+		return nullptr;
 
-	uint64_t firstPage = (uint64_t) virtualAddress / 4096;
-	uint64_t lastPage  = firstPage + count - 1;
-	VMMPageTableFillProtect((struct VMMState*) pageTable, firstPage, lastPage, protect);
+	struct VMMState* state = (struct VMMState*) pageTable;
+	VMMLockAcquire(&state->Lock);
+	void* result = VMMAllocLocked(state, count, alignment, type, protect, memoryType);
+	VMMLockRelease(&state->Lock);
+	return result;
+}
+
+void* VMMAllocAt(void* pageTable, uint64_t virtualAddress, size_t count, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType)
+{
+	if (!pageTable)
+		return nullptr;
+
+	struct VMMState* state = (struct VMMState*) pageTable;
+	VMMLockAcquire(&state->Lock);
+	void* result = VMMAllocAtLocked(state, virtualAddress, count, type, protect, memoryType);
+	VMMLockRelease(&state->Lock);
+	return result;
 }
 
-void VMMMap(void* pageTable, void* virtualAddress, void* physicalAddress)
+void VMMFree(void* pageTable, void* virtualAddress, size_t count)
 {
 	if (!pageTable)
 		return;
 
-	VMMPageTableMap((struct VMMState*) pageTable, (uint64_t) virtualAddress / 4096, (uint64_t) physicalAddress);
+	struct VMMState* state = (struct VMMState*) pageTable;
+	VMMLockAcquire(&state->Lock);
+	VMMFreeLocked(state, virtualAddress, count);
+	VMMLockRelease(&state->Lock);
 }
 
-void VMMMapLinear(void* pageTable, void* virtualAddress, void* physicalAddress, size_t count)
+void VMMProtect(void* pageTable, void* virtualAddress, size_t count, enum VMMPageProtect protect)
 {
 	if (!pageTable)
 		return;
 
-	uint64_t firstPage = (uint64_t) virtualAddress / 4096;
-	uint64_t lastPage  = firstPage + count - 1;
-	VMMPageTableMapLinear((struct VMMState*) pageTable, firstPage, lastPage, (uint64_t) physicalAddress);
+	struct VMMState* state     = (struct VMMState*) pageTable;
+	uint64_t         firstPage = (uint64_t) virtualAddress / 4096;
+	uint64_t         lastPage  = firstPage + count - 1;
+	VMMBatchBegin(state);
+	// Like in VMMFreeLocked the protection stays as it was
+	if (!VMMPageTableSplitAt(state, firstPage) || !VMMPageTableSplitAt(state, lastPage + 1))
+	{
+		VMMBatchCommit(state);
+		return;
+	}
+	VMMPageTableFillProtect(state, firstPage, lastPage, protect);
+	VMMBatchAddRange(state, firstPage, lastPage);
+	VMMBatchCommit(state);
+}
+
+bool VMMMap(void* pageTable, void* virtualAddress, void* physicalAddress)
+{
+	if (!pageTable)
+		return false;
+
+	struct VMMState* state = (struct VMMState*) pageTable;
+	// The batch shoots down the translation a remap replaces
+	VMMBatchBegin(state);
+	bool mapped = VMMPageTableMap(state, (uint64_t) virtualAddress / 4096, (uint64_t) physicalAddress);
+	VMMBatchCommit(state);
+	return mapped;
+}
+
+bool VMMMapLinear(void* pageTable, void* virtualAddress, void* physicalAddress, size_t count, enum VMMMemoryType memoryType)
+{
+	if (!pageTable || count == 0)
+		return false;
+
+	struct VMMState* state     = (struct VMMState*) pageTable;
+	uint64_t         firstPage = (uint64_t) virtualAddress / 4096;
+	uint64_t         lastPage  = firstPage + count - 1;
+	VMMBatchBegin(state);
+	bool mapped = VMMPageTableMapLinear(state, firstPage, lastPage, (uint64_t) physicalAddress, memoryType);
+	VMMBatchCommit(state);
+	return mapped;
 }
 
 void* VMMTranslate(void* pageTable, void* virtualAddress)
@@ -810,8 +2188,42 @@ void* VMMTranslate(void* pageTable, void* virtualAddress)
 	if (!pageTable)
 		return nullptr;
 
-	uint64_t page = (uint64_t) virtualAddress / 4096;
-	return VMMPageTableGetPhysicalAddress((struct VMMState*) pageTable, page);
+	struct VMMState* state = (struct VMMState*) pageTable;
+	uint64_t         page  = (uint64_t) virtualAddress / 4096;
+	VMMLockAcquire(&state->Lock);
+	++state->Stats.Translations;
+	void* physicalAddress = VMMPageTableGetPhysicalAddress(state, page);
+	VMMLockRelease(&state->Lock);
+	return physicalAddress;
+}
+
+void* VMMTransfer(void* sourcePageTable, void* virtualAddress, size_t count, void* destinationPageTable)
+{
+	if (!sourcePageTable || !destinationPageTable)
+		return nullptr;
+
+	return VMMCopyLeaves((struct VMMState*) sourcePageTable, (uint64_t) virtualAddress / 4096, count, (struct VMMState*) destinationPageTable, false);
+}
+
+void* VMMShare(void* sourcePageTable, void* virtualAddress, size_t count, void* destinationPageTable)
+{
+	if (!sourcePageTable || !destinationPageTable)
+		return nullptr;
+
+	return VMMCopyLeaves((struct VMMState*) sourcePageTable, (uint64_t) virtualAddress / 4096, count, (struct VMMState*) destinationPageTable, true);
+}
+
+bool VMMHandlePageFault(void* pageTable, void* virtualAddress, bool write)
+{
+	if (!pageTable)
+		return false;
+
+	struct VMMState* state = (struct VMMState*) pageTable;
+	// Resolving a zero leaf replaces a translation other processors may cache, the commit shoots it down
+	VMMBatchBegin(state);
+	bool handled = VMMPageTableHandleFault(state, (uint64_t) virtualAddress / 4096, write);
+	VMMBatchCommit(state);
+	return handled;
 }
 
 void VMMActivate(void* pageTable)
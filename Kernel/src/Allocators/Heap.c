@@ -0,0 +1,92 @@
+#include "Heap.h"
+#include "KernelVMM.h"
+#include "Slab.h"
+#include "VMM.h"
+
+#include <string.h>
+
+#define HEAP_SMALLEST_SHIFT 3
+#define HEAP_LARGEST_SHIFT  10
+#define HEAP_CLASS_COUNT    (HEAP_LARGEST_SHIFT - HEAP_SMALLEST_SHIFT + 1)
+#define HEAP_LARGE_OFFSET   64 // Large allocations keep their header in front of the returned address
+
+struct HeapLargeHeader
+{
+	struct SlabCache* Cache; // Always nullptr, overlays struct Slab::Cache
+	size_t            PageCount;
+};
+
+static struct SlabCache g_HeapCaches[HEAP_CLASS_COUNT];
+
+static const char* const c_HeapCacheNames[HEAP_CLASS_COUNT] = {
+	"Heap 8",
+	"Heap 16",
+	"Heap 32",
+	"Heap 64",
+	"Heap 128",
+	"Heap 256",
+	"Heap 512",
+	"Heap 1024"
+};
+
+static uint8_t HeapGetClass(size_t size)
+{
+	if (size <= (1UL << HEAP_SMALLEST_SHIFT))
+		return 0;
+	return (64 - __builtin_clzll(size - 1)) - HEAP_SMALLEST_SHIFT;
+}
+
+static void* HeapAllocLarge(size_t size)
+{
+	size_t   pageCount = (size + HEAP_LARGE_OFFSET + 4095) / 4096;
+	uint8_t* base      = (uint8_t*) VMMAlloc(GetKernelPageTable(), pageCount, 0, VMM_PAGE_TYPE_AUTO, VMM_PAGE_PROTECT_READ_WRITE, VMM_MEMORY_TYPE_WRITE_BACK);
+	if (!base)
+		return nullptr;
+
+	struct HeapLargeHeader* header = (struct HeapLargeHeader*) base;
+	header->Cache                  = nullptr;
+	header->PageCount              = pageCount;
+	return base + HEAP_LARGE_OFFSET;
+}
+
+void HeapInit(void)
+{
+	for (uint8_t i = 0; i < HEAP_CLASS_COUNT; ++i)
+	{
+		size_t size = 1UL << (i + HEAP_SMALLEST_SHIFT);
+		SlabCacheInit(&g_HeapCaches[i], c_HeapCacheNames[i], size, size < 64 ? size : 64, nullptr, nullptr);
+	}
+}
+
+void* HeapAlloc(size_t size)
+{
+	if (size == 0)
+		return nullptr;
+	if (size > (1UL << HEAP_LARGEST_SHIFT))
+		return HeapAllocLarge(size);
+	return SlabAlloc(&g_HeapCaches[HeapGetClass(size)]);
+}
+
+void* HeapAllocZeroed(size_t size)
+{
+	void* address = HeapAlloc(size);
+	if (address)
+		memset(address, 0, size);
+	return address;
+}
+
+void HeapFree(void* address)
+{
+	if (!address)
+		return;
+
+	struct SlabCache* cache = SlabGetCache(address);
+	if (cache)
+	{
+		SlabFree(cache, address);
+		return;
+	}
+
+	struct HeapLargeHeader* header = (struct HeapLargeHeader*) ((uint64_t) address & ~0xFFFUL);
+	VMMFree(GetKernelPageTable(), header, header->PageCount);
+}
\ No newline at end of file
@@ -0,0 +1,464 @@
+#include "Slab.h"
+#include "CPU.h"
+#include "Halt.h"
+#include "PMM.h"
+
+#include <string.h>
+
+#define SLAB_MAGAZINE_SIZE 14 // Objects per magazine, which makes a magazine exactly two cache lines
+#define SLAB_EMPTY_LIMIT   2  // Empty slabs kept per cache before they are returned to the PMM
+#define SLAB_DEPOT_LIMIT   8  // Empty magazines kept in a depot before they are returned to the magazine cache
+
+struct Slab
+{
+	struct SlabCache* Cache; // Must stay first, HeapFree tells slabs apart from large allocations by it
+	struct Slab*      Prev;
+	struct Slab*      Next;
+	void*             Free;
+	size_t            InUse;
+};
+
+struct SlabMagazine
+{
+	struct SlabMagazine* Next;
+	size_t               Count;
+	void*                Objects[SLAB_MAGAZINE_SIZE];
+};
+
+static struct SlabCache* g_SlabCaches    = nullptr;
+static struct TicketLock g_SlabCacheLock;
+static struct SlabCache  g_SlabMagazineCache;
+
+static void SlabListPush(struct Slab** list, struct Slab* slab)
+{
+	slab->Prev = nullptr;
+	slab->Next = *list;
+	if (*list)
+		(*list)->Prev = slab;
+	*list = slab;
+}
+
+static void SlabListRemove(struct Slab** list, struct Slab* slab)
+{
+	if (slab->Prev)
+		slab->Prev->Next = slab->Next;
+	else
+		*list = slab->Next;
+	if (slab->Next)
+		slab->Next->Prev = slab->Prev;
+	slab->Prev = nullptr;
+	slab->Next = nullptr;
+}
+
+static struct Slab* SlabNew(struct SlabCache* cache)
+{
+	struct Slab* slab = (struct Slab*) PMMAlloc(1);
+	if (!slab)
+		return nullptr;
+
+	slab->Cache = cache;
+	slab->Prev  = nullptr;
+	slab->Next  = nullptr;
+	slab->Free  = nullptr;
+	slab->InUse = 0;
+
+	uint8_t* objects = (uint8_t*) slab + cache->FirstObject;
+	for (size_t i = cache->ObjectsPerSlab; i-- > 0;)
+	{
+		void** object = (void**) (objects + i * cache->ObjectSize);
+		*object       = slab->Free;
+		slab->Free    = object;
+	}
+	++cache->Stats.SlabCount;
+	return slab;
+}
+
+static void SlabRelease(struct SlabCache* cache, struct Slab* slab)
+{
+	PMMFree(slab, 1);
+	--cache->Stats.SlabCount;
+}
+
+// Expects the cache lock to be held
+static void* SlabTake(struct SlabCache* cache)
+{
+	struct Slab* slab = cache->Partial;
+	if (!slab)
+	{
+		slab = cache->Empty;
+		if (slab)
+		{
+			SlabListRemove(&cache->Empty, slab);
+			--cache->EmptyCount;
+		}
+		else
+		{
+			slab = SlabNew(cache);
+			if (!slab)
+				return nullptr;
+		}
+		SlabListPush(&cache->Partial, slab);
+	}
+
+	void** object = (void**) slab->Free;
+	slab->Free    = *object;
+	++slab->InUse;
+	++cache->Stats.ObjectsInUse;
+	if (!slab->Free)
+	{
+		SlabListRemove(&cache->Partial, slab);
+		SlabListPush(&cache->Full, slab);
+	}
+	return object;
+}
+
+// Expects the cache lock to be held
+static void SlabReturn(struct SlabCache* cache, void* object)
+{
+	struct Slab* slab = (struct Slab*) ((uint64_t) object & ~0xFFFUL);
+	bool         full = !slab->Free;
+
+	*(void**) object = slab->Free;
+	slab->Free       = object;
+	--slab->InUse;
+	--cache->Stats.ObjectsInUse;
+
+	if (slab->InUse == 0)
+	{
+		SlabListRemove(full ? &cache->Full : &cache->Partial, slab);
+		if (cache->EmptyCount < SLAB_EMPTY_LIMIT)
+		{
+			SlabListPush(&cache->Empty, slab);
+			++cache->EmptyCount;
+		}
+		else
+		{
+			SlabRelease(cache, slab);
+		}
+	}
+	else if (full)
+	{
+		SlabListRemove(&cache->Full, slab);
+		SlabListPush(&cache->Partial, slab);
+	}
+}
+
+static void* SlabAllocFromSlabs(struct SlabCache* cache)
+{
+	bool  interrupts = TicketLockAcquireIRQSave(&cache->Lock);
+	void* object     = SlabTake(cache);
+	TicketLockReleaseIRQRestore(&cache->Lock, interrupts);
+	if (object && cache->Constructor)
+		cache->Constructor(object);
+	return object;
+}
+
+static void SlabFreeToSlabs(struct SlabCache* cache, void* object)
+{
+	if (cache->Destructor)
+		cache->Destructor(object);
+	bool interrupts = TicketLockAcquireIRQSave(&cache->Lock);
+	SlabReturn(cache, object);
+	TicketLockReleaseIRQRestore(&cache->Lock, interrupts);
+}
+
+static struct SlabMagazine* SlabMagazineNew(void)
+{
+	struct SlabMagazine* magazine = (struct SlabMagazine*) SlabAlloc(&g_SlabMagazineCache);
+	if (magazine)
+	{
+		magazine->Next  = nullptr;
+		magazine->Count = 0;
+	}
+	return magazine;
+}
+
+static void SlabMagazineFlush(struct SlabCache* cache, struct SlabMagazine* magazine)
+{
+	if (cache->Destructor)
+	{
+		for (size_t i = 0; i < magazine->Count; ++i)
+			cache->Destructor(magazine->Objects[i]);
+	}
+	bool interrupts = TicketLockAcquireIRQSave(&cache->Lock);
+	for (size_t i = 0; i < magazine->Count; ++i)
+		SlabReturn(cache, magazine->Objects[i]);
+	TicketLockReleaseIRQRestore(&cache->Lock, interrupts);
+	SlabFree(&g_SlabMagazineCache, magazine);
+}
+
+static struct SlabMagazine* SlabDepotTake(struct SlabCache* cache, bool full)
+{
+	bool                  interrupts = TicketLockAcquireIRQSave(&cache->DepotLock);
+	struct SlabMagazine** list       = full ? &cache->FullMagazines : &cache->EmptyMagazines;
+	struct SlabMagazine*  magazine   = *list;
+	if (magazine)
+	{
+		*list = magazine->Next;
+		if (full)
+			--cache->FullMagazineCount;
+		else
+			--cache->EmptyMagazineCount;
+	}
+	TicketLockReleaseIRQRestore(&cache->DepotLock, interrupts);
+	return magazine;
+}
+
+static void SlabDepotPut(struct SlabCache* cache, struct SlabMagazine* magazine)
+{
+	bool full       = magazine->Count > 0;
+	bool interrupts = TicketLockAcquireIRQSave(&cache->DepotLock);
+	if (!full && cache->EmptyMagazineCount >= SLAB_DEPOT_LIMIT)
+	{
+		TicketLockReleaseIRQRestore(&cache->DepotLock, interrupts);
+		SlabFree(&g_SlabMagazineCache, magazine);
+		return;
+	}
+	if (full)
+	{
+		magazine->Next       = cache->FullMagazines;
+		cache->FullMagazines = magazine;
+		++cache->FullMagazineCount;
+	}
+	else
+	{
+		magazine->Next        = cache->EmptyMagazines;
+		cache->EmptyMagazines = magazine;
+		++cache->EmptyMagazineCount;
+	}
+	TicketLockReleaseIRQRestore(&cache->DepotLock, interrupts);
+}
+
+static bool SlabCacheSetup(struct SlabCache* cache, const char* name, size_t objectSize, size_t alignment, SlabObjectFn constructor, SlabObjectFn destructor, bool useMagazines)
+{
+	if (alignment < 8)
+		alignment = 8;
+	if (alignment & (alignment - 1))
+		return false;
+	objectSize = (objectSize + alignment - 1) & ~(alignment - 1);
+
+	size_t firstObject = (sizeof(struct Slab) + alignment - 1) & ~(alignment - 1);
+	if (firstObject + objectSize > 4096)
+		return false;
+
+	memset(cache, 0, sizeof(struct SlabCache));
+	cache->Name           = name;
+	cache->ObjectSize     = objectSize;
+	cache->FirstObject    = firstObject;
+	cache->ObjectsPerSlab = (4096 - firstObject) / objectSize;
+	cache->Constructor    = constructor;
+	cache->Destructor     = destructor;
+	cache->UseMagazines   = useMagazines;
+
+	bool interrupts = TicketLockAcquireIRQSave(&g_SlabCacheLock);
+	cache->Next     = g_SlabCaches;
+	g_SlabCaches    = cache;
+	TicketLockReleaseIRQRestore(&g_SlabCacheLock, interrupts);
+	return true;
+}
+
+bool SlabCacheInit(struct SlabCache* cache, const char* name, size_t objectSize, size_t alignment, SlabObjectFn constructor, SlabObjectFn destructor)
+{
+	if (!cache)
+		return false;
+
+	// Magazines come from a cache of their own, which is set up along with the first cache and never uses magazines itself
+	if (g_SlabMagazineCache.ObjectSize == 0)
+		SlabCacheSetup(&g_SlabMagazineCache, "Slab magazine", sizeof(struct SlabMagazine), 64, nullptr, nullptr, false);
+	return SlabCacheSetup(cache, name, objectSize, alignment, constructor, destructor, true);
+}
+
+struct SlabCache* SlabCacheCreate(const char* name, size_t objectSize, size_t alignment, SlabObjectFn constructor, SlabObjectFn destructor)
+{
+	struct SlabCache* cache = (struct SlabCache*) PMMAlloc((sizeof(struct SlabCache) + 4095) / 4096);
+	if (!cache)
+		return nullptr;
+
+	if (!SlabCacheInit(cache, name, objectSize, alignment, constructor, destructor))
+	{
+		PMMFree(cache, (sizeof(struct SlabCache) + 4095) / 4096);
+		return nullptr;
+	}
+	return cache;
+}
+
+void SlabCacheDestroy(struct SlabCache* cache)
+{
+	if (!cache)
+		return;
+
+	bool               interrupts = TicketLockAcquireIRQSave(&g_SlabCacheLock);
+	struct SlabCache** link       = &g_SlabCaches;
+	while (*link && *link != cache)
+		link = &(*link)->Next;
+	if (*link)
+		*link = cache->Next;
+	TicketLockReleaseIRQRestore(&g_SlabCacheLock, interrupts);
+
+	for (size_t i = 0; i < SLAB_MAX_CPUS; ++i)
+	{
+		struct SlabCPUCache* cpuCache = &cache->CPUs[i];
+		if (cpuCache->Loaded)
+			SlabMagazineFlush(cache, cpuCache->Loaded);
+		if (cpuCache->Previous)
+			SlabMagazineFlush(cache, cpuCache->Previous);
+		cpuCache->Loaded   = nullptr;
+		cpuCache->Previous = nullptr;
+	}
+	SlabCacheReap(cache);
+	while (cache->EmptyMagazines)
+		SlabFree(&g_SlabMagazineCache, SlabDepotTake(cache, false));
+
+	interrupts            = TicketLockAcquireIRQSave(&cache->Lock);
+	struct Slab* lists[3] = { cache->Empty, cache->Partial, cache->Full };
+	for (size_t i = 0; i < 3; ++i)
+	{
+		struct Slab* slab = lists[i];
+		while (slab)
+		{
+			struct Slab* next = slab->Next;
+			SlabRelease(cache, slab);
+			slab = next;
+		}
+	}
+	TicketLockReleaseIRQRestore(&cache->Lock, interrupts);
+	PMMFree(cache, (sizeof(struct SlabCache) + 4095) / 4096);
+}
+
+void SlabCacheReap(struct SlabCache* cache)
+{
+	if (!cache)
+		return;
+
+	while (true)
+	{
+		struct SlabMagazine* magazine = SlabDepotTake(cache, true);
+		if (!magazine)
+			break;
+		SlabMagazineFlush(cache, magazine);
+	}
+}
+
+void SlabCacheGetStats(struct SlabCache* cache, struct SlabCacheStats* stats)
+{
+	if (!cache || !stats)
+		return;
+
+	bool interrupts       = TicketLockAcquireIRQSave(&cache->Lock);
+	*stats                = cache->Stats;
+	stats->EmptySlabCount = cache->EmptyCount;
+	TicketLockReleaseIRQRestore(&cache->Lock, interrupts);
+	interrupts            = TicketLockAcquireIRQSave(&cache->DepotLock);
+	stats->FullMagazines  = cache->FullMagazineCount;
+	stats->EmptyMagazines = cache->EmptyMagazineCount;
+	TicketLockReleaseIRQRestore(&cache->DepotLock, interrupts);
+}
+
+struct SlabCache* SlabGetCaches(void)
+{
+	return g_SlabCaches;
+}
+
+// Expects interrupts to be disabled, so neither a tick nor an interrupt handler can get at the magazines halfway through
+static void* SlabAllocFromMagazines(struct SlabCache* cache, struct SlabCPUCache* cpuCache)
+{
+	struct SlabMagazine* loaded = cpuCache->Loaded;
+	if (loaded && loaded->Count > 0)
+		return loaded->Objects[--loaded->Count];
+
+	struct SlabMagazine* previous = cpuCache->Previous;
+	if (previous && previous->Count > 0)
+	{
+		cpuCache->Loaded   = previous;
+		cpuCache->Previous = loaded;
+		return previous->Objects[--previous->Count];
+	}
+
+	// Both magazines are empty, trade one for a full magazine from the depot
+	struct SlabMagazine* full = SlabDepotTake(cache, true);
+	if (!full)
+		return SlabAllocFromSlabs(cache);
+	if (previous)
+		SlabDepotPut(cache, previous);
+	cpuCache->Previous = loaded;
+	cpuCache->Loaded   = full;
+	return full->Objects[--full->Count];
+}
+
+void* SlabAlloc(struct SlabCache* cache)
+{
+	if (!cache || cache->ObjectsPerSlab == 0)
+		return nullptr;
+	if (!cache->UseMagazines)
+		return SlabAllocFromSlabs(cache);
+
+	// The index is only stable while this processor cannot switch threads
+	bool     interrupts = SaveAndDisableInterrupts();
+	uint32_t cpuIndex   = CPUGetIndex();
+	void*    object     = cpuIndex < SLAB_MAX_CPUS ? SlabAllocFromMagazines(cache, &cache->CPUs[cpuIndex]) : SlabAllocFromSlabs(cache);
+	RestoreInterrupts(interrupts);
+	return object;
+}
+
+// Expects interrupts to be disabled
+static void SlabFreeToMagazines(struct SlabCache* cache, struct SlabCPUCache* cpuCache, void* object)
+{
+	struct SlabMagazine* loaded = cpuCache->Loaded;
+	if (loaded && loaded->Count < SLAB_MAGAZINE_SIZE)
+	{
+		loaded->Objects[loaded->Count++] = object;
+		return;
+	}
+
+	struct SlabMagazine* previous = cpuCache->Previous;
+	if (previous && previous->Count < SLAB_MAGAZINE_SIZE)
+	{
+		cpuCache->Loaded                     = previous;
+		cpuCache->Previous                   = loaded;
+		previous->Objects[previous->Count++] = object;
+		return;
+	}
+
+	// Both magazines are full, hand one to the depot in exchange for an empty one
+	struct SlabMagazine* empty = SlabDepotTake(cache, false);
+	if (!empty)
+		empty = SlabMagazineNew();
+	if (!empty)
+	{
+		SlabFreeToSlabs(cache, object);
+		return;
+	}
+	if (previous)
+		SlabDepotPut(cache, previous);
+	cpuCache->Previous             = loaded;
+	cpuCache->Loaded               = empty;
+	empty->Objects[empty->Count++] = object;
+}
+
+void SlabFree(struct SlabCache* cache, void* object)
+{
+	if (!cache || !object)
+		return;
+	if (!cache->UseMagazines)
+	{
+		SlabFreeToSlabs(cache, object);
+		return;
+	}
+
+	bool     interrupts = SaveAndDisableInterrupts();
+	uint32_t cpuIndex   = CPUGetIndex();
+	if (cpuIndex < SLAB_MAX_CPUS)
+		SlabFreeToMagazines(cache, &cache->CPUs[cpuIndex], object);
+	else
+		SlabFreeToSlabs(cache, object);
+	RestoreInterrupts(interrupts);
+}
+
+struct SlabCache* SlabGetCache(void* object)
+{
+	if (!object)
+		return nullptr;
+
+	struct Slab* slab = (struct Slab*) ((uint64_t) object & ~0xFFFUL);
+	return slab->Cache;
+}
\ No newline at end of file
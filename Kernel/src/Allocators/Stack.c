@@ -0,0 +1,210 @@
+#include "Stack.h"
+#include "CPU.h"
+#include "Halt.h"
+#include "KernelVMM.h"
+#include "Lock.h"
+#include "PMM.h"
+#include "VMM.h"
+
+#define STACK_SLOT_PAGES (STACK_PAGES + 1)
+
+// Count and Stacks are only touched by their own processor, the alignment keeps processors from sharing lines
+struct StackCPUCache
+{
+	alignas(64) size_t Count;
+	uint64_t Hits;
+	void*    Stacks[STACK_CPU_CACHE];
+};
+
+static struct StackCPUCache g_StackCPUs[STACK_MAX_CPUS];
+static struct TicketLock    g_StackLock;
+static void*                g_StackFree      = nullptr; // Backed stacks, linked through the lowest word of each stack
+static uint8_t*             g_StackNextSlot  = nullptr;
+static uint8_t*             g_StackRegionEnd = nullptr;
+static struct StackStats    g_StackStats;
+
+// Expects the stack lock to be held
+static bool StackReserveRegion(void)
+{
+	// The slots stay reserved but unbacked, so every guard page faults
+	uint8_t* region = (uint8_t*) VMMAlloc(GetKernelPageTable(), STACK_REGION_SLOTS * STACK_SLOT_PAGES, 0, VMM_PAGE_TYPE_4KIB, VMM_PAGE_PROTECT_READ_WRITE, VMM_MEMORY_TYPE_WRITE_BACK);
+	if (!region)
+		return false;
+
+	g_StackNextSlot  = region;
+	g_StackRegionEnd = region + STACK_REGION_SLOTS * STACK_SLOT_PAGES * 4096;
+	++g_StackStats.Regions;
+	return true;
+}
+
+// Expects the stack lock to be held
+static void* StackBackSlot(void)
+{
+	if (g_StackNextSlot == g_StackRegionEnd && !StackReserveRegion())
+		return nullptr;
+
+	void*    kernelPageTable = GetKernelPageTable();
+	uint8_t* stack           = g_StackNextSlot + 4096;
+	void*    frames          = PMMAlloc(STACK_PAGES);
+	if (frames)
+	{
+		if (!VMMMapLinear(kernelPageTable, stack, frames, STACK_PAGES, VMM_MEMORY_TYPE_WRITE_BACK))
+		{
+			// Nothing ran on the stack yet, unmapping it again is enough before the frames go back
+			VMMMapLinear(kernelPageTable, stack, nullptr, STACK_PAGES, VMM_MEMORY_TYPE_WRITE_BACK);
+			PMMFree(frames, STACK_PAGES);
+			return nullptr;
+		}
+	}
+	else
+	{
+		void* pages[STACK_PAGES];
+		for (size_t i = 0; i < STACK_PAGES; ++i)
+		{
+			pages[i] = PMMAlloc(1);
+			if (!pages[i])
+			{
+				while (i-- > 0)
+					PMMFree(pages[i], 1);
+				return nullptr;
+			}
+		}
+		bool mapped = true;
+		for (size_t i = 0; i < STACK_PAGES; ++i)
+			mapped = VMMMap(kernelPageTable, stack + i * 4096, pages[i]) && mapped;
+		if (!mapped)
+		{
+			for (size_t i = 0; i < STACK_PAGES; ++i)
+			{
+				VMMMap(kernelPageTable, stack + i * 4096, nullptr);
+				PMMFree(pages[i], 1);
+			}
+			return nullptr;
+		}
+	}
+
+	g_StackNextSlot += STACK_SLOT_PAGES * 4096;
+	++g_StackStats.SlotsUsed;
+	return stack + STACK_PAGES * 4096;
+}
+
+// Expects the stack lock to be held
+static void StackPushFree(void* stackTop)
+{
+	void** link = (void**) ((uint8_t*) stackTop - STACK_PAGES * 4096);
+	*link       = g_StackFree;
+	g_StackFree = link;
+	++g_StackStats.Cached;
+}
+
+void StackInit(void)
+{
+	bool interrupts = TicketLockAcquireIRQSave(&g_StackLock);
+	StackReserveRegion();
+	TicketLockReleaseIRQRestore(&g_StackLock, interrupts);
+}
+
+void StackGetStats(struct StackStats* stats)
+{
+	if (!stats)
+		return;
+
+	bool interrupts = TicketLockAcquireIRQSave(&g_StackLock);
+	*stats          = g_StackStats;
+	TicketLockReleaseIRQRestore(&g_StackLock, interrupts);
+	uint64_t cpuCached = 0;
+	for (size_t i = 0; i < STACK_MAX_CPUS; ++i)
+	{
+		cpuCached        += g_StackCPUs[i].Count;
+		stats->CacheHits += g_StackCPUs[i].Hits;
+	}
+	stats->InUse = stats->SlotsUsed - stats->Cached - cpuCached;
+}
+
+// Expects interrupts to be disabled, so the processor cannot switch threads while it works on its own cache
+static void* StackAllocOn(uint32_t cpuIndex)
+{
+	if (cpuIndex >= STACK_MAX_CPUS)
+	{
+		TicketLockAcquire(&g_StackLock);
+		void* stack = nullptr;
+		if (g_StackFree)
+		{
+			void** link  = (void**) g_StackFree;
+			g_StackFree  = *link;
+			stack        = (uint8_t*) link + STACK_PAGES * 4096;
+			--g_StackStats.Cached;
+		}
+		else
+		{
+			stack = StackBackSlot();
+		}
+		TicketLockRelease(&g_StackLock);
+		return stack;
+	}
+
+	struct StackCPUCache* cpuCache = &g_StackCPUs[cpuIndex];
+	if (cpuCache->Count > 0)
+	{
+		++cpuCache->Hits;
+		return cpuCache->Stacks[--cpuCache->Count];
+	}
+
+	// Refill half of the cache from the global list, new slots are only backed once it runs dry
+	TicketLockAcquire(&g_StackLock);
+	++g_StackStats.CacheMisses;
+	while (cpuCache->Count < STACK_CPU_CACHE / 2 && g_StackFree)
+	{
+		void** link = (void**) g_StackFree;
+		g_StackFree = *link;
+		--g_StackStats.Cached;
+		cpuCache->Stacks[cpuCache->Count++] = (uint8_t*) link + STACK_PAGES * 4096;
+	}
+	void* stack = cpuCache->Count > 0 ? cpuCache->Stacks[--cpuCache->Count] : StackBackSlot();
+	TicketLockRelease(&g_StackLock);
+	return stack;
+}
+
+// Expects interrupts to be disabled
+static void StackFreeOn(uint32_t cpuIndex, void* stackTop)
+{
+	if (cpuIndex >= STACK_MAX_CPUS)
+	{
+		TicketLockAcquire(&g_StackLock);
+		StackPushFree(stackTop);
+		TicketLockRelease(&g_StackLock);
+		return;
+	}
+
+	struct StackCPUCache* cpuCache = &g_StackCPUs[cpuIndex];
+	if (cpuCache->Count < STACK_CPU_CACHE)
+	{
+		cpuCache->Stacks[cpuCache->Count++] = stackTop;
+		return;
+	}
+
+	// Hand half of the cache over to the global list where other processors can pick the stacks up
+	TicketLockAcquire(&g_StackLock);
+	StackPushFree(stackTop);
+	while (cpuCache->Count > STACK_CPU_CACHE / 2)
+		StackPushFree(cpuCache->Stacks[--cpuCache->Count]);
+	TicketLockRelease(&g_StackLock);
+}
+
+void* StackAlloc(void)
+{
+	bool  interrupts = SaveAndDisableInterrupts();
+	void* stack      = StackAllocOn(CPUGetIndex());
+	RestoreInterrupts(interrupts);
+	return stack;
+}
+
+void StackFree(void* stackTop)
+{
+	if (!stackTop)
+		return;
+
+	bool interrupts = SaveAndDisableInterrupts();
+	StackFreeOn(CPUGetIndex(), stackTop);
+	RestoreInterrupts(interrupts);
+}
\ No newline at end of file
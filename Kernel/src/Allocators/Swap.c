@@ -0,0 +1,117 @@
+#include "Swap.h"
+#include "Compression/LZ4.h"
+#include "Lock.h"
+#include "Slab.h"
+
+#include <string.h>
+
+#define SWAP_CLASS_COUNT 6
+
+struct SwapObject
+{
+	uint16_t Size; // Compressed size of Data
+	uint8_t  Data[];
+};
+
+// Each class fits a whole number of objects into a slab page, so the pool wastes little more than the slack within a class
+static const size_t c_SwapClassSizes[SWAP_CLASS_COUNT] = { 240, 496, 800, 1008, 1344, 2016 };
+
+static const char* const c_SwapCacheNames[SWAP_CLASS_COUNT] = {
+	"Swap 240",
+	"Swap 496",
+	"Swap 800",
+	"Swap 1008",
+	"Swap 1344",
+	"Swap 2016"
+};
+
+static struct SlabCache  g_SwapCaches[SWAP_CLASS_COUNT];
+static struct TicketLock g_SwapLock;
+static struct SwapStats  g_SwapStats;
+static struct LZ4State   g_SwapLZ4State;
+static uint8_t           g_SwapBuffer[2016 - sizeof(struct SwapObject)];
+
+void SwapInit(void)
+{
+	for (uint8_t i = 0; i < SWAP_CLASS_COUNT; ++i)
+		SlabCacheInit(&g_SwapCaches[i], c_SwapCacheNames[i], c_SwapClassSizes[i], 16, nullptr, nullptr);
+}
+
+void SwapGetStats(struct SwapStats* stats)
+{
+	if (!stats)
+		return;
+
+	bool interrupts = TicketLockAcquireIRQSave(&g_SwapLock);
+	*stats          = g_SwapStats;
+	TicketLockReleaseIRQRestore(&g_SwapLock, interrupts);
+	stats->PoolPages = 0;
+	for (uint8_t i = 0; i < SWAP_CLASS_COUNT; ++i)
+	{
+		struct SlabCacheStats cacheStats;
+		SlabCacheGetStats(&g_SwapCaches[i], &cacheStats);
+		stats->PoolPages += cacheStats.SlabCount;
+	}
+}
+
+void* SwapStore(const void* page)
+{
+	if (!page || g_SwapCaches[0].ObjectSize == 0)
+		return nullptr;
+
+	// The scratch buffer and hash table are shared, compression is serialized
+	bool interrupts = TicketLockAcquireIRQSave(&g_SwapLock);
+	++g_SwapStats.Stores;
+	size_t size = LZ4Compress(&g_SwapLZ4State, page, 4096, g_SwapBuffer, sizeof(g_SwapBuffer));
+	if (size == 0)
+	{
+		++g_SwapStats.Rejected;
+		TicketLockReleaseIRQRestore(&g_SwapLock, interrupts);
+		return nullptr;
+	}
+
+	uint8_t cls = 0;
+	while (c_SwapClassSizes[cls] < size + sizeof(struct SwapObject))
+		++cls;
+	struct SwapObject* object = (struct SwapObject*) SlabAlloc(&g_SwapCaches[cls]);
+	if (!object)
+	{
+		TicketLockReleaseIRQRestore(&g_SwapLock, interrupts);
+		return nullptr;
+	}
+	object->Size = (uint16_t) size;
+	memcpy(object->Data, g_SwapBuffer, size);
+	++g_SwapStats.StoredPages;
+	g_SwapStats.CompressedBytes += size;
+	TicketLockReleaseIRQRestore(&g_SwapLock, interrupts);
+	return object;
+}
+
+bool SwapLoad(void* handle, void* page)
+{
+	if (!handle || !page)
+		return false;
+
+	struct SwapObject* object = (struct SwapObject*) handle;
+	if (LZ4Decompress(object->Data, object->Size, page, 4096) != 4096)
+		return false;
+
+	bool interrupts = TicketLockAcquireIRQSave(&g_SwapLock);
+	++g_SwapStats.Loads;
+	TicketLockReleaseIRQRestore(&g_SwapLock, interrupts);
+	SwapRelease(handle);
+	return true;
+}
+
+void SwapRelease(void* handle)
+{
+	if (!handle)
+		return;
+
+	struct SwapObject* object     = (struct SwapObject*) handle;
+	bool               interrupts = TicketLockAcquireIRQSave(&g_SwapLock);
+	--g_SwapStats.StoredPages;
+	g_SwapStats.CompressedBytes -= object->Size;
+	TicketLockReleaseIRQRestore(&g_SwapLock, interrupts);
+	SlabFree(SlabGetCache(object), object);
+}
\ No newline at end of file
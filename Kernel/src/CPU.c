@@ -0,0 +1,55 @@
+#include "CPU.h"
+#include "Heap.h"
+
+extern uint32_t CPUArchGetBootID(void);
+extern void     CPUArchSetData(struct CPUData* data);
+
+static struct CPUData  g_CPUBootData;
+static struct CPUData* g_CPUs[CPU_MAX_COUNT];
+static size_t          g_CPUCount = 0;
+
+void CPUInitBoot(void)
+{
+	g_CPUBootData = (struct CPUData) {
+		.Self  = &g_CPUBootData,
+		.ID    = CPUArchGetBootID(),
+		.Index = 0
+	};
+	g_CPUs[0]  = &g_CPUBootData;
+	g_CPUCount = 1;
+	CPUArchSetData(&g_CPUBootData);
+}
+
+struct CPUData* CPUCreate(uint32_t id, void* stackTop)
+{
+	if (g_CPUCount == CPU_MAX_COUNT)
+		return nullptr;
+
+	// The heap hands out 64 byte aligned blocks for this size, so no two blocks share a cache line
+	struct CPUData* data = (struct CPUData*) HeapAllocZeroed(sizeof(struct CPUData));
+	if (!data)
+		return nullptr;
+
+	data->Self           = data;
+	data->ID             = id;
+	data->Index          = (uint32_t) g_CPUCount;
+	data->StackTop       = stackTop;
+	g_CPUs[g_CPUCount++] = data;
+	return data;
+}
+
+void CPUInstall(struct CPUData* data)
+{
+	if (data)
+		CPUArchSetData(data);
+}
+
+size_t CPUGetCount(void)
+{
+	return g_CPUCount;
+}
+
+struct CPUData* CPUGetDataByIndex(size_t index)
+{
+	return index < g_CPUCount ? g_CPUs[index] : nullptr;
+}
\ No newline at end of file
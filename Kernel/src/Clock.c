@@ -0,0 +1,241 @@
+#include "Clock.h"
+#include "Build.h"
+#include "CPU.h"
+
+#if BUILD_IS_ARCH_X86_64
+	#include "x86_64/Features.h"
+#endif
+
+#define CLOCK_FALLBACK_FREQUENCY 1'000'000'000
+#define CLOCK_SYNC_SPINS         (1UL << 20) // A processor that does not join the check in time is skipped
+
+// Written once by the boot processor before any other processor runs, so readers need no synchronization
+struct ClockState
+{
+	uint64_t         Base;
+	uint64_t         CyclesToTime; // 32.32 fixed point nanoseconds per cycle
+	uint64_t         TimeToCycles; // 32.32 fixed point cycles per nanosecond
+	uint64_t         Frequency;
+	enum ClockSource Source;
+	bool             Invariant;
+	bool             Synchronized;
+	uint64_t         MaxWarp;
+};
+
+// The two processors take turns reading their counters, each reading has to be at least the last one of the other side
+struct ClockSync
+{
+	alignas(64) uint32_t Target; // Index of the processor checked right now
+	uint32_t Turn;               // 0 while the boot processor reads, 1 while the target reads
+	uint64_t Last;
+	uint64_t Warp;
+	bool     Done;
+};
+
+static struct ClockState g_ClockState;
+static struct ClockSync  g_ClockSync;
+
+static void ClockPause(void)
+{
+#if BUILD_IS_ARCH_X86_64
+	__builtin_ia32_pause();
+#endif
+}
+
+static uint64_t ClockDiscoverFrequency(enum ClockSource* source)
+{
+#if BUILD_IS_ARCH_X86_64
+	uint32_t registers[4];
+	x86_64CPUID(1, 0, registers);
+	if (registers[2] & (1U << 31))
+	{
+		// Hypervisors know the rate they scale the counter to better than any leaf passed through from the host
+		x86_64CPUID(0x4000'0000, 0, registers);
+		if (registers[0] >= 0x4000'0010)
+		{
+			x86_64CPUID(0x4000'0010, 0, registers);
+			if (registers[0])
+			{
+				*source = ClockSourceHypervisor;
+				return (uint64_t) registers[0] * 1'000;
+			}
+		}
+	}
+
+	x86_64CPUID(0, 0, registers);
+	uint32_t maxLeaf = registers[0];
+	if (maxLeaf >= 0x15)
+	{
+		// The counter runs at the crystal clock times EBX / EAX, processors that do not report the crystal run it at the base frequency
+		x86_64CPUID(0x15, 0, registers);
+		uint32_t denominator = registers[0];
+		uint32_t numerator   = registers[1];
+		uint32_t crystal     = registers[2];
+		if (denominator && numerator)
+		{
+			if (crystal)
+			{
+				*source = ClockSourceCPUID;
+				return (uint64_t) crystal * numerator / denominator;
+			}
+			if (maxLeaf >= 0x16)
+			{
+				x86_64CPUID(0x16, 0, registers);
+				if (registers[0] & 0xFFFF)
+				{
+					*source = ClockSourceCPUID;
+					return (uint64_t) (registers[0] & 0xFFFF) * 1'000'000;
+				}
+			}
+		}
+	}
+#endif
+	return 0;
+}
+
+static bool ClockDetectInvariant(void)
+{
+#if BUILD_IS_ARCH_X86_64
+	uint32_t registers[4];
+	x86_64CPUID(0x8000'0000, 0, registers);
+	if (registers[0] < 0x8000'0007)
+		return false;
+	x86_64CPUID(0x8000'0007, 0, registers);
+	return registers[3] & (1U << 8);
+#else
+	return false;
+#endif
+}
+
+static void ClockRecordWarp(uint64_t now)
+{
+	uint64_t last = __atomic_load_n(&g_ClockSync.Last, __ATOMIC_RELAXED);
+	if (now < last)
+	{
+		uint64_t warp = last - now;
+		if (warp > g_ClockSync.Warp)
+			g_ClockSync.Warp = warp;
+	}
+	__atomic_store_n(&g_ClockSync.Last, now, __ATOMIC_RELAXED);
+}
+
+void ClockInit(uint64_t calibratedFrequency)
+{
+	enum ClockSource source    = ClockSourceFallback;
+	uint64_t         frequency = ClockDiscoverFrequency(&source);
+	if (!frequency && calibratedFrequency)
+	{
+		source    = ClockSourceCalibrated;
+		frequency = calibratedFrequency;
+	}
+	if (!frequency)
+	{
+		source    = ClockSourceFallback;
+		frequency = CLOCK_FALLBACK_FREQUENCY;
+	}
+
+	g_ClockState = (struct ClockState) {
+		.Base         = CPUReadCycles(),
+		.CyclesToTime = (1'000'000'000UL << 32) / frequency,
+		.TimeToCycles = ((frequency << 24) / 1'000'000'000) << 8, // Shifting in two steps keeps the dividend within 64 bits
+		.Frequency    = frequency,
+		.Source       = source,
+		.Invariant    = ClockDetectInvariant(),
+		.Synchronized = true,
+		.MaxWarp      = 0
+	};
+}
+
+void ClockGetStats(struct ClockStats* stats)
+{
+	if (!stats)
+		return;
+
+	*stats = (struct ClockStats) {
+		.Frequency    = g_ClockState.Frequency,
+		.Source       = g_ClockState.Source,
+		.Invariant    = g_ClockState.Invariant,
+		.Synchronized = g_ClockState.Synchronized,
+		.MaxWarp      = g_ClockState.MaxWarp
+	};
+}
+
+uint64_t ClockGetTime(void)
+{
+	// A processor whose counter lags the boot processor's could read a value before the base
+	int64_t cycles = (int64_t) (CPUReadCycles() - g_ClockState.Base);
+	if (cycles < 0)
+		return 0;
+	return (uint64_t) (((unsigned __int128) cycles * g_ClockState.CyclesToTime) >> 32);
+}
+
+uint64_t ClockToCycles(uint64_t time)
+{
+	return g_ClockState.Base + (uint64_t) (((unsigned __int128) time * g_ClockState.TimeToCycles) >> 32);
+}
+
+bool ClockSyncCheck(size_t cpuCount)
+{
+	uint64_t maxWarp = 0;
+	for (size_t i = 1; i < cpuCount; ++i)
+	{
+		g_ClockSync.Warp = 0;
+		__atomic_store_n(&g_ClockSync.Last, CPUReadCyclesOrdered(), __ATOMIC_RELAXED);
+		__atomic_store_n(&g_ClockSync.Turn, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&g_ClockSync.Target, (uint32_t) i, __ATOMIC_RELEASE);
+
+		bool joined = true;
+		for (uint32_t round = 0; round < CLOCK_SYNC_ROUNDS && joined; ++round)
+		{
+			uint64_t spins = 0;
+			while (__atomic_load_n(&g_ClockSync.Turn, __ATOMIC_ACQUIRE) != 0 && spins < CLOCK_SYNC_SPINS)
+			{
+				ClockPause();
+				++spins;
+			}
+			if (spins == CLOCK_SYNC_SPINS)
+			{
+				joined = false;
+				break;
+			}
+			ClockRecordWarp(CPUReadCyclesOrdered());
+			__atomic_store_n(&g_ClockSync.Turn, 1, __ATOMIC_RELEASE);
+		}
+		// The last reading of the target still has to be checked before the next processor gets its turn
+		for (uint64_t spins = 0; joined && __atomic_load_n(&g_ClockSync.Turn, __ATOMIC_ACQUIRE) != 0 && spins < CLOCK_SYNC_SPINS; ++spins)
+			ClockPause();
+		ClockRecordWarp(CPUReadCyclesOrdered());
+		if (g_ClockSync.Warp > maxWarp)
+			maxWarp = g_ClockSync.Warp;
+	}
+	__atomic_store_n(&g_ClockSync.Target, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&g_ClockSync.Done, true, __ATOMIC_RELEASE);
+
+	g_ClockState.MaxWarp      = maxWarp;
+	g_ClockState.Synchronized = maxWarp == 0;
+	return g_ClockState.Synchronized;
+}
+
+void ClockSyncJoin(void)
+{
+	uint32_t index = CPUGetIndex();
+	while (__atomic_load_n(&g_ClockSync.Target, __ATOMIC_ACQUIRE) != index)
+	{
+		if (__atomic_load_n(&g_ClockSync.Done, __ATOMIC_ACQUIRE))
+			return;
+		ClockPause();
+	}
+
+	for (uint32_t round = 0; round < CLOCK_SYNC_ROUNDS; ++round)
+	{
+		// The boot processor moves on when this one took too long, its turns then belong to the next processor
+		while (__atomic_load_n(&g_ClockSync.Turn, __ATOMIC_ACQUIRE) != 1)
+		{
+			if (__atomic_load_n(&g_ClockSync.Target, __ATOMIC_ACQUIRE) != index)
+				return;
+			ClockPause();
+		}
+		ClockRecordWarp(CPUReadCyclesOrdered());
+		__atomic_store_n(&g_ClockSync.Turn, 0, __ATOMIC_RELEASE);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include "Compression/LZ4.h"
+
+#include <string.h>
+
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5  // The block has to end in at least this many literals
+#define LZ4_MATCH_LIMIT   12 // Matches may not start within this many bytes of the end
+
+static uint32_t LZ4Read32(const uint8_t* address)
+{
+	uint32_t value;
+	memcpy(&value, address, 4);
+	return value;
+}
+
+static uint32_t LZ4Hash(uint32_t sequence)
+{
+	return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t* LZ4WriteLength(uint8_t* output, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		*output++ = 255;
+	*output++ = (uint8_t) length;
+	return output;
+}
+
+static bool LZ4ReadLength(const uint8_t** input, const uint8_t* inputEnd, size_t* length)
+{
+	uint8_t byte;
+	do
+	{
+		if (*input >= inputEnd)
+			return false;
+		byte     = *(*input)++;
+		*length += byte;
+	}
+	while (byte == 255);
+	return true;
+}
+
+static uint8_t* LZ4WriteSequence(uint8_t* output, uint8_t* outputEnd, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength, bool last)
+{
+	// Worst case of the token, both length extensions, the literals and the offset
+	size_t required = 1 + literalLength / 255 + 1 + literalLength + (last ? 0 : 2 + matchLength / 255 + 1);
+	if (required > (size_t) (outputEnd - output))
+		return nullptr;
+
+	uint8_t* token = output++;
+	*token         = (uint8_t) ((literalLength < 15 ? literalLength : 15) << 4);
+	if (literalLength >= 15)
+		output = LZ4WriteLength(output, literalLength - 15);
+	memcpy(output, literals, literalLength);
+	output += literalLength;
+	if (last)
+		return output;
+
+	*output++  = (uint8_t) offset;
+	*output++  = (uint8_t) (offset >> 8);
+	*token    |= matchLength < 15 ? matchLength : 15;
+	if (matchLength >= 15)
+		output = LZ4WriteLength(output, matchLength - 15);
+	return output;
+}
+
+size_t LZ4Compress(struct LZ4State* state, const void* source, size_t sourceSize, void* destination, size_t destinationCapacity)
+{
+	if (!state || !source || !destination || sourceSize > LZ4_MAX_INPUT)
+		return 0;
+
+	const uint8_t* input     = (const uint8_t*) source;
+	const uint8_t* inputEnd  = input + sourceSize;
+	uint8_t*       output    = (uint8_t*) destination;
+	uint8_t*       outputEnd = output + destinationCapacity;
+	const uint8_t* anchor    = input;
+
+	memset(state->Table, 0, sizeof(state->Table));
+	if (sourceSize > LZ4_MATCH_LIMIT)
+	{
+		const uint8_t* matchLimit = inputEnd - LZ4_MATCH_LIMIT;
+		const uint8_t* copyLimit  = inputEnd - LZ4_LAST_LITERALS;
+		const uint8_t* current    = input;
+		while (current <= matchLimit)
+		{
+			uint32_t       sequence  = LZ4Read32(current);
+			uint32_t       hash      = LZ4Hash(sequence);
+			const uint8_t* reference = input + state->Table[hash];
+			state->Table[hash]       = (uint16_t) (current - input);
+			if (reference >= current || LZ4Read32(reference) != sequence)
+			{
+				++current;
+				continue;
+			}
+
+			while (current > anchor && reference > input && current[-1] == reference[-1])
+			{
+				--current;
+				--reference;
+			}
+			const uint8_t* matchEnd     = current + LZ4_MIN_MATCH;
+			const uint8_t* referenceEnd = reference + LZ4_MIN_MATCH;
+			while (matchEnd < copyLimit && *matchEnd == *referenceEnd)
+			{
+				++matchEnd;
+				++referenceEnd;
+			}
+
+			output = LZ4WriteSequence(output, outputEnd, anchor, current - anchor, current - reference, matchEnd - current - LZ4_MIN_MATCH, false);
+			if (!output)
+				return 0;
+			current = matchEnd;
+			anchor  = matchEnd;
+		}
+	}
+
+	output = LZ4WriteSequence(output, outputEnd, anchor, inputEnd - anchor, 0, 0, true);
+	if (!output)
+		return 0;
+	return output - (uint8_t*) destination;
+}
+
+size_t LZ4Decompress(const void* source, size_t sourceSize, void* destination, size_t destinationCapacity)
+{
+	if (!source || !destination)
+		return 0;
+
+	const uint8_t* input       = (const uint8_t*) source;
+	const uint8_t* inputEnd    = input + sourceSize;
+	uint8_t*       output      = (uint8_t*) destination;
+	uint8_t*       outputStart = output;
+	uint8_t*       outputEnd   = output + destinationCapacity;
+	while (input < inputEnd)
+	{
+		uint8_t token         = *input++;
+		size_t  literalLength = token >> 4;
+		if (literalLength == 15 && !LZ4ReadLength(&input, inputEnd, &literalLength))
+			return 0;
+		if (literalLength > (size_t) (inputEnd - input) || literalLength > (size_t) (outputEnd - output))
+			return 0;
+		memcpy(output, input, literalLength);
+		input  += literalLength;
+		output += literalLength;
+		if (input == inputEnd)
+			break;
+
+		if (inputEnd - input < 2)
+			return 0;
+		size_t offset  = input[0] | ((size_t) input[1] << 8);
+		input         += 2;
+		if (offset == 0 || offset > (size_t) (output - outputStart))
+			return 0;
+		size_t matchLength = token & 15;
+		if (matchLength == 15 && !LZ4ReadLength(&input, inputEnd, &matchLength))
+			return 0;
+		matchLength += LZ4_MIN_MATCH;
+		if (matchLength > (size_t) (outputEnd - output))
+			return 0;
+		// Matches may overlap their own output, so they are copied front to back
+		const uint8_t* reference = output - offset;
+		for (size_t i = 0; i < matchLength; ++i)
+			output[i] = reference[i];
+		output += matchLength;
+	}
+	return output - outputStart;
+}
\ No newline at end of file
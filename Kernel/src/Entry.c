@@ -1,24 +1,42 @@
 #include "ACPI/ACPI.h"
 #include "Build.h"
+#include "CPU.h"
+#include "Clock.h"
 #include "DebugCon.h"
+#include "FPU.h"
 #include "Graphics/Graphics.h"
 #include "Halt.h"
+#include "Heap.h"
+#include "Idle.h"
 #include "KernelVMM.h"
+#include "Lock.h"
 #include "Log.h"
 #include "PMM.h"
+#include "RCU.h"
+#include "SMPCall.h"
+#include "Scheduler.h"
+#include "Slab.h"
+#include "Stack.h"
+#include "Swap.h"
+#include "Task.h"
+#include "Timer.h"
 #include "Ultra/UltraProtocol.h"
 #include "VMM.h"
 
 #include <string.h>
 
 #if BUILD_IS_ARCH_X86_64
+	#include "x86_64/APIC.h"
 	#include "x86_64/GDT.h"
 	#include "x86_64/IDT.h"
 	#include "x86_64/InterruptHandlers.h"
+	#include "x86_64/TSS.h"
 	#include "x86_64/Trampoline.h"
 	#include "x86_64/Features.h"
 #endif
 
+#define SMP_BOOT_SPINS (1ULL << 30)
+
 struct KernelStartupData
 {
 	void* RsdpAddress;
@@ -28,16 +46,35 @@ struct KernelStartupData
 	void* BasicLatin;
 };
 
+static void SMPCountCall(void* userdata)
+{
+	__atomic_add_fetch((uint32_t*) userdata, 1, __ATOMIC_RELAXED);
+}
+
+#if BUILD_IS_CONFIG_DEBUG
+// Getting here at all covers ThreadCreate, the tests run on a thread as they need the scheduler and the timer tick
+static void SelfTestThread(void* userdata)
+{
+	bool passed = TaskSelfTest();
+	passed      = TimerSelfTest() && passed;
+	passed      = RCUSelfTest() && passed;
+	if (passed)
+		LogDebug("SelfTest", "Every self-test passed");
+}
+#endif
+
 static bool UltraProtocolMemoryMapConverter(void* userdata, size_t index, struct PMMMemoryMapEntry* entry);
 static void UltraProtocolPrintAttributes(struct ultra_attribute_header* firstAttribute, uint32_t attributeCount);
 
-bool    g_LapicWaitLock = false;
-uint8_t g_LapicsRunning = 0;
-void    CPUTrampoline(uint8_t lapicID);
-void*   CPUStackAlloc(void);
+bool     g_LapicWaitLock = false;
+uint32_t g_LapicsRunning = 0;
+void     CPUTrampoline(struct CPUData* cpu);
+
+static void SMPWaitFor(uint32_t* counter, size_t target);
 
 void kernel_entry(struct ultra_boot_context* bootContext, uint32_t magic)
 {
+	CPUInitBoot();
 	LogDebugFormatted("Entry", "BootContext: 0x%016lX, magic: %08X", (uint64_t) bootContext, magic);
 	if (!bootContext)
 	{
@@ -68,10 +105,21 @@ void kernel_entry(struct ultra_boot_context* bootContext, uint32_t magic)
 	x86_64GDTSetDataDescriptor(4);
 	x86_64IDTClearDescriptors();
 	x86_64IDTSetTrapGate(0x0D, (uint64_t) x86_64GPExceptionHandlerWrapper, 8, 0, 0);
+	x86_64IDTSetInterruptGate(0x0E, (uint64_t) x86_64PageFaultHandlerWrapper, 8, 0, 0);
+	x86_64IDTSetInterruptGate(APIC_TIMER_VECTOR, (uint64_t) x86_64TimerInterruptHandlerWrapper, 8, 0, 0);
+	x86_64IDTSetInterruptGate(APIC_WAKEUP_VECTOR, (uint64_t) x86_64WakeupInterruptHandlerWrapper, 8, 0, 0);
+	x86_64IDTSetInterruptGate(APIC_CALL_VECTOR, (uint64_t) x86_64CallInterruptHandlerWrapper, 8, 0, 0);
 	x86_64IDTSetInterruptGate(0x40, (uint64_t) x86_64TestInterruptHandlerWrapper, 8, 0, 0);
+	x86_64IDTSetInterruptGate(APIC_SPURIOUS_VECTOR, (uint64_t) x86_64SpuriousInterruptHandlerWrapper, 8, 0, 0);
 	x86_64LoadGDT(8, 16);
 	x86_64LoadLDT(0);
 	x86_64LoadIDT();
+	if (CPUGetData() != CPUGetDataByIndex(0))
+	{
+		LogCritical("Entry", "Processor data got lost while loading the GDT");
+		CPUHalt();
+		return;
+	}
 	EnableInterrupts();
 #endif
 
@@ -131,11 +179,64 @@ void kernel_entry(struct ultra_boot_context* bootContext, uint32_t magic)
 	}
 
 	KernelVMMInit();
+	HeapInit();
+	SwapInit();
+	StackInit();
+#if BUILD_IS_ARCH_X86_64
+	// The interrupt stacks need the stack allocator, until now every fault ran on the stack it hit
+	if (x86_64TSSCreate(CPUGetData()) && x86_64TSSLoad())
+	{
+		x86_64IDTSetInterruptGate(0x02, (uint64_t) x86_64NMIHandlerWrapper, 8, 0, X86_64_IST_NMI);
+		x86_64IDTSetInterruptGate(0x08, (uint64_t) x86_64DoubleFaultHandlerWrapper, 8, 0, X86_64_IST_DOUBLE_FAULT);
+		x86_64IDTSetInterruptGate(0x0E, (uint64_t) x86_64PageFaultHandlerWrapper, 8, 0, X86_64_IST_PAGE_FAULT);
+	}
+	else
+	{
+		LogError("TSS", "Failed to allocate the interrupt stacks");
+	}
+#endif
+	SchedulerInit();
+	GraphicsMapFramebuffer(&kernelStartupData.Framebuffer);
 	LoadFont((struct FontHeader*) kernelStartupData.BasicLatin);
 	LogInit(&kernelStartupData.Framebuffer);
 	UltraProtocolPrintAttributes(bootContext->attributes, bootContext->attribute_count);
 	HandleACPITables(kernelStartupData.RsdpAddress);
 	PMMReclaim();
+#if BUILD_IS_ARCH_X86_64
+	if (x86_64APICInit(GetLAPICAddress()))
+		LogDebugFormatted("APIC", "Using %s mode", x86_64APICIsX2APIC() ? "x2APIC" : "xAPIC");
+	else
+		LogError("APIC", "Failed to set up the local APIC");
+#endif
+	TimerInit();
+	IdleInit();
+	if (!FPUInitCPU())
+		LogError("FPU", "Failed to allocate the save areas");
+
+	{
+		static const char* const c_ClockSourceStrs[] = { "assumed", "calibrated", "CPUID", "hypervisor" };
+
+		struct ClockStats clockStats;
+		ClockGetStats(&clockStats);
+		struct TimerStats timerStats;
+		TimerGetStats(&timerStats);
+		LogDebugFormatted("Clock", "Cycle Counter:    %lu Hz (%s, %s)", clockStats.Frequency, c_ClockSourceStrs[clockStats.Source], clockStats.Invariant ? "invariant" : "not invariant");
+		LogDebugFormatted("Timer", "APIC Timer:       %lu Hz (%s)", timerStats.APICFrequency, timerStats.TSCDeadline ? "TSC-deadline" : "one-shot");
+		if (!clockStats.Invariant)
+			LogWarn("Clock", "Cycle counter is not invariant, time drifts when the processor changes its frequency");
+		struct IdleStats idleStats;
+		IdleGetStats(&idleStats);
+		if (idleStats.MWait)
+			LogDebugFormatted("Idle", "Wait:             MWAIT (hint 0x%02X)", idleStats.MWaitHint);
+		else
+			LogDebug("Idle", "Wait:             HLT");
+		struct FPUStats fpuStats;
+		FPUGetStats(&fpuStats);
+		if (fpuStats.Features)
+			LogDebugFormatted("FPU", "State:            XSAVE%s (components 0x%lX, %u bytes)", fpuStats.XSaveOpt ? "OPT" : "", fpuStats.Features, fpuStats.StateSize);
+		else
+			LogDebugFormatted("FPU", "State:            FXSAVE (%u bytes)", fpuStats.StateSize);
+	}
 
 	{
 		struct PMMMemoryStats memoryStats;
@@ -146,22 +247,58 @@ void kernel_entry(struct ultra_boot_context* bootContext, uint32_t magic)
 		LogDebugFormatted("PMM", "Last Address:        0x%016lX", memoryStats.LastAddress);
 		LogDebugFormatted("PMM", "Pages Taken:         0x%016lX", memoryStats.PagesTaken);
 		LogDebugFormatted("PMM", "Pages Free:          0x%016lX", memoryStats.PagesFree);
+		LogDebugFormatted("PMM", "Compaction:          %lu runs, %lu regions recovered, %lu pages migrated", memoryStats.CompactionRuns, memoryStats.CompactionRegionsRecovered, memoryStats.CompactionPagesMigrated);
+		LogDebugFormatted("PMM", "Eviction:            %lu runs, %lu pages evicted, %lu stalls, %lu reserve frames taken", memoryStats.EvictionRuns, memoryStats.PagesEvicted, memoryStats.EvictionStalls, memoryStats.EvictionReserveTaken);
 	}
 
 	{
 		void*                 kernelPageTable = GetKernelPageTable();
 		struct VMMMemoryStats memoryStats;
 		VMMGetMemoryStats(kernelPageTable, &memoryStats);
-		LogDebugFormatted("VMM", "Address:         0x%016lX", (uint64_t) kernelPageTable);
-		LogDebugFormatted("VMM", "Footprint:       %lu", (memoryStats.AllocatorFootprint + 4095) / 4096);
-		LogDebugFormatted("VMM", "Pages Allocated: %lu", memoryStats.PagesAllocated);
+		uint64_t mappedBytes = memoryStats.Mapped4KiB * 4096 + memoryStats.Mapped2MiB * 0x20'0000 + memoryStats.Mapped1GiB * 0x4000'0000;
+		if (mappedBytes == 0)
+			mappedBytes = 1;
+		LogDebugFormatted("VMM", "Address:           0x%016lX", (uint64_t) kernelPageTable);
+		LogDebugFormatted("VMM", "Footprint:         %lu", (memoryStats.AllocatorFootprint + 4095) / 4096);
+		LogDebugFormatted("VMM", "Pages Allocated:   %lu", memoryStats.PagesAllocated);
+		LogDebugFormatted("VMM", "Table Pages:       %lu %lu %lu %lu %lu (%lu cached)", memoryStats.TablePages[0], memoryStats.TablePages[1], memoryStats.TablePages[2], memoryStats.TablePages[3], memoryStats.TablePages[4], memoryStats.CachedTablePages);
+		LogDebugFormatted("VMM", "Free Entries:      %lu / %lu in %lu pages", memoryStats.FreeEntriesUsed, memoryStats.FreeEntriesCapacity, memoryStats.FreeEntryPages);
+		LogDebugFormatted("VMM", "Mapped 4 KiB:      %lu (%lu%%)", memoryStats.Mapped4KiB, memoryStats.Mapped4KiB * 4096 * 100 / mappedBytes);
+		LogDebugFormatted("VMM", "Mapped 2 MiB:      %lu (%lu%%)", memoryStats.Mapped2MiB, memoryStats.Mapped2MiB * 0x20'0000 * 100 / mappedBytes);
+		LogDebugFormatted("VMM", "Mapped 1 GiB:      %lu (%lu%%)", memoryStats.Mapped1GiB, memoryStats.Mapped1GiB * 0x4000'0000 * 100 / mappedBytes);
+		LogDebugFormatted("VMM", "Fills / Frees:     %lu / %lu", memoryStats.Fills, memoryStats.Frees);
+		LogDebugFormatted("VMM", "Translations:      %lu (%lu steps)", memoryStats.Translations, memoryStats.TranslationSteps);
+		LogDebugFormatted("VMM", "Zero Faults:       %lu", memoryStats.ZeroFaults);
+		LogDebugFormatted("VMM", "Swapped Pages:     %lu (%lu out, %lu in)", memoryStats.SwappedPages, memoryStats.SwapOuts, memoryStats.SwapIns);
+	}
+
+	{
+		struct SwapStats swapStats;
+		SwapGetStats(&swapStats);
+		LogDebugFormatted("Swap", "Stored Pages:     %lu in %lu pool pages (%lu bytes compressed)", swapStats.StoredPages, swapStats.PoolPages, swapStats.CompressedBytes);
+		LogDebugFormatted("Swap", "Stores / Loads:   %lu / %lu (%lu rejected)", swapStats.Stores, swapStats.Loads, swapStats.Rejected);
+	}
+
+	{
+		struct StackStats stackStats;
+		StackGetStats(&stackStats);
+		LogDebugFormatted("Stack", "Slots:            %lu used in %lu regions, %lu in use, %lu cached", stackStats.SlotsUsed, stackStats.Regions, stackStats.InUse, stackStats.Cached);
+		LogDebugFormatted("Stack", "Cache Hits:       %lu (%lu misses)", stackStats.CacheHits, stackStats.CacheMisses);
 	}
 
-	uint8_t  lapicCount = 0;
-	uint8_t* lapicIDs   = GetLAPICIDs(&lapicCount);
+	for (struct SlabCache* cache = SlabGetCaches(); cache; cache = cache->Next)
+	{
+		struct SlabCacheStats cacheStats;
+		SlabCacheGetStats(cache, &cacheStats);
+		LogDebugFormatted("Slab", "%-16s %4lu B: %lu objects in %lu slabs (%lu empty)", cache->Name, cache->ObjectSize, cacheStats.ObjectsInUse, cacheStats.SlabCount, cacheStats.EmptySlabCount);
+	}
+
+	uint32_t  lapicCount = 0;
+	uint32_t* lapicIDs   = GetLAPICIDs(&lapicCount);
 	if (lapicCount > 1)
 	{
-		LogDebugFormatted("SMP", "Booting up %hhu additional cores", lapicCount - 1);
+		uint64_t bootStart = CPUReadCycles();
+		LogDebugFormatted("SMP", "Booting up %u additional cores", lapicCount - 1);
 		void*   kernelPageTable        = GetKernelPageTable();
 		uint8_t kernelPageTableLevels  = 0;
 		bool    kernelPageTableUse1GiB = false;
@@ -169,96 +306,184 @@ void kernel_entry(struct ultra_boot_context* bootContext, uint32_t magic)
 		void*   tempRootPageTable      = PMMAllocBelow(1, 0xFFFF'FFFFU);
 		memcpy(tempRootPageTable, kernelRootPage, 4096);
 
+		// Every core gets its stack and processor data up front, so none of them has to wait on another during bring-up
+		for (size_t i = 0; i < lapicCount; ++i)
+		{
+			// The boot core is looked up by ID, x2APIC entries do not have to follow it in the MADT
+			uint32_t id = lapicIDs[i];
+			if (id == GetProcessorID())
+				continue;
+
+			void*           stackTop = StackAlloc();
+			struct CPUData* cpu      = stackTop ? CPUCreate(id, stackTop) : nullptr;
+			if (!cpu)
+			{
+				LogErrorFormatted("SMP", "Failed to allocate stack or processor data for core %u", id);
+				StackFree(stackTop);
+			}
 #if BUILD_IS_ARCH_X86_64
-		g_x86_64TrampolineSettings = (struct x86_64TrampolineSettings) {
+			else if (!x86_64TSSCreate(cpu))
+			{
+				// The core has to stop before it takes a fault, its IDT entries refer to interrupt stacks it does not have
+				LogErrorFormatted("SMP", "Failed to allocate the interrupt stacks for core %u", id);
+			}
+#endif
+		}
+		size_t coreCount = CPUGetCount() - 1;
+		// Cores may send calls as soon as they run, the boot core has to take them from then on
+		if (!SMPCallInitCPU())
+			LogError("SMP", "Failed to allocate the call slots");
+
+#if BUILD_IS_ARCH_X86_64
+		// The trampoline lives in the read-execute kernel text, so its settings are only written into the copy at 0x1000
+		memcpy((void*) 0x1000, x86_64Trampoline, 4096);
+
+		struct x86_64TrampolineSlot* trampolineSlots = (struct x86_64TrampolineSlot*) HeapAlloc(coreCount * sizeof(struct x86_64TrampolineSlot));
+		if (!trampolineSlots)
+		{
+			LogError("SMP", "Failed to allocate trampoline slots");
+			coreCount = 0;
+		}
+		for (size_t i = 0; i < coreCount; ++i)
+		{
+			struct CPUData* cpu = CPUGetDataByIndex(i + 1);
+			trampolineSlots[i]  = (struct x86_64TrampolineSlot) {
+				.ID       = cpu->ID,
+				.Reserved = 0,
+				.StackTop = (uint64_t) cpu->StackTop,
+				.CPUData  = (uint64_t) cpu
+			};
+		}
+
+		struct x86_64TrampolineSettings* trampolineSettings = (struct x86_64TrampolineSettings*) (0x1000 + ((uint64_t) &g_x86_64TrampolineSettings - (uint64_t) x86_64Trampoline));
+		struct x86_64TrampolineStats*    trampolineStats    = (struct x86_64TrampolineStats*) (0x1000 + ((uint64_t) &g_x86_64TrampolineStats - (uint64_t) x86_64Trampoline));
+		*trampolineSettings                                 = (struct x86_64TrampolineSettings) {
 			.PageTable         = (uint64_t) tempRootPageTable,
 			.PageTableSettings = (kernelPageTableLevels == 5 ? 1 : 0) | (kernelPageTableUse1GiB ? 2 : 0),
 			.CPUTrampolineFn   = (uint64_t) CPUTrampoline,
-			.StackAllocFn      = (uint64_t) CPUStackAlloc
+			.Slots             = (uint64_t) trampolineSlots,
+			.SlotCount         = coreCount
+		};
+		*trampolineStats = (struct x86_64TrampolineStats) {
+			.Alive = 0
 		};
-		memcpy((void*) 0x1000, x86_64Trampoline, 4096);
-
-		struct x86_64TrampolineStats* trampolineStats = (struct x86_64TrampolineStats*) (0x1000 + ((uint64_t) &g_x86_64TrampolineStats - (uint64_t) x86_64Trampoline));
 #endif
 
-		void*     lapicAddress   = GetLAPICAddress();
-		uint32_t* lapicRegisters = (uint32_t*) lapicAddress;
+		uint64_t prepareEnd = CPUReadCycles();
+		uint64_t initEnd    = prepareEnd;
+		uint64_t startupEnd = prepareEnd;
+		uint32_t coresAlive = 0;
 
 		g_LapicWaitLock = true;
-		for (size_t i = 1; i < lapicCount; ++i) // Hoping implementations uphold the ACPI specification with first lapicID being the boot core
+#if BUILD_IS_ARCH_X86_64
+		// INIT goes out to every core before the first startup IPI, then each startup IPI round is sent to all of them back to back
+		for (size_t i = 1; i <= coreCount; ++i)
 		{
-			uint8_t id = lapicIDs[i];
-
-			uint8_t pLapicsRunning = g_LapicsRunning;
-
-			*trampolineStats = (struct x86_64TrampolineStats) {
-				.Alive = 0,
-				.Ack   = 0
-			};
-
-			LogDebugFormatted("SMP", "Sending startup IPI to core %hhu", id);
-
-			lapicRegisters[0xA0] = 0;
-			lapicRegisters[0xC4] = lapicRegisters[0xC4] & 0x00FF'FFFF | (id << 24);
-			lapicRegisters[0xC0] = lapicRegisters[0xC0] & 0xFFF0'0000 | 0xC500;
-			while (lapicRegisters[0xC0] & 4096);
-			lapicRegisters[0xC4] = lapicRegisters[0xC4] & 0x00FF'FFFF | (id << 24);
-			lapicRegisters[0xC0] = lapicRegisters[0xC0] & 0xFFF0'0000 | 0x8500;
-			while (lapicRegisters[0xC0] & 4096);
-
-			for (uint8_t j = 0; j < 2; ++j)
-			{
-				lapicRegisters[0xA0] = 0;
-				lapicRegisters[0xC4] = lapicRegisters[0xC4] & 0x00FF'FFFF | (id << 24);
-				uint32_t val         = lapicRegisters[0xC0] & 0xFFF0'F800 | 0x0601;
-				lapicRegisters[0xC0] = val;
-				while (lapicRegisters[0xC0] & 4096);
-			}
-
-			while (!trampolineStats->Alive); // Wait for cpu to be alive
-			LogDebugFormatted("SMP", "Core %hhu alive", id);
-			trampolineStats->Ack = true;
+			uint32_t id = CPUGetDataByIndex(i)->ID;
+			x86_64APICSendIPI(id, APIC_ICR_INIT_ASSERT);
+			if (!x86_64APICIsX2APIC())
+				x86_64APICSendIPI(id, APIC_ICR_INIT_DEASSERT);
+		}
+		initEnd = CPUReadCycles();
+		for (uint8_t j = 0; j < 2; ++j)
+		{
+			for (size_t i = 1; i <= coreCount; ++i)
+				x86_64APICSendIPI(CPUGetDataByIndex(i)->ID, APIC_ICR_STARTUP | (0x1000 >> 12));
+		}
+		startupEnd = CPUReadCycles();
 
-			while (g_LapicsRunning == pLapicsRunning); // Synchronize with lapic bootstrap
-			LogDebugFormatted("SMP", "Core %hhu booted", id);
+		SMPWaitFor(&trampolineStats->Alive, coreCount);
+		coresAlive = __atomic_load_n(&trampolineStats->Alive, __ATOMIC_ACQUIRE);
+#endif
+		uint64_t aliveEnd = CPUReadCycles();
+		SMPWaitFor(&g_LapicsRunning, coreCount);
+		uint32_t coresRunning = __atomic_load_n(&g_LapicsRunning, __ATOMIC_ACQUIRE);
+		uint64_t runningEnd   = CPUReadCycles();
+		bool     clockSynced  = ClockSyncCheck(coreCount + 1);
+		uint64_t syncEnd      = CPUReadCycles();
+		uint32_t coresCalled  = 0;
+		SMPCallAll(SMPCountCall, &coresCalled, true);
+		uint64_t callEnd = CPUReadCycles();
+#if BUILD_IS_CONFIG_DEBUG
+		LockBenchmarkStart(coresRunning + 1);
+#endif
+		__atomic_store_n(&g_LapicWaitLock, false, __ATOMIC_RELEASE);
+
+		LogDebugFormatted("SMP", "%u of %lu cores alive, %u running", coresAlive, coreCount, coresRunning);
+		LogDebugFormatted("SMP", "Prepare:          %lu cycles", prepareEnd - bootStart);
+		LogDebugFormatted("SMP", "INIT:             %lu cycles", initEnd - prepareEnd);
+		LogDebugFormatted("SMP", "Startup IPIs:     %lu cycles", startupEnd - initEnd);
+		LogDebugFormatted("SMP", "Trampoline:       %lu cycles", aliveEnd - startupEnd);
+		LogDebugFormatted("SMP", "Core Setup:       %lu cycles", runningEnd - aliveEnd);
+		LogDebugFormatted("SMP", "Clock Sync:       %lu cycles", syncEnd - runningEnd);
+		LogDebugFormatted("SMP", "Call Round Trip:  %lu cycles (%u cores answered)", callEnd - syncEnd, coresCalled);
+		LogDebugFormatted("SMP", "Total:            %lu cycles", callEnd - bootStart);
+		if (!clockSynced)
+		{
+			struct ClockStats clockStats;
+			ClockGetStats(&clockStats);
+			LogWarnFormatted("Clock", "Cycle counters are not synchronized, saw a warp of %lu cycles", clockStats.MaxWarp);
 		}
-		g_LapicWaitLock = false;
 
-		PMMFree(tempRootPageTable, 1);
+		// Cores that never showed up could still read the slots and the temporary page table, so those are only released once every core is running
+		if (coresRunning == coreCount)
+		{
+			PMMFree(tempRootPageTable, 1);
+#if BUILD_IS_ARCH_X86_64
+			HeapFree(trampolineSlots);
+#endif
+		}
+		LockBenchmarkRun();
 	}
 
-	CPUHalt();
+	if (!TimerInitCPU())
+		LogError("Timer", "Failed to allocate the timer wheel");
+#if BUILD_IS_CONFIG_DEBUG
+	if (!ThreadCreate(SelfTestThread, nullptr))
+		LogError("SelfTest", "Failed to create the self-test thread");
+#endif
+	SchedulerStart();
 }
 
-void CPUTrampoline(uint8_t lapicID)
+void CPUTrampoline(struct CPUData* cpu)
 {
+	CPUInstall(cpu);
+	x86_64APICEnable();
+	x86_64FeatureEnable();
 	x86_64LoadGDT(8, 16);
 	x86_64LoadLDT(0);
+	if (CPUGetData() != cpu || !x86_64TSSLoad())
+		CPUHalt(); // Nothing per processor works without its data and interrupt stacks, not even logging
 	x86_64LoadIDT();
 	EnableInterrupts();
+	if (!SMPCallInitCPU())
+		LogError("SMP", "Failed to allocate the call slots");
+	if (!FPUInitCPU())
+		LogError("FPU", "Failed to allocate the save areas");
 
 	void* pageTable = GetKernelPageTable();
 	VMMActivate(pageTable);
 
-	++g_LapicsRunning;
+	__atomic_add_fetch(&g_LapicsRunning, 1, __ATOMIC_RELEASE);
 	LogDebug("SMP", "Booted");
-	while (g_LapicWaitLock);
+	ClockSyncJoin();
+	IdleWaitWhile(&g_LapicWaitLock);
+	LockBenchmarkRun();
 
-	CPUHalt();
+	if (!TimerInitCPU())
+		LogError("Timer", "Failed to allocate the timer wheel");
+	SchedulerStart();
 }
 
-void* CPUStackAlloc(void)
+void SMPWaitFor(uint32_t* counter, size_t target)
 {
-	void* kernelPageTable = GetKernelPageTable();
-	void* stack           = VMMAlloc(kernelPageTable, 4, 0, VMM_PAGE_TYPE_4KIB, VMM_PAGE_PROTECT_READ_WRITE);
-	for (size_t i = 0; i < 4; ++i)
+	// There is no timer yet, so a core that never answers is given up on after a fixed number of spins
+	for (uint64_t spins = 0; __atomic_load_n(counter, __ATOMIC_ACQUIRE) < target && spins < SMP_BOOT_SPINS; ++spins)
 	{
-		void* physical = PMMAlloc(1);
-		if (!physical)
-			return nullptr; // TODO(MarcasRealAccount): PANIC
-		VMMMap(kernelPageTable, (uint8_t*) stack + i * 4096, physical);
+#if BUILD_IS_ARCH_X86_64
+		__builtin_ia32_pause();
+#endif
 	}
-	return stack + 4 * 4096;
 }
 
 bool UltraProtocolMemoryMapConverter(void* userdata, size_t index, struct PMMMemoryMapEntry* entry)
@@ -0,0 +1,185 @@
+#include "FPU.h"
+#include "Build.h"
+#include "CPU.h"
+#include "Halt.h"
+#include "PMM.h"
+
+#include <string.h>
+
+#if BUILD_IS_ARCH_X86_64
+	#include "x86_64/FPU.h"
+	#include "x86_64/Features.h"
+#endif
+
+// Only touched by the owning processor with interrupts disabled, the state of an interrupted section goes to SaveAreas[Depth - 1]
+struct FPUCPU
+{
+	alignas(64) uint32_t Depth;
+	uint8_t* SaveAreas;
+	uint64_t Sections;
+	uint64_t NestedSaves;
+};
+
+static struct FPUCPU g_FPUCPUs[CPU_MAX_COUNT];
+static uint64_t      g_FPUFeatures  = 0;
+static uint32_t      g_FPUStateSize = 0;
+static bool          g_FPUXSaveOpt  = false;
+
+#if BUILD_IS_ARCH_X86_64
+static uint64_t FPUDetectFeatures(void)
+{
+	uint32_t registers[4];
+	x86_64CPUID(0, 0, registers);
+	uint32_t maxLeaf = registers[0];
+	x86_64CPUID(1, 0, registers);
+	bool xsave = registers[2] & (1U << 26);
+	bool avx   = registers[2] & (1U << 28);
+	if (!xsave || maxLeaf < 0xD)
+		return 0;
+
+	x86_64CPUID(0xD, 0, registers);
+	uint64_t supported = registers[0] | ((uint64_t) registers[3] << 32);
+	uint64_t features  = FPU_XCR0_X87 | FPU_XCR0_SSE;
+	if (avx && (supported & FPU_XCR0_AVX))
+		features |= FPU_XCR0_AVX;
+	if ((features & FPU_XCR0_AVX) && maxLeaf >= 7 && (supported & FPU_XCR0_AVX512) == FPU_XCR0_AVX512)
+	{
+		x86_64CPUID(7, 0, registers);
+		if (registers[1] & (1U << 16)) // AVX-512F
+			features |= FPU_XCR0_AVX512;
+	}
+	x86_64CPUID(0xD, 1, registers);
+	g_FPUXSaveOpt = registers[0] & 1;
+	return features;
+}
+#endif
+
+static void FPUSave(void* area)
+{
+#if BUILD_IS_ARCH_X86_64
+	if (!g_FPUFeatures)
+		x86_64FPUFXSave(area);
+	else if (g_FPUXSaveOpt)
+		x86_64FPUXSaveOpt(area, g_FPUFeatures);
+	else
+		x86_64FPUXSave(area, g_FPUFeatures);
+#endif
+}
+
+static void FPURestore(const void* area)
+{
+#if BUILD_IS_ARCH_X86_64
+	if (g_FPUFeatures)
+		x86_64FPUXRestore(area, g_FPUFeatures);
+	else
+		x86_64FPUFXRestore(area);
+#endif
+}
+
+bool FPUInitCPU(void)
+{
+#if BUILD_IS_ARCH_X86_64
+	// The boot processor sets up before any other processor is started
+	if (!g_FPUStateSize)
+	{
+		g_FPUFeatures = FPUDetectFeatures();
+		x86_64FPUEnable(g_FPUFeatures);
+		uint32_t size = 512;
+		if (g_FPUFeatures)
+		{
+			// EBX reports the size for the components enabled in XCR0 right now
+			uint32_t registers[4];
+			x86_64CPUID(0xD, 0, registers);
+			size = registers[1];
+		}
+		g_FPUStateSize = (size + 63) & ~63U;
+	}
+	else
+	{
+		x86_64FPUEnable(g_FPUFeatures);
+	}
+
+	size_t   pages = ((FPU_MAX_DEPTH - 1) * g_FPUStateSize + 4095) / 4096;
+	uint8_t* areas = (uint8_t*) PMMAlloc(pages);
+	if (!areas)
+		return false;
+	memset(areas, 0, pages * 4096);
+	g_FPUCPUs[CPUGetIndex()].SaveAreas = areas;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void FPUGetStats(struct FPUStats* stats)
+{
+	if (!stats)
+		return;
+
+	*stats = (struct FPUStats) {
+		.Features    = g_FPUFeatures,
+		.StateSize   = g_FPUStateSize,
+		.XSaveOpt    = g_FPUXSaveOpt,
+		.Sections    = 0,
+		.NestedSaves = 0
+	};
+	size_t cpuCount = CPUGetCount();
+	for (size_t i = 0; i < cpuCount; ++i)
+	{
+		stats->Sections    += __atomic_load_n(&g_FPUCPUs[i].Sections, __ATOMIC_RELAXED);
+		stats->NestedSaves += __atomic_load_n(&g_FPUCPUs[i].NestedSaves, __ATOMIC_RELAXED);
+	}
+}
+
+bool FPUBegin(void)
+{
+	bool           interrupts = SaveAndDisableInterrupts();
+	struct FPUCPU* cpu        = &g_FPUCPUs[CPUGetIndex()];
+	if (!cpu->SaveAreas || cpu->Depth == FPU_MAX_DEPTH)
+	{
+		RestoreInterrupts(interrupts);
+		return false;
+	}
+
+	// Kernel code outside of sections never touches the vector registers, so only an interrupted section has state worth saving
+	if (cpu->Depth > 0)
+	{
+		FPUSave(cpu->SaveAreas + (cpu->Depth - 1) * g_FPUStateSize);
+		++cpu->NestedSaves;
+	}
+#if BUILD_IS_ARCH_X86_64
+	x86_64FPUReset();
+#endif
+	++cpu->Depth;
+	++cpu->Sections;
+	RestoreInterrupts(interrupts);
+	return true;
+}
+
+void FPUEnd(void)
+{
+	bool           interrupts = SaveAndDisableInterrupts();
+	struct FPUCPU* cpu        = &g_FPUCPUs[CPUGetIndex()];
+	if (cpu->Depth == 0)
+	{
+		RestoreInterrupts(interrupts);
+		return;
+	}
+
+	if (--cpu->Depth > 0)
+	{
+		FPURestore(cpu->SaveAreas + (cpu->Depth - 1) * g_FPUStateSize);
+	}
+#if BUILD_IS_ARCH_X86_64
+	else if (g_FPUFeatures & FPU_XCR0_AVX)
+	{
+		x86_64FPUClearUpper();
+	}
+#endif
+	RestoreInterrupts(interrupts);
+}
+
+bool FPUIsActive(void)
+{
+	return g_FPUCPUs[CPUGetIndex()].Depth > 0;
+}
\ No newline at end of file
@@ -1,8 +1,8 @@
 #include "Graphics/Graphics.h"
 #include "DebugCon.h"
+#include "FPU.h"
 #include "KernelVMM.h"
 #include "Log.h"
-#include "PMM.h"
 #include "VMM.h"
 
 #include <stdint.h>
@@ -14,6 +14,9 @@ struct FontCharacter
 	void*   BitmapAddress;
 };
 
+// Built with SIMD flags, only called between FPUBegin and FPUEnd
+extern void GraphicsFillRow32(uint32_t* row, size_t count, uint32_t value);
+
 uint8_t               g_FontWidth;
 uint8_t               g_FontHeight;
 struct FontCharacter* g_FontCharacters;
@@ -26,28 +29,24 @@ void LoadFont(struct FontHeader* font)
 	void* kernelPagetable = GetKernelPageTable();
 	if (!g_FontCharacters)
 	{
-		g_FontCharacters = (struct FontCharacter*) VMMAlloc(kernelPagetable, 4352, 0, VMM_PAGE_TYPE_4KIB, VMM_PAGE_PROTECT_READ_WRITE);
-		g_FontWidth      = font->CharWidth;
-		g_FontHeight     = font->CharHeight;
+		// Most of the table stays empty, pages only get real frames once a character in them is written
+		g_FontCharacters = (struct FontCharacter*) VMMAlloc(kernelPagetable, 4352, 0, VMM_PAGE_TYPE_ZERO, VMM_PAGE_PROTECT_READ_WRITE, VMM_MEMORY_TYPE_WRITE_BACK);
+		if (!g_FontCharacters)
+		{
+			LogCritical("Graphics", "Failed to allocate font table");
+			return;
+		}
+		g_FontWidth  = font->CharWidth;
+		g_FontHeight = font->CharHeight;
 	}
 	if (font->CharWidth != g_FontWidth || font->CharHeight != g_FontHeight || font->Bitdepth != 1)
 		return;
 	struct FontCharacterLUT* fontCharacters = (struct FontCharacterLUT*) (font + 1);
 	for (size_t i = 0; i < font->CharacterCount; ++i)
 	{
-		struct FontCharacterLUT* fontCharacter   = &fontCharacters[i];
-		void*                    physicalAddress = VMMTranslate(kernelPagetable, &g_FontCharacters[fontCharacter->Character]);
-		if (!physicalAddress)
-		{
-			physicalAddress = PMMAlloc(1);
-			if (!physicalAddress)
-			{
-				LogCritical("Graphics", "Failed to allocate page for font");
-				break;
-			}
-			memset(physicalAddress, 0, 4096);
-			VMMMap(kernelPagetable, &g_FontCharacters[fontCharacter->Character], physicalAddress);
-		}
+		struct FontCharacterLUT* fontCharacter = &fontCharacters[i];
+		if (fontCharacter->Character >= 0x11'0000)
+			continue;
 		g_FontCharacters[fontCharacter->Character] = (struct FontCharacter) {
 			.Width         = fontCharacter->Width,
 			.BitmapAddress = (uint8_t*) font + fontCharacter->Offset
@@ -55,6 +54,27 @@ void LoadFont(struct FontHeader* font)
 	}
 }
 
+bool GraphicsMapFramebuffer(struct Framebuffer* framebuffer)
+{
+	if (!framebuffer || !framebuffer->Content)
+		return false;
+
+	uint64_t physicalAddress = (uint64_t) framebuffer->Content;
+	uint64_t pageOffset      = physicalAddress & 0xFFF;
+	size_t   pageCount       = (pageOffset + framebuffer->Pitch * framebuffer->Height + 4095) / 4096;
+
+	void*    kernelPageTable = GetKernelPageTable();
+	uint8_t* mapping         = (uint8_t*) VMMAlloc(kernelPageTable, pageCount, 0, VMM_PAGE_TYPE_4KIB, VMM_PAGE_PROTECT_READ_WRITE, VMM_MEMORY_TYPE_WRITE_COMBINING);
+	if (!mapping)
+	{
+		LogError("Graphics", "Failed to allocate write-combining framebuffer mapping");
+		return false;
+	}
+	VMMMapLinear(kernelPageTable, mapping, (void*) (physicalAddress - pageOffset), pageCount, VMM_MEMORY_TYPE_WRITE_COMBINING);
+	framebuffer->Content = mapping + pageOffset;
+	return true;
+}
+
 static struct LinearColor GraphicsLinearToColorspace(struct LinearColor color, enum FramebufferColorspace colorspace)
 {
 	switch (colorspace)
@@ -143,6 +163,17 @@ void GraphicsDrawRect(struct Framebuffer* framebuffer, struct GraphicsRect rect,
 	size_t ey = framebuffer->Height < rect.y + rect.h ? framebuffer->Height : rect.y + rect.h;
 
 	struct LinearColor fillColorspaceAdjusted = GraphicsLinearToColorspace(fillColor, framebuffer->Colorspace);
+	if ((framebuffer->Format == FramebufferFormatARGB8 || framebuffer->Format == FramebufferFormatRGBA8) && sx < ex && FPUBegin())
+	{
+		// Same byte order GraphicsSetPixel writes, read as one little endian pixel
+		uint32_t value = framebuffer->Format == FramebufferFormatARGB8
+							 ? (fillColorspaceAdjusted.b >> 8) | ((uint32_t) (fillColorspaceAdjusted.g >> 8) << 8) | ((uint32_t) (fillColorspaceAdjusted.r >> 8) << 16) | ((uint32_t) (fillColorspaceAdjusted.a >> 8) << 24)
+							 : (fillColorspaceAdjusted.a >> 8) | ((uint32_t) (fillColorspaceAdjusted.b >> 8) << 8) | ((uint32_t) (fillColorspaceAdjusted.g >> 8) << 16) | ((uint32_t) (fillColorspaceAdjusted.r >> 8) << 24);
+		for (size_t y = sy; y < ey; ++y)
+			GraphicsFillRow32((uint32_t*) ((uint8_t*) framebuffer->Content + framebuffer->Pitch * y) + sx, ex - sx, value);
+		FPUEnd();
+		return;
+	}
 	for (size_t y = sy; y < ey; ++y)
 	{
 		for (size_t x = sx; x < ex; ++x)
@@ -201,11 +232,9 @@ void GraphicsDrawLine(struct Framebuffer* framebuffer, struct GraphicsPoint a, s
 
 void GraphicsDrawText(struct Framebuffer* framebuffer, struct GraphicsPoint pos, const char* text, size_t count, struct LinearColor color)
 {
-	if (!framebuffer)
+	if (!framebuffer || !g_FontCharacters)
 		return;
 
-	void* kernelPageTable = GetKernelPageTable();
-
 	size_t currentX = pos.x;
 	size_t currentY = pos.y;
 	for (size_t i = 0; i < count; ++i)
@@ -222,28 +251,13 @@ void GraphicsDrawText(struct Framebuffer* framebuffer, struct GraphicsPoint pos,
 		case ' ': currentX += g_FontWidth + 2; continue;
 		}
 
-		struct FontCharacter* character = nullptr;
-		if (!VMMTranslate(kernelPageTable, &g_FontCharacters[(uint32_t) c]))
-		{
-			if (!VMMTranslate(kernelPageTable, &g_FontCharacters[0xFFFD]))
-			{
-				currentX += g_FontWidth + 2;
-				continue;
-			}
+		struct FontCharacter* character = &g_FontCharacters[(uint8_t) c];
+		if (character->Width == 0 && character->BitmapAddress == 0)
 			character = &g_FontCharacters[0xFFFD];
-		}
-		else
-		{
-			character = &g_FontCharacters[(uint32_t) c];
-		}
 		if (character->Width == 0 && character->BitmapAddress == 0)
 		{
-			if (!VMMTranslate(kernelPageTable, &g_FontCharacters[0xFFFD]))
-			{
-				currentX += g_FontWidth + 2;
-				continue;
-			}
-			character = &g_FontCharacters[0xFFFD];
+			currentX += g_FontWidth + 2;
+			continue;
 		}
 
 		size_t paddedWidth = ((size_t) character->Width * g_FontWidth + 7) & ~7;
@@ -0,0 +1,22 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// Unaligned so rows can start anywhere in the framebuffer
+typedef uint32_t GraphicsVector __attribute__((vector_size(16), aligned(4)));
+
+void GraphicsFillRow32(uint32_t* row, size_t count, uint32_t value)
+{
+	GraphicsVector vector = { value, value, value, value };
+	size_t         i      = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		*(GraphicsVector*) (row + i)      = vector;
+		*(GraphicsVector*) (row + i + 4)  = vector;
+		*(GraphicsVector*) (row + i + 8)  = vector;
+		*(GraphicsVector*) (row + i + 12) = vector;
+	}
+	for (; i + 4 <= count; i += 4)
+		*(GraphicsVector*) (row + i) = vector;
+	for (; i < count; ++i)
+		row[i] = value;
+}
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "Idle.h"
+#include "Build.h"
+#include "CPU.h"
+#include "Halt.h"
+
+#if BUILD_IS_ARCH_X86_64
+	#include "x86_64/APIC.h"
+	#include "x86_64/Features.h"
+	#include "x86_64/MWait.h"
+#endif
+
+// Each processor watches its own line, so a wakeup write only disturbs the processor it is meant for
+struct IdleCPU
+{
+	alignas(64) uint32_t Wake;
+	bool     Sleeping;
+	uint64_t Sleeps;
+	uint64_t WakeWrites;
+	uint64_t WakeIPIs;
+};
+
+static struct IdleCPU g_IdleCPUs[CPU_MAX_COUNT];
+static uint32_t       g_IdleSleepers  = 0;
+static bool           g_IdleUseMWait  = false;
+static uint32_t       g_IdleMWaitHint = 0;
+
+void IdleInit(void)
+{
+#if BUILD_IS_ARCH_X86_64
+	uint32_t registers[4];
+	x86_64CPUID(0, 0, registers);
+	uint32_t maxLeaf = registers[0];
+	x86_64CPUID(1, 0, registers);
+	if (!(registers[2] & (1U << 3)) || maxLeaf < 5)
+		return;
+
+	// Without the extensions MWAIT takes no hint and only enters C1
+	x86_64CPUID(5, 0, registers);
+	g_IdleUseMWait = true;
+	if (!(registers[2] & 1))
+		return;
+	uint32_t subStates = registers[3];
+
+	// C-states past C1 may stop the local APIC timer unless it is always running, the scheduler tick would be lost there
+	uint8_t deepest = 1;
+	if (maxLeaf >= 6)
+	{
+		x86_64CPUID(6, 0, registers);
+		if (registers[0] & (1U << 2))
+			deepest = 7;
+	}
+	for (uint8_t state = deepest; state > 0; --state)
+	{
+		uint8_t count = (subStates >> (state * 4)) & 0xF;
+		if (count)
+		{
+			g_IdleMWaitHint = ((state - 1U) << 4) | (count - 1U);
+			break;
+		}
+	}
+#endif
+}
+
+void IdleGetStats(struct IdleStats* stats)
+{
+	if (!stats)
+		return;
+
+	*stats = (struct IdleStats) {
+		.MWait      = g_IdleUseMWait,
+		.MWaitHint  = g_IdleMWaitHint,
+		.Sleeps     = 0,
+		.WakeWrites = 0,
+		.WakeIPIs   = 0
+	};
+	size_t cpuCount = CPUGetCount();
+	for (size_t i = 0; i < cpuCount; ++i)
+	{
+		struct IdleCPU* idle  = &g_IdleCPUs[i];
+		stats->Sleeps        += __atomic_load_n(&idle->Sleeps, __ATOMIC_RELAXED);
+		stats->WakeWrites    += __atomic_load_n(&idle->WakeWrites, __ATOMIC_RELAXED);
+		stats->WakeIPIs      += __atomic_load_n(&idle->WakeIPIs, __ATOMIC_RELAXED);
+	}
+}
+
+void IdleWait(void)
+{
+	struct IdleCPU* idle = &g_IdleCPUs[CPUGetIndex()];
+	++idle->Sleeps;
+	// Pairs with IdleWake, which sets the flag before it looks at Sleeping
+	__atomic_store_n(&idle->Sleeping, true, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&g_IdleSleepers, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&idle->Wake, __ATOMIC_SEQ_CST))
+	{
+		EnableInterrupts();
+	}
+#if BUILD_IS_ARCH_X86_64
+	else if (g_IdleUseMWait)
+	{
+		// The flag is checked again once the monitor is armed, a write in between would otherwise go unnoticed
+		x86_64Monitor(&idle->Wake);
+		if (__atomic_load_n(&idle->Wake, __ATOMIC_SEQ_CST))
+			EnableInterrupts();
+		else
+			x86_64MWaitEnableInterrupts(g_IdleMWaitHint);
+	}
+#endif
+	else
+	{
+		CPUWaitForInterrupt();
+	}
+	__atomic_sub_fetch(&g_IdleSleepers, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&idle->Sleeping, false, __ATOMIC_RELAXED);
+	__atomic_store_n(&idle->Wake, 0, __ATOMIC_RELAXED);
+}
+
+void IdleWake(uint32_t index)
+{
+	if (index >= CPU_MAX_COUNT || index == CPUGetIndex())
+		return;
+
+	struct IdleCPU* idle = &g_IdleCPUs[index];
+	if (__atomic_load_n(&idle->Wake, __ATOMIC_RELAXED))
+		return;
+	__atomic_store_n(&idle->Wake, 1, __ATOMIC_SEQ_CST);
+	if (g_IdleUseMWait || !__atomic_load_n(&idle->Sleeping, __ATOMIC_SEQ_CST))
+	{
+		__atomic_add_fetch(&idle->WakeWrites, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	// A halted processor only notices the flag once something interrupts it
+	__atomic_add_fetch(&idle->WakeIPIs, 1, __ATOMIC_RELAXED);
+#if BUILD_IS_ARCH_X86_64
+	struct CPUData* cpu = CPUGetDataByIndex(index);
+	if (cpu)
+		x86_64APICSendIPI(cpu->ID, APIC_ICR_FIXED | APIC_WAKEUP_VECTOR);
+#endif
+}
+
+void IdleWakeOne(void)
+{
+	if (__atomic_load_n(&g_IdleSleepers, __ATOMIC_SEQ_CST) == 0)
+		return;
+
+	uint32_t index    = CPUGetIndex();
+	size_t   cpuCount = CPUGetCount();
+	for (size_t i = 1; i < cpuCount; ++i)
+	{
+		uint32_t other = (uint32_t) ((index + i) % cpuCount);
+		if (__atomic_load_n(&g_IdleCPUs[other].Sleeping, __ATOMIC_RELAXED))
+		{
+			IdleWake(other);
+			return;
+		}
+	}
+}
+
+void IdleWaitWhile(bool* flag)
+{
+	while (__atomic_load_n(flag, __ATOMIC_ACQUIRE))
+	{
+#if BUILD_IS_ARCH_X86_64
+		if (g_IdleUseMWait)
+		{
+			x86_64Monitor(flag);
+			if (__atomic_load_n(flag, __ATOMIC_ACQUIRE))
+				x86_64MWait(0);
+			continue;
+		}
+		__builtin_ia32_pause();
+#endif
+	}
+}
\ No newline at end of file
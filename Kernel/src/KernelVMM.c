@@ -2,8 +2,44 @@
 #include "PMM.h"
 #include "VMM.h"
 
+extern uint8_t g_KernelTextStart[];
+extern uint8_t g_KernelTextEnd[];
+extern uint8_t g_KernelRODataStart[];
+extern uint8_t g_KernelRODataEnd[];
+extern uint8_t g_KernelDataStart[];
+extern uint8_t g_KernelDataEnd[];
+
 void* g_KVMM;
 
+static void KernelVMMMapIdentity(uint64_t start, uint64_t end, enum VMMPageType type, enum VMMPageProtect protect)
+{
+	if (start >= end)
+		return;
+
+	size_t pageCount = (end - start) / 4096;
+	void*  virtual   = VMMAllocAt(g_KVMM, start, pageCount, type, protect, VMM_MEMORY_TYPE_WRITE_BACK);
+	VMMMapLinear(g_KVMM, virtual, (void*) start, pageCount, VMM_MEMORY_TYPE_WRITE_BACK);
+}
+
+static void KernelVMMMapRange(uint64_t start, uint64_t end, enum VMMPageProtect protect)
+{
+	start = start & ~0xFFFUL;
+	end   = (end + 0xFFF) & ~0xFFFUL;
+	if (start >= end)
+		return;
+
+	uint64_t hugeStart = (start + 0x1F'FFFF) & ~0x1F'FFFFUL;
+	uint64_t hugeEnd   = end & ~0x1F'FFFFUL;
+	if (hugeStart >= hugeEnd)
+	{
+		KernelVMMMapIdentity(start, end, VMM_PAGE_TYPE_4KIB, protect);
+		return;
+	}
+	KernelVMMMapIdentity(start, hugeStart, VMM_PAGE_TYPE_4KIB, protect);
+	KernelVMMMapIdentity(hugeStart, hugeEnd, VMM_PAGE_TYPE_2MIB, protect);
+	KernelVMMMapIdentity(hugeEnd, end, VMM_PAGE_TYPE_4KIB, protect);
+}
+
 void KernelVMMInit(void)
 {
 	g_KVMM = VMMNewPageTable();
@@ -12,17 +48,27 @@ void KernelVMMInit(void)
 		// TODO(MarcasRealAccount): PANIC
 		return;
 	}
+	VMMSetGlobal(g_KVMM, true);
 
 	struct PMMMemoryStats memoryStats;
 	PMMGetMemoryStats(&memoryStats);
-	uint64_t lastAddress = memoryStats.LastAddress;
-
-	uint64_t last4KPage        = lastAddress > 0x20'0000 ? 512 : lastAddress / 4096;
-	uint64_t last2MPage        = (lastAddress + 0x1F'FFFF) / 0x20'0000;
-	void*    identityBegin4KiB = VMMAllocAt(g_KVMM, 0x1000, last4KPage - 1, VMM_PAGE_TYPE_4KIB, VMM_PAGE_PROTECT_READ_WRITE_EXECUTE);
-	void*    identityBegin2MiB = VMMAllocAt(g_KVMM, last4KPage * 4096, (last2MPage - 1) * 512, VMM_PAGE_TYPE_2MIB, VMM_PAGE_PROTECT_READ_WRITE_EXECUTE);
-	VMMMapLinear(g_KVMM, identityBegin4KiB, (void*) 0x1000, last4KPage - 1);
-	VMMMapLinear(g_KVMM, identityBegin2MiB, (void*) 0x20'0000, (last2MPage - 1) * 512);
+	uint64_t lastAddress = (memoryStats.LastAddress + 0x1F'FFFF) & ~0x1F'FFFFUL;
+
+	uint64_t textStart   = (uint64_t) g_KernelTextStart & ~0xFFFUL;
+	uint64_t textEnd     = ((uint64_t) g_KernelTextEnd + 0xFFF) & ~0xFFFUL;
+	uint64_t rodataStart = (uint64_t) g_KernelRODataStart & ~0xFFFUL;
+	uint64_t rodataEnd   = ((uint64_t) g_KernelRODataEnd + 0xFFF) & ~0xFFFUL;
+	uint64_t dataStart   = (uint64_t) g_KernelDataStart & ~0xFFFUL;
+	uint64_t dataEnd     = ((uint64_t) g_KernelDataEnd + 0xFFF) & ~0xFFFUL;
+
+	// Everything outside of the kernel image stays identity mapped as before, the image itself gets per section protections
+	KernelVMMMapRange(0x1000, textStart, VMM_PAGE_PROTECT_READ_WRITE_EXECUTE);
+	KernelVMMMapRange(textStart, textEnd, VMM_PAGE_PROTECT_READ_EXECUTE);
+	KernelVMMMapRange(textEnd, rodataStart, VMM_PAGE_PROTECT_READ_WRITE_EXECUTE);
+	KernelVMMMapRange(rodataStart, rodataEnd, VMM_PAGE_PROTECT_READ_ONLY);
+	KernelVMMMapRange(rodataEnd, dataStart, VMM_PAGE_PROTECT_READ_WRITE_EXECUTE);
+	KernelVMMMapRange(dataStart, dataEnd, VMM_PAGE_PROTECT_READ_WRITE);
+	KernelVMMMapRange(dataEnd, lastAddress, VMM_PAGE_PROTECT_READ_WRITE_EXECUTE);
 
 	VMMActivate(g_KVMM);
 }
@@ -0,0 +1,298 @@
+#include "Lock.h"
+#include "Build.h"
+#include "CPU.h"
+#include "Halt.h"
+#include "Log.h"
+#include "SMPCall.h"
+
+#define RWLOCK_WRITER  0x8000'0000U
+#define RWLOCK_WAITING 0x4000'0000U // A writer waits for the readers to leave
+
+#define LOCK_BENCHMARK_ITERATIONS 16384
+#define LOCK_BENCHMARK_KINDS      4
+
+static void LockPause(void)
+{
+#if BUILD_IS_ARCH_X86_64
+	__builtin_ia32_pause();
+#endif
+}
+
+void TicketLockInit(struct TicketLock* lock)
+{
+	__atomic_store_n(&lock->Next, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&lock->Serving, 0, __ATOMIC_RELEASE);
+}
+
+void TicketLockAcquire(struct TicketLock* lock)
+{
+	uint32_t ticket = __atomic_fetch_add(&lock->Next, 1, __ATOMIC_RELAXED);
+	while (true)
+	{
+		uint32_t serving = __atomic_load_n(&lock->Serving, __ATOMIC_ACQUIRE);
+		if (serving == ticket)
+			break;
+		// The holder may be waiting for this processor to run a shootdown, e.g. when PMMAlloc evicts pages under a slab lock
+		SMPCallPoll();
+		// Back off in proportion to the waiters ahead, which keeps the line quieter for the holder
+		for (uint32_t i = ticket - serving; i > 0; --i)
+			LockPause();
+	}
+}
+
+bool TicketLockTryAcquire(struct TicketLock* lock)
+{
+	uint32_t serving = __atomic_load_n(&lock->Serving, __ATOMIC_ACQUIRE);
+	uint32_t ticket  = serving;
+	return __atomic_compare_exchange_n(&lock->Next, &ticket, serving + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void TicketLockRelease(struct TicketLock* lock)
+{
+	// Only the holder writes Serving
+	__atomic_store_n(&lock->Serving, __atomic_load_n(&lock->Serving, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+bool TicketLockAcquireIRQSave(struct TicketLock* lock)
+{
+	bool interrupts = SaveAndDisableInterrupts();
+	TicketLockAcquire(lock);
+	return interrupts;
+}
+
+void TicketLockReleaseIRQRestore(struct TicketLock* lock, bool interrupts)
+{
+	TicketLockRelease(lock);
+	RestoreInterrupts(interrupts);
+}
+
+void MCSLockInit(struct MCSLock* lock)
+{
+	__atomic_store_n(&lock->Tail, nullptr, __ATOMIC_RELEASE);
+}
+
+void MCSLockAcquire(struct MCSLock* lock, struct MCSNode* node)
+{
+	__atomic_store_n(&node->Next, nullptr, __ATOMIC_RELAXED);
+	__atomic_store_n(&node->Locked, true, __ATOMIC_RELAXED);
+	struct MCSNode* previous = __atomic_exchange_n(&lock->Tail, node, __ATOMIC_ACQ_REL);
+	if (!previous)
+		return;
+
+	__atomic_store_n(&previous->Next, node, __ATOMIC_RELEASE);
+	while (__atomic_load_n(&node->Locked, __ATOMIC_ACQUIRE))
+		LockPause();
+}
+
+bool MCSLockTryAcquire(struct MCSLock* lock, struct MCSNode* node)
+{
+	__atomic_store_n(&node->Next, nullptr, __ATOMIC_RELAXED);
+	__atomic_store_n(&node->Locked, false, __ATOMIC_RELAXED);
+	struct MCSNode* expected = nullptr;
+	return __atomic_compare_exchange_n(&lock->Tail, &expected, node, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void MCSLockRelease(struct MCSLock* lock, struct MCSNode* node)
+{
+	struct MCSNode* next = __atomic_load_n(&node->Next, __ATOMIC_ACQUIRE);
+	if (!next)
+	{
+		struct MCSNode* expected = node;
+		if (__atomic_compare_exchange_n(&lock->Tail, &expected, nullptr, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			return;
+		// A waiter swapped itself in as the tail but has not linked itself to this node yet
+		while (!(next = __atomic_load_n(&node->Next, __ATOMIC_ACQUIRE)))
+			LockPause();
+	}
+	__atomic_store_n(&next->Locked, false, __ATOMIC_RELEASE);
+}
+
+bool MCSLockAcquireIRQSave(struct MCSLock* lock, struct MCSNode* node)
+{
+	bool interrupts = SaveAndDisableInterrupts();
+	MCSLockAcquire(lock, node);
+	return interrupts;
+}
+
+void MCSLockReleaseIRQRestore(struct MCSLock* lock, struct MCSNode* node, bool interrupts)
+{
+	MCSLockRelease(lock, node);
+	RestoreInterrupts(interrupts);
+}
+
+void RWLockInit(struct RWLock* lock)
+{
+	__atomic_store_n(&lock->State, 0, __ATOMIC_RELEASE);
+}
+
+void RWLockAcquireRead(struct RWLock* lock)
+{
+	uint32_t state = __atomic_load_n(&lock->State, __ATOMIC_RELAXED);
+	while (true)
+	{
+		if (state & (RWLOCK_WRITER | RWLOCK_WAITING))
+		{
+			LockPause();
+			state = __atomic_load_n(&lock->State, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&lock->State, &state, state + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return;
+	}
+}
+
+void RWLockReleaseRead(struct RWLock* lock)
+{
+	__atomic_fetch_sub(&lock->State, 1, __ATOMIC_RELEASE);
+}
+
+void RWLockAcquireWrite(struct RWLock* lock)
+{
+	uint32_t state = __atomic_load_n(&lock->State, __ATOMIC_RELAXED);
+	while (true)
+	{
+		// Taking the lock also clears the waiting bit, other waiting writers set it again on their next attempt
+		if ((state & ~RWLOCK_WAITING) == 0)
+		{
+			if (__atomic_compare_exchange_n(&lock->State, &state, RWLOCK_WRITER, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				return;
+			continue;
+		}
+		if (!(state & RWLOCK_WAITING))
+			__atomic_fetch_or(&lock->State, RWLOCK_WAITING, __ATOMIC_RELAXED);
+		LockPause();
+		state = __atomic_load_n(&lock->State, __ATOMIC_RELAXED);
+	}
+}
+
+void RWLockReleaseWrite(struct RWLock* lock)
+{
+	__atomic_fetch_and(&lock->State, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
+
+bool RWLockAcquireReadIRQSave(struct RWLock* lock)
+{
+	bool interrupts = SaveAndDisableInterrupts();
+	RWLockAcquireRead(lock);
+	return interrupts;
+}
+
+void RWLockReleaseReadIRQRestore(struct RWLock* lock, bool interrupts)
+{
+	RWLockReleaseRead(lock);
+	RestoreInterrupts(interrupts);
+}
+
+bool RWLockAcquireWriteIRQSave(struct RWLock* lock)
+{
+	bool interrupts = SaveAndDisableInterrupts();
+	RWLockAcquireWrite(lock);
+	return interrupts;
+}
+
+void RWLockReleaseWriteIRQRestore(struct RWLock* lock, bool interrupts)
+{
+	RWLockReleaseWrite(lock);
+	RestoreInterrupts(interrupts);
+}
+
+struct LockBenchmarkState
+{
+	uint32_t Participants;
+	uint32_t Tickets;
+	uint32_t Barriers[LOCK_BENCHMARK_KINDS + 1];
+	uint64_t Cycles[LOCK_BENCHMARK_KINDS];
+	uint64_t Counter;
+
+	bool              TestAndSetLock;
+	struct TicketLock TicketLock;
+	struct MCSLock    MCSLock;
+	struct RWLock     RWLock;
+};
+
+static const char* const c_LockBenchmarkNames[LOCK_BENCHMARK_KINDS] = {
+	"Test and set",
+	"Ticket",
+	"MCS",
+	"RW write"
+};
+
+static struct LockBenchmarkState g_LockBenchmark;
+
+static void LockBenchmarkBarrier(uint32_t* barrier, uint32_t participants)
+{
+	__atomic_add_fetch(barrier, 1, __ATOMIC_ACQ_REL);
+	while (__atomic_load_n(barrier, __ATOMIC_ACQUIRE) < participants)
+		LockPause();
+}
+
+static void LockBenchmarkCriticalSection(void)
+{
+	__atomic_store_n(&g_LockBenchmark.Counter, __atomic_load_n(&g_LockBenchmark.Counter, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+void LockBenchmarkStart(uint32_t participants)
+{
+	__atomic_store_n(&g_LockBenchmark.Participants, participants, __ATOMIC_RELEASE);
+}
+
+void LockBenchmarkRun(void)
+{
+	uint32_t participants = __atomic_load_n(&g_LockBenchmark.Participants, __ATOMIC_ACQUIRE);
+	if (participants == 0)
+		return;
+	// Late processors stay out, the barriers only count the participants the benchmark was started with
+	uint32_t ticket = __atomic_fetch_add(&g_LockBenchmark.Tickets, 1, __ATOMIC_RELAXED);
+	if (ticket >= participants)
+		return;
+
+	for (uint8_t kind = 0; kind < LOCK_BENCHMARK_KINDS; ++kind)
+	{
+		LockBenchmarkBarrier(&g_LockBenchmark.Barriers[kind], participants);
+		uint64_t start = CPUReadCycles();
+		for (size_t i = 0; i < LOCK_BENCHMARK_ITERATIONS; ++i)
+		{
+			switch (kind)
+			{
+			case 0:
+				while (__atomic_test_and_set(&g_LockBenchmark.TestAndSetLock, __ATOMIC_ACQUIRE))
+				{
+					while (__atomic_load_n(&g_LockBenchmark.TestAndSetLock, __ATOMIC_RELAXED))
+						LockPause();
+				}
+				LockBenchmarkCriticalSection();
+				__atomic_clear(&g_LockBenchmark.TestAndSetLock, __ATOMIC_RELEASE);
+				break;
+			case 1:
+				TicketLockAcquire(&g_LockBenchmark.TicketLock);
+				LockBenchmarkCriticalSection();
+				TicketLockRelease(&g_LockBenchmark.TicketLock);
+				break;
+			case 2:
+			{
+				struct MCSNode node;
+				MCSLockAcquire(&g_LockBenchmark.MCSLock, &node);
+				LockBenchmarkCriticalSection();
+				MCSLockRelease(&g_LockBenchmark.MCSLock, &node);
+				break;
+			}
+			case 3:
+				RWLockAcquireWrite(&g_LockBenchmark.RWLock);
+				LockBenchmarkCriticalSection();
+				RWLockReleaseWrite(&g_LockBenchmark.RWLock);
+				break;
+			}
+		}
+		__atomic_add_fetch(&g_LockBenchmark.Cycles[kind], CPUReadCycles() - start, __ATOMIC_RELAXED);
+	}
+	LockBenchmarkBarrier(&g_LockBenchmark.Barriers[LOCK_BENCHMARK_KINDS], participants);
+	if (ticket != 0)
+		return;
+
+	uint64_t acquisitions = (uint64_t) participants * LOCK_BENCHMARK_ITERATIONS;
+	LogDebugFormatted("Lock", "Contention across %u processors, %lu acquisitions per lock:", participants, acquisitions);
+	for (uint8_t kind = 0; kind < LOCK_BENCHMARK_KINDS; ++kind)
+		LogDebugFormatted("Lock", "  %-12s %lu cycles per acquisition", c_LockBenchmarkNames[kind], g_LockBenchmark.Cycles[kind] / acquisitions);
+	if (g_LockBenchmark.Counter != LOCK_BENCHMARK_KINDS * acquisitions)
+		LogErrorFormatted("Lock", "Counter is %lu, expected %lu", g_LockBenchmark.Counter, LOCK_BENCHMARK_KINDS * acquisitions);
+}
\ No newline at end of file
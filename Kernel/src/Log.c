@@ -1,9 +1,12 @@
 #include "Log.h"
-#include "ACPI/ACPI.h"
 #include "Build.h"
+#include "CPU.h"
+#include "Clock.h"
 #include "DebugCon.h"
 #include "Graphics/Graphics.h"
+#include "Halt.h"
 #include "KernelVMM.h"
+#include "Lock.h"
 #include "PMM.h"
 #include "VMM.h"
 
@@ -28,8 +31,12 @@ struct LogState
 	struct Framebuffer Framebuffer;
 };
 
-uint8_t g_LogLockProcID = 0;
-uint8_t g_LogLockCount  = 0;
+// The lock is recursive per thread, so a fault raised while logging can still log
+// Before the scheduler runs a thread the processor itself is the owner
+struct TicketLock g_LogLock;
+void*             g_LogLockOwner      = nullptr;
+uint32_t          g_LogLockCount      = 0;
+bool              g_LogLockInterrupts = false;
 
 struct LogState g_LogState = (struct LogState) {
 	.Lines     = nullptr,
@@ -52,7 +59,7 @@ void LogInit(struct Framebuffer* framebuffer)
 	size_t requiredPageCount = 1 + (lineCount * maxLineSize + 4095) / 4096;
 
 	void* kernelPageTable = GetKernelPageTable();
-	g_LogState.Lines      = VMMAlloc(kernelPageTable, requiredPageCount, 0, VMM_PAGE_TYPE_4KIB, VMM_PAGE_PROTECT_READ_WRITE);
+	g_LogState.Lines      = VMMAlloc(kernelPageTable, requiredPageCount, 0, VMM_PAGE_TYPE_4KIB, VMM_PAGE_PROTECT_READ_WRITE, VMM_MEMORY_TYPE_WRITE_BACK);
 	if (!g_LogState.Lines)
 	{
 		LogCritical("Log", "LogInit failed to allocate line buffers for log!");
@@ -83,30 +90,50 @@ void LogInit(struct Framebuffer* framebuffer)
 	g_LogState.Framebuffer = *framebuffer;
 }
 
+// Must be called with interrupts disabled, the thread could otherwise migrate in between
+static void* LogGetOwner(void)
+{
+	struct CPUData* cpu = CPUGetData();
+	if (cpu->CurrentThread)
+		return cpu->CurrentThread;
+	return cpu;
+}
+
 void LogLock(void)
 {
-	uint8_t curProcessorID    = GetProcessorID();
-	uint8_t* restrict logLock = &g_LogLockProcID;
-	if (*logLock == curProcessorID)
+	bool  interrupts = SaveAndDisableInterrupts();
+	void* owner      = LogGetOwner();
+	// Only the owner ever stores itself, so seeing it means the lock is already held by this thread
+	if (__atomic_load_n(&g_LogLockOwner, __ATOMIC_RELAXED) == owner)
 	{
 		++g_LogLockCount;
+		RestoreInterrupts(interrupts);
 		return;
 	}
-	while (*logLock != 0);
-	*logLock = curProcessorID;
-	++g_LogLockCount;
+	RestoreInterrupts(interrupts);
+	// Interrupts stay off while the lock is held, an interrupt handler logging on this processor would spin on itself
+	interrupts = TicketLockAcquireIRQSave(&g_LogLock);
+	__atomic_store_n(&g_LogLockOwner, LogGetOwner(), __ATOMIC_RELAXED);
+	g_LogLockCount      = 1;
+	g_LogLockInterrupts = interrupts;
 }
 
 void LogUnlock(void)
 {
-	uint8_t curProcessorID = GetProcessorID();
-	if (g_LogLockProcID != curProcessorID)
+	bool  interrupts = SaveAndDisableInterrupts();
+	void* owner      = LogGetOwner();
+	RestoreInterrupts(interrupts);
+	if (__atomic_load_n(&g_LogLockOwner, __ATOMIC_RELAXED) != owner)
 	{
 		// TODO(MarcasRealAccount): Should we PANIC?
 		return;
 	}
 	if (--g_LogLockCount == 0)
-		g_LogLockProcID = 0;
+	{
+		bool restore = g_LogLockInterrupts;
+		__atomic_store_n(&g_LogLockOwner, nullptr, __ATOMIC_RELAXED);
+		TicketLockReleaseIRQRestore(&g_LogLock, restore);
+	}
 }
 
 static void LogFlush(void)
@@ -245,7 +272,8 @@ void Log(enum LogSeverity severity, const char* id, const char* message)
 	logStream.WriteChar  = LogWriteChar;
 	logStream.WriteChars = LogWriteChars;
 
-	uint8_t processorID = GetProcessorID();
+	uint32_t processorID = GetProcessorID();
+	uint64_t time        = ClockGetTime();
 
 	const char* severityStr = nullptr;
 	switch (severity)
@@ -259,7 +287,7 @@ void Log(enum LogSeverity severity, const char* id, const char* message)
 	}
 
 	LogLock();
-	fprintf(&logStream, "%-8s %8.8s (%hhu): %s\n", severityStr, id, processorID, message);
+	fprintf(&logStream, "[%5lu.%06lu] %-8s %8.8s (%u): %s\n", time / 1'000'000'000, time / 1'000 % 1'000'000, severityStr, id, processorID, message);
 	LogUnlock();
 }
 
@@ -301,7 +329,8 @@ void LogFormatted(enum LogSeverity severity, const char* id, const char* fmt, ..
 	logStream.WriteChar  = LogWriteChar;
 	logStream.WriteChars = LogWriteChars;
 
-	uint8_t processorID = GetProcessorID();
+	uint32_t processorID = GetProcessorID();
+	uint64_t time        = ClockGetTime();
 
 	const char* severityStr = nullptr;
 	switch (severity)
@@ -317,7 +346,7 @@ void LogFormatted(enum LogSeverity severity, const char* id, const char* fmt, ..
 	LogLock();
 	va_list vlist;
 	va_start(vlist, fmt);
-	fprintf(&logStream, "%-8s %8.8s (%02hhX): %Ls\n", severityStr, id, processorID, fmt, &vlist);
+	fprintf(&logStream, "[%5lu.%06lu] %-8s %8.8s (%02X): %Ls\n", time / 1'000'000'000, time / 1'000 % 1'000'000, severityStr, id, processorID, fmt, &vlist);
 	va_end(vlist);
 	LogUnlock();
 }
@@ -328,12 +357,13 @@ void LogInfoFormatted(const char* id, const char* fmt, ...)
 	logStream.WriteChar  = LogWriteChar;
 	logStream.WriteChars = LogWriteChars;
 
-	uint8_t processorID = GetProcessorID();
+	uint32_t processorID = GetProcessorID();
+	uint64_t time        = ClockGetTime();
 
 	LogLock();
 	va_list vlist;
 	va_start(vlist, fmt);
-	fprintf(&logStream, "Info     %8.8s (%02hhX): %Ls\n", id, processorID, fmt, &vlist);
+	fprintf(&logStream, "[%5lu.%06lu] Info     %8.8s (%02X): %Ls\n", time / 1'000'000'000, time / 1'000 % 1'000'000, id, processorID, fmt, &vlist);
 	va_end(vlist);
 	LogUnlock();
 }
@@ -345,12 +375,13 @@ void LogDebugFormatted(const char* id, const char* fmt, ...)
 	logStream.WriteChar  = LogWriteChar;
 	logStream.WriteChars = LogWriteChars;
 
-	uint8_t processorID = GetProcessorID();
+	uint32_t processorID = GetProcessorID();
+	uint64_t time        = ClockGetTime();
 
 	LogLock();
 	va_list vlist;
 	va_start(vlist, fmt);
-	fprintf(&logStream, "Debug    %8.8s (%02hhX): %Ls\n", id, processorID, fmt, &vlist);
+	fprintf(&logStream, "[%5lu.%06lu] Debug    %8.8s (%02X): %Ls\n", time / 1'000'000'000, time / 1'000 % 1'000'000, id, processorID, fmt, &vlist);
 	va_end(vlist);
 	LogUnlock();
 #endif
@@ -362,12 +393,13 @@ void LogWarnFormatted(const char* id, const char* fmt, ...)
 	logStream.WriteChar  = LogWriteChar;
 	logStream.WriteChars = LogWriteChars;
 
-	uint8_t processorID = GetProcessorID();
+	uint32_t processorID = GetProcessorID();
+	uint64_t time        = ClockGetTime();
 
 	LogLock();
 	va_list vlist;
 	va_start(vlist, fmt);
-	fprintf(&logStream, "Warn     %8.8s (%02hhX): %Ls\n", id, processorID, fmt, &vlist);
+	fprintf(&logStream, "[%5lu.%06lu] Warn     %8.8s (%02X): %Ls\n", time / 1'000'000'000, time / 1'000 % 1'000'000, id, processorID, fmt, &vlist);
 	va_end(vlist);
 	LogUnlock();
 }
@@ -378,12 +410,13 @@ void LogErrorFormatted(const char* id, const char* fmt, ...)
 	logStream.WriteChar  = LogWriteChar;
 	logStream.WriteChars = LogWriteChars;
 
-	uint8_t processorID = GetProcessorID();
+	uint32_t processorID = GetProcessorID();
+	uint64_t time        = ClockGetTime();
 
 	LogLock();
 	va_list vlist;
 	va_start(vlist, fmt);
-	fprintf(&logStream, "Error    %8.8s (%02hhX): %Ls\n", id, processorID, fmt, &vlist);
+	fprintf(&logStream, "[%5lu.%06lu] Error    %8.8s (%02X): %Ls\n", time / 1'000'000'000, time / 1'000 % 1'000'000, id, processorID, fmt, &vlist);
 	va_end(vlist);
 	LogUnlock();
 }
@@ -394,12 +427,13 @@ void LogCriticalFormatted(const char* id, const char* fmt, ...)
 	logStream.WriteChar  = LogWriteChar;
 	logStream.WriteChars = LogWriteChars;
 
-	uint8_t processorID = GetProcessorID();
+	uint32_t processorID = GetProcessorID();
+	uint64_t time        = ClockGetTime();
 
 	LogLock();
 	va_list vlist;
 	va_start(vlist, fmt);
-	fprintf(&logStream, "Critical %8.8s (%02hhX): %Ls\n", id, processorID, fmt, &vlist);
+	fprintf(&logStream, "[%5lu.%06lu] Critical %8.8s (%02X): %Ls\n", time / 1'000'000'000, time / 1'000 % 1'000'000, id, processorID, fmt, &vlist);
 	va_end(vlist);
 	LogUnlock();
 }
\ No newline at end of file
@@ -0,0 +1,220 @@
+#include "RCU.h"
+#include "Build.h"
+#include "CPU.h"
+#include "Clock.h"
+#include "Halt.h"
+#include "Log.h"
+#include "Scheduler.h"
+
+#define RCU_SELF_TEST_TIMEOUT 1'000'000'000
+
+// Seen is read by whichever processor advances the epoch, the callback list is only touched by its owner with interrupts disabled
+struct RCUCPU
+{
+	alignas(64) uint64_t Seen; // Epoch observed at the last quiescent state
+	bool             Online;
+	struct RCUHead*  Head;
+	struct RCUHead** Tail;
+	uint64_t         Queued;
+	uint64_t         Run;
+};
+
+struct RCUState
+{
+	alignas(64) uint64_t Epoch;
+	uint64_t Completed;
+	uint64_t Waiting; // Queued callbacks and synchronizing threads, the epoch only advances while there are any
+};
+
+struct RCUSelfTestObject
+{
+	struct RCUHead Head;
+	bool           Run;
+};
+
+static struct RCUCPU   g_RCUCPUs[CPU_MAX_COUNT];
+static struct RCUState g_RCUState = { .Epoch = 1, .Completed = 0, .Waiting = 0 };
+
+// Static, so a callback that only runs after the self-test gave up still finds its object
+static struct RCUSelfTestObject g_RCUSelfTestObject;
+
+// An epoch is completed once every registered processor passed a quiescent state after it started
+static void RCUAdvance(void)
+{
+	uint64_t epoch    = __atomic_load_n(&g_RCUState.Epoch, __ATOMIC_ACQUIRE);
+	size_t   cpuCount = CPUGetCount();
+	for (size_t i = 0; i < cpuCount; ++i)
+	{
+		struct RCUCPU* cpu = &g_RCUCPUs[i];
+		if (__atomic_load_n(&cpu->Online, __ATOMIC_ACQUIRE) && __atomic_load_n(&cpu->Seen, __ATOMIC_ACQUIRE) < epoch)
+			return;
+	}
+
+	uint64_t completed = __atomic_load_n(&g_RCUState.Completed, __ATOMIC_RELAXED);
+	while (completed < epoch && !__atomic_compare_exchange_n(&g_RCUState.Completed, &completed, epoch, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	// Several processors may get here for the same epoch, only one of them starts the next
+	if (__atomic_load_n(&g_RCUState.Waiting, __ATOMIC_RELAXED) > 0)
+		__atomic_compare_exchange_n(&g_RCUState.Epoch, &epoch, epoch + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+void RCUInitCPU(void)
+{
+	struct RCUCPU* cpu = &g_RCUCPUs[CPUGetIndex()];
+	cpu->Head          = nullptr;
+	cpu->Tail          = &cpu->Head;
+	__atomic_store_n(&cpu->Seen, __atomic_load_n(&g_RCUState.Epoch, __ATOMIC_SEQ_CST), __ATOMIC_RELEASE);
+	__atomic_store_n(&cpu->Online, true, __ATOMIC_SEQ_CST);
+}
+
+void RCUGetStats(struct RCUStats* stats)
+{
+	if (!stats)
+		return;
+
+	*stats = (struct RCUStats) {
+		.Epoch     = __atomic_load_n(&g_RCUState.Epoch, __ATOMIC_RELAXED),
+		.Completed = __atomic_load_n(&g_RCUState.Completed, __ATOMIC_RELAXED),
+		.Queued    = 0,
+		.Run       = 0
+	};
+	size_t cpuCount = CPUGetCount();
+	for (size_t i = 0; i < cpuCount; ++i)
+	{
+		stats->Queued += __atomic_load_n(&g_RCUCPUs[i].Queued, __ATOMIC_RELAXED);
+		stats->Run    += __atomic_load_n(&g_RCUCPUs[i].Run, __ATOMIC_RELAXED);
+	}
+}
+
+void RCUReadLock(void)
+{
+	// The thread stays the same even if an interrupt comes in between, so the plain increment is safe
+	struct Thread* thread = CPUGetData()->CurrentThread;
+	if (thread)
+		++thread->RCUDepth;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+void RCUReadUnlock(void)
+{
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	struct Thread* thread = CPUGetData()->CurrentThread;
+	if (thread)
+		--thread->RCUDepth;
+}
+
+void RCUCall(struct RCUHead* head, RCUCallback fn)
+{
+	if (!head || !fn)
+		return;
+
+	bool           interrupts = SaveAndDisableInterrupts();
+	struct RCUCPU* cpu        = &g_RCUCPUs[CPUGetIndex()];
+	if (!cpu->Online)
+	{
+		// Without a tick of its own this processor would never get to run the callback
+		RestoreInterrupts(interrupts);
+		RCUSynchronize();
+		fn(head);
+		return;
+	}
+
+	// The object was unpublished before this, the epoch read afterwards must not be from before that
+	head->Next  = nullptr;
+	head->Fn    = fn;
+	head->Epoch = __atomic_load_n(&g_RCUState.Epoch, __ATOMIC_SEQ_CST);
+	*cpu->Tail  = head;
+	cpu->Tail   = &head->Next;
+	++cpu->Queued;
+	__atomic_add_fetch(&g_RCUState.Waiting, 1, __ATOMIC_SEQ_CST);
+	RestoreInterrupts(interrupts);
+}
+
+void RCUSynchronize(void)
+{
+	__atomic_add_fetch(&g_RCUState.Waiting, 1, __ATOMIC_SEQ_CST);
+	uint64_t epoch = __atomic_load_n(&g_RCUState.Epoch, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&g_RCUState.Completed, __ATOMIC_ACQUIRE) <= epoch)
+	{
+		RCUQuiescentState();
+		bool interrupts = SaveAndDisableInterrupts();
+		RCUAdvance();
+		RestoreInterrupts(interrupts);
+		if (__atomic_load_n(&g_RCUState.Completed, __ATOMIC_ACQUIRE) > epoch)
+			break;
+		ThreadYield();
+#if BUILD_IS_ARCH_X86_64
+		__builtin_ia32_pause();
+#endif
+	}
+	__atomic_sub_fetch(&g_RCUState.Waiting, 1, __ATOMIC_RELAXED);
+}
+
+void RCUQuiescentState(void)
+{
+	struct Thread* thread = CPUGetData()->CurrentThread;
+	if (thread && thread->RCUDepth > 0)
+		return;
+
+	// Loads of finished critical sections are ordered before this store, x86 keeps loads ahead of later stores anyway
+	struct RCUCPU* cpu = &g_RCUCPUs[CPUGetIndex()];
+	__atomic_store_n(&cpu->Seen, __atomic_load_n(&g_RCUState.Epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+void RCUTick(void)
+{
+	struct RCUCPU* cpu = &g_RCUCPUs[CPUGetIndex()];
+	if (!cpu->Online)
+		return;
+
+	// Readers cannot be preempted, so a tick outside of any critical section means none of them is running here
+	RCUQuiescentState();
+	if (__atomic_load_n(&g_RCUState.Waiting, __ATOMIC_RELAXED) == 0)
+		return;
+	RCUAdvance();
+
+	uint64_t completed = __atomic_load_n(&g_RCUState.Completed, __ATOMIC_ACQUIRE);
+	size_t   run       = 0;
+	while (cpu->Head && cpu->Head->Epoch < completed)
+	{
+		struct RCUHead* head = cpu->Head;
+		cpu->Head            = head->Next;
+		if (!cpu->Head)
+			cpu->Tail = &cpu->Head;
+		head->Fn(head);
+		++run;
+	}
+	if (run)
+	{
+		cpu->Run += run;
+		__atomic_sub_fetch(&g_RCUState.Waiting, run, __ATOMIC_RELAXED);
+	}
+}
+
+static void RCUSelfTestCallback(struct RCUHead* head)
+{
+	__atomic_store_n(&((struct RCUSelfTestObject*) head)->Run, true, __ATOMIC_RELEASE);
+}
+
+bool RCUSelfTest(void)
+{
+	uint64_t start = ClockGetTime();
+	uint64_t epoch = __atomic_load_n(&g_RCUState.Epoch, __ATOMIC_SEQ_CST);
+	RCUCall(&g_RCUSelfTestObject.Head, RCUSelfTestCallback);
+	RCUSynchronize();
+	if (__atomic_load_n(&g_RCUState.Completed, __ATOMIC_ACQUIRE) <= epoch)
+	{
+		LogErrorFormatted("RCU", "Self-test grace period returned with epoch %lu not completed", epoch);
+		return false;
+	}
+
+	// The callback runs from a tick on the processor it was queued on
+	while (!__atomic_load_n(&g_RCUSelfTestObject.Run, __ATOMIC_ACQUIRE) && ClockGetTime() - start < RCU_SELF_TEST_TIMEOUT)
+		ThreadYield();
+	if (!__atomic_load_n(&g_RCUSelfTestObject.Run, __ATOMIC_ACQUIRE))
+	{
+		LogError("RCU", "Self-test callback never ran");
+		return false;
+	}
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,231 @@
+#include "SMPCall.h"
+#include "Build.h"
+#include "CPU.h"
+#include "Halt.h"
+#include "PMM.h"
+
+#include <string.h>
+
+#if BUILD_IS_ARCH_X86_64
+	#include "x86_64/APIC.h"
+#endif
+
+// Each sender owns one slot per target, a slot is only reused once the target ran the call in it
+struct SMPCallSlot
+{
+	alignas(64) struct SMPCallSlot* Next;
+	SMPCallFn Fn;
+	void*     Userdata;
+	uint32_t  Busy; // Cleared by the target once the function returned
+};
+
+// Pending is pushed to by every sender, everything else is only touched by the owning processor
+struct SMPCallCPU
+{
+	alignas(64) struct SMPCallSlot* Pending;
+	alignas(64) struct SMPCallSlot* Slots;
+	uint32_t SlotCount;
+	bool     Online;
+	uint64_t Sent;
+	uint64_t IPIs;
+	uint64_t Executed;
+	uint64_t Interrupts;
+};
+
+static struct SMPCallCPU g_SMPCallCPUs[CPU_MAX_COUNT];
+
+// Expects interrupts to be disabled
+static void SMPCallDrain(struct SMPCallCPU* self)
+{
+	// Senders push to the front, so the list is reversed to run the calls in the order they were sent
+	struct SMPCallSlot* list    = __atomic_exchange_n(&self->Pending, nullptr, __ATOMIC_ACQUIRE);
+	struct SMPCallSlot* ordered = nullptr;
+	while (list)
+	{
+		struct SMPCallSlot* next = list->Next;
+		list->Next               = ordered;
+		ordered                  = list;
+		list                     = next;
+	}
+
+	while (ordered)
+	{
+		// The sender may reuse the slot as soon as it is released, so nothing is read from it afterwards
+		struct SMPCallSlot* slot = ordered;
+		ordered                  = slot->Next;
+		slot->Fn(slot->Userdata);
+		++self->Executed;
+		__atomic_store_n(&slot->Busy, 0, __ATOMIC_RELEASE);
+	}
+}
+
+// Expects interrupts to be disabled, two processors waiting on each other keep running the calls they were sent
+static void SMPCallWaitSlot(struct SMPCallCPU* self, struct SMPCallSlot* slot)
+{
+	while (__atomic_load_n(&slot->Busy, __ATOMIC_ACQUIRE))
+	{
+		SMPCallDrain(self);
+#if BUILD_IS_ARCH_X86_64
+		__builtin_ia32_pause();
+#endif
+	}
+}
+
+// Expects interrupts to be disabled
+static void SMPCallQueue(struct SMPCallCPU* self, uint32_t target, SMPCallFn fn, void* userdata)
+{
+	struct SMPCallSlot* slot = &self->Slots[target];
+	SMPCallWaitSlot(self, slot);
+	slot->Fn       = fn;
+	slot->Userdata = userdata;
+	slot->Busy     = 1;
+
+	struct SMPCallCPU*  other = &g_SMPCallCPUs[target];
+	struct SMPCallSlot* head  = __atomic_load_n(&other->Pending, __ATOMIC_RELAXED);
+	do
+		slot->Next = head;
+	while (!__atomic_compare_exchange_n(&other->Pending, &head, slot, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	++self->Sent;
+	// The target drains its whole list on every interrupt, only the sender that found it empty has to raise one
+	if (head)
+		return;
+
+	++self->IPIs;
+#if BUILD_IS_ARCH_X86_64
+	x86_64APICSendIPI(CPUGetDataByIndex(target)->ID, APIC_ICR_FIXED | APIC_CALL_VECTOR);
+#endif
+}
+
+static bool SMPCallIsTarget(struct SMPCallCPU* self, uint32_t index, uint32_t selfIndex)
+{
+	return index != selfIndex && index < self->SlotCount && __atomic_load_n(&g_SMPCallCPUs[index].Online, __ATOMIC_ACQUIRE);
+}
+
+bool SMPCallInitCPU(void)
+{
+	struct SMPCallCPU* self  = &g_SMPCallCPUs[CPUGetIndex()];
+	size_t             count = CPUGetCount();
+	size_t             pages = (count * sizeof(struct SMPCallSlot) + 4095) / 4096;
+	// Whole pages keep the slots aligned to cache lines
+	struct SMPCallSlot* slots = (struct SMPCallSlot*) PMMAlloc(pages);
+	if (!slots)
+		return false;
+
+	memset(slots, 0, pages * 4096);
+	self->Slots     = slots;
+	self->SlotCount = (uint32_t) count;
+	__atomic_store_n(&self->Online, true, __ATOMIC_RELEASE);
+	return true;
+}
+
+void SMPCallGetStats(struct SMPCallStats* stats)
+{
+	if (!stats)
+		return;
+
+	*stats = (struct SMPCallStats) {
+		.Sent       = 0,
+		.IPIs       = 0,
+		.Executed   = 0,
+		.Interrupts = 0
+	};
+	size_t cpuCount = CPUGetCount();
+	for (size_t i = 0; i < cpuCount; ++i)
+	{
+		struct SMPCallCPU* cpu  = &g_SMPCallCPUs[i];
+		stats->Sent            += __atomic_load_n(&cpu->Sent, __ATOMIC_RELAXED);
+		stats->IPIs            += __atomic_load_n(&cpu->IPIs, __ATOMIC_RELAXED);
+		stats->Executed        += __atomic_load_n(&cpu->Executed, __ATOMIC_RELAXED);
+		stats->Interrupts      += __atomic_load_n(&cpu->Interrupts, __ATOMIC_RELAXED);
+	}
+}
+
+bool SMPCallOn(uint32_t index, SMPCallFn fn, void* userdata, bool wait)
+{
+	if (!fn)
+		return false;
+
+	bool               interrupts = SaveAndDisableInterrupts();
+	uint32_t           selfIndex  = CPUGetIndex();
+	struct SMPCallCPU* self       = &g_SMPCallCPUs[selfIndex];
+	if (index == selfIndex)
+	{
+		fn(userdata);
+		RestoreInterrupts(interrupts);
+		return true;
+	}
+	if (!SMPCallIsTarget(self, index, selfIndex))
+	{
+		RestoreInterrupts(interrupts);
+		return false;
+	}
+
+	SMPCallQueue(self, index, fn, userdata);
+	if (wait)
+		SMPCallWaitSlot(self, &self->Slots[index]);
+	RestoreInterrupts(interrupts);
+	return true;
+}
+
+void SMPCallMany(const uint32_t* indices, size_t count, SMPCallFn fn, void* userdata, bool wait)
+{
+	if (!indices || !fn)
+		return;
+
+	// Every call is queued before the first wait, so the targets run them in parallel
+	bool               interrupts = SaveAndDisableInterrupts();
+	uint32_t           selfIndex  = CPUGetIndex();
+	struct SMPCallCPU* self       = &g_SMPCallCPUs[selfIndex];
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (SMPCallIsTarget(self, indices[i], selfIndex))
+			SMPCallQueue(self, indices[i], fn, userdata);
+	}
+	if (wait)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (SMPCallIsTarget(self, indices[i], selfIndex))
+				SMPCallWaitSlot(self, &self->Slots[indices[i]]);
+		}
+	}
+	RestoreInterrupts(interrupts);
+}
+
+void SMPCallAll(SMPCallFn fn, void* userdata, bool wait)
+{
+	if (!fn)
+		return;
+
+	bool               interrupts = SaveAndDisableInterrupts();
+	uint32_t           selfIndex  = CPUGetIndex();
+	struct SMPCallCPU* self       = &g_SMPCallCPUs[selfIndex];
+	for (uint32_t i = 0; i < self->SlotCount; ++i)
+	{
+		if (SMPCallIsTarget(self, i, selfIndex))
+			SMPCallQueue(self, i, fn, userdata);
+	}
+	if (wait)
+	{
+		for (uint32_t i = 0; i < self->SlotCount; ++i)
+		{
+			if (SMPCallIsTarget(self, i, selfIndex))
+				SMPCallWaitSlot(self, &self->Slots[i]);
+		}
+	}
+	RestoreInterrupts(interrupts);
+}
+
+void SMPCallHandleInterrupt(void)
+{
+	struct SMPCallCPU* self = &g_SMPCallCPUs[CPUGetIndex()];
+	++self->Interrupts;
+	SMPCallDrain(self);
+}
+
+void SMPCallPoll(void)
+{
+	bool interrupts = SaveAndDisableInterrupts();
+	SMPCallDrain(&g_SMPCallCPUs[CPUGetIndex()]);
+	RestoreInterrupts(interrupts);
+}
\ No newline at end of file
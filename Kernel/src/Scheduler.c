@@ -0,0 +1,340 @@
+#include "Scheduler.h"
+#include "CPU.h"
+#include "FPU.h"
+#include "Halt.h"
+#include "Idle.h"
+#include "Lock.h"
+#include "PMM.h"
+#include "RCU.h"
+#include "Slab.h"
+#include "Stack.h"
+#include "Task.h"
+
+extern void* SchedulerArchPrepareStack(void* stackTop, void (*entry)(void));
+extern void  SchedulerArchSwitch(void** stackPointer, void* nextStackPointer);
+
+// Only the owning processor pops its queue outside of load balancing, the lock is taken with interrupts disabled
+struct SchedulerQueue
+{
+	alignas(64) struct TicketLock Lock;
+	struct Thread* Head;
+	struct Thread* Tail;
+	size_t         Length;
+
+	struct Thread* Idle;
+	struct Thread* Previous; // Thread switched away from, the next thread takes care of it once it runs on its own stack
+	bool           Started;
+	uint64_t       Ticks;
+	uint64_t       LastCompact; // Tick of the last compaction pass run while idle
+	uint32_t       SliceLeft;
+
+	uint64_t ContextSwitches;
+	uint64_t Migrations;
+};
+
+static struct SchedulerQueue g_SchedulerQueues[CPU_MAX_COUNT];
+static struct SlabCache      g_ThreadCache;
+static uint64_t              g_ThreadsCreated = 0;
+static uint64_t              g_ThreadsExited  = 0;
+
+// Expects the queue lock to be held
+static void SchedulerQueuePush(struct SchedulerQueue* queue, struct Thread* thread)
+{
+	thread->Next = nullptr;
+	if (queue->Tail)
+		queue->Tail->Next = thread;
+	else
+		queue->Head = thread;
+	queue->Tail = thread;
+	__atomic_store_n(&queue->Length, queue->Length + 1, __ATOMIC_RELAXED);
+}
+
+// Expects the queue lock to be held
+static struct Thread* SchedulerQueuePop(struct SchedulerQueue* queue)
+{
+	struct Thread* thread = queue->Head;
+	if (!thread)
+		return nullptr;
+	queue->Head = thread->Next;
+	if (!queue->Head)
+		queue->Tail = nullptr;
+	thread->Next = nullptr;
+	__atomic_store_n(&queue->Length, queue->Length - 1, __ATOMIC_RELAXED);
+	return thread;
+}
+
+// Runs on the new thread's stack right after every switch
+static void SchedulerFinishSwitch(void)
+{
+	uint32_t               index    = CPUGetIndex();
+	struct SchedulerQueue* queue    = &g_SchedulerQueues[index];
+	struct Thread*         previous = queue->Previous;
+	queue->Previous                 = nullptr;
+	if (!previous || previous->Idle)
+		return;
+
+	if (previous->State == ThreadStateDead)
+	{
+		StackFree(previous->StackTop);
+		SlabFree(&g_ThreadCache, previous);
+		return;
+	}
+	previous->State = ThreadStateReady;
+	previous->CPU   = index;
+	TicketLockAcquire(&queue->Lock);
+	SchedulerQueuePush(queue, previous);
+	TicketLockRelease(&queue->Lock);
+}
+
+// Expects interrupts to be disabled
+static void SchedulerSchedule(struct SchedulerQueue* queue)
+{
+	struct Thread* current = CPUGetData()->CurrentThread;
+	TicketLockAcquire(&queue->Lock);
+	struct Thread* next = SchedulerQueuePop(queue);
+	TicketLockRelease(&queue->Lock);
+	if (!next)
+	{
+		if (current->State == ThreadStateRunning)
+			return;
+		next = queue->Idle;
+	}
+
+	RCUQuiescentState();
+	queue->SliceLeft = SCHEDULER_TIMESLICE_TICKS;
+	++queue->ContextSwitches;
+	queue->Previous             = current;
+	next->State                 = ThreadStateRunning;
+	next->CPU                   = (uint32_t) (queue - g_SchedulerQueues);
+	CPUGetData()->CurrentThread = next;
+	SchedulerArchSwitch(&current->StackPointer, next->StackPointer);
+	SchedulerFinishSwitch();
+}
+
+// Expects interrupts to be disabled, returns whether a thread was pulled over
+static bool SchedulerBalance(struct SchedulerQueue* queue, bool idle)
+{
+	uint32_t               index         = (uint32_t) (queue - g_SchedulerQueues);
+	struct SchedulerQueue* busiest       = nullptr;
+	size_t                 busiestLength = 0;
+	size_t                 cpuCount      = CPUGetCount();
+	for (size_t i = 0; i < cpuCount; ++i)
+	{
+		struct SchedulerQueue* other = &g_SchedulerQueues[i];
+		if (i == index || !__atomic_load_n(&other->Started, __ATOMIC_ACQUIRE))
+			continue;
+		size_t length = __atomic_load_n(&other->Length, __ATOMIC_RELAXED);
+		if (length > busiestLength)
+		{
+			busiest       = other;
+			busiestLength = length;
+		}
+	}
+	// An idle processor takes any waiting thread, otherwise moving a thread only pays off when the queues differ by two or more
+	if (!busiest || (!idle && busiestLength < __atomic_load_n(&queue->Length, __ATOMIC_RELAXED) + 2))
+		return false;
+
+	TicketLockAcquire(&busiest->Lock);
+	struct Thread* thread = SchedulerQueuePop(busiest);
+	TicketLockRelease(&busiest->Lock);
+	if (!thread)
+		return false;
+
+	thread->CPU = index;
+	++queue->Migrations;
+	TicketLockAcquire(&queue->Lock);
+	SchedulerQueuePush(queue, thread);
+	TicketLockRelease(&queue->Lock);
+	return true;
+}
+
+static void SchedulerThreadEntry(void)
+{
+	SchedulerFinishSwitch();
+	EnableInterrupts();
+	struct Thread* thread = ThreadGetCurrent();
+	thread->Entry(thread->Userdata);
+	ThreadExit();
+}
+
+void SchedulerInit(void)
+{
+	SlabCacheInit(&g_ThreadCache, "Thread", sizeof(struct Thread), 16, nullptr, nullptr);
+}
+
+void SchedulerGetStats(struct SchedulerStats* stats)
+{
+	if (!stats)
+		return;
+
+	*stats = (struct SchedulerStats) {
+		.ThreadsCreated  = __atomic_load_n(&g_ThreadsCreated, __ATOMIC_RELAXED),
+		.ThreadsExited   = __atomic_load_n(&g_ThreadsExited, __ATOMIC_RELAXED),
+		.ContextSwitches = 0,
+		.Migrations      = 0,
+		.Ready           = 0
+	};
+	size_t cpuCount = CPUGetCount();
+	for (size_t i = 0; i < cpuCount; ++i)
+	{
+		struct SchedulerQueue* queue  = &g_SchedulerQueues[i];
+		stats->ContextSwitches       += __atomic_load_n(&queue->ContextSwitches, __ATOMIC_RELAXED);
+		stats->Migrations            += __atomic_load_n(&queue->Migrations, __ATOMIC_RELAXED);
+		stats->Ready                 += __atomic_load_n(&queue->Length, __ATOMIC_RELAXED);
+	}
+}
+
+void SchedulerStart(void)
+{
+	DisableInterrupts();
+	struct CPUData*        cpu   = CPUGetData();
+	struct SchedulerQueue* queue = &g_SchedulerQueues[cpu->Index];
+	struct Thread*         idle  = (struct Thread*) SlabAlloc(&g_ThreadCache);
+	if (!idle)
+		CPUHalt();
+
+	*idle = (struct Thread) {
+		.StackPointer = nullptr,
+		.StackTop     = cpu->StackTop,
+		.Entry        = nullptr,
+		.Userdata     = nullptr,
+		.State        = ThreadStateRunning,
+		.CPU          = cpu->Index,
+		.Idle         = true,
+		.RCUDepth     = 0,
+		.Next         = nullptr
+	};
+	queue->Idle        = idle;
+	queue->SliceLeft   = SCHEDULER_TIMESLICE_TICKS;
+	cpu->CurrentThread = idle;
+	RCUInitCPU();
+	__atomic_store_n(&queue->Started, true, __ATOMIC_RELEASE);
+
+	while (true)
+	{
+		DisableInterrupts();
+		if (__atomic_load_n(&queue->Length, __ATOMIC_RELAXED) == 0)
+			SchedulerBalance(queue, true);
+		if (__atomic_load_n(&queue->Length, __ATOMIC_RELAXED) > 0)
+		{
+			SchedulerSchedule(queue);
+			continue;
+		}
+		// Queued tasks are short, so they run right on the idle thread with interrupts enabled
+		EnableInterrupts();
+		if (TaskRunOne())
+			continue;
+		// Compaction is only worth its cost while nothing else wants the processor, migrated pages stall their writers briefly
+		uint64_t ticks = __atomic_load_n(&queue->Ticks, __ATOMIC_RELAXED);
+		if (ticks - queue->LastCompact >= SCHEDULER_COMPACT_TICKS)
+		{
+			queue->LastCompact = ticks;
+			PMMCompact(SCHEDULER_COMPACT_REGIONS);
+			continue;
+		}
+		DisableInterrupts();
+		RCUQuiescentState();
+		// Threads queued here from another processor wake this one, the next tick balances again
+		IdleWait();
+	}
+}
+
+void SchedulerTick(void)
+{
+	struct SchedulerQueue* queue = &g_SchedulerQueues[CPUGetIndex()];
+	if (!queue->Started)
+		return;
+
+	++queue->Ticks;
+	RCUTick();
+	if (queue->Ticks % SCHEDULER_BALANCE_TICKS == 0)
+		SchedulerBalance(queue, false);
+
+	struct Thread* current = CPUGetData()->CurrentThread;
+	if (current->Idle)
+		return; // The idle loop schedules as soon as the interrupt returns
+	if (queue->SliceLeft > 0 && --queue->SliceLeft > 0)
+		return;
+	if (current->RCUDepth > 0 || FPUIsActive())
+		return; // Switched out on the first tick after the section ends
+	SchedulerSchedule(queue);
+}
+
+struct Thread* ThreadCreate(ThreadFn entry, void* userdata)
+{
+	if (!entry)
+		return nullptr;
+
+	struct Thread* thread = (struct Thread*) SlabAlloc(&g_ThreadCache);
+	if (!thread)
+		return nullptr;
+	void* stackTop = StackAlloc();
+	if (!stackTop)
+	{
+		SlabFree(&g_ThreadCache, thread);
+		return nullptr;
+	}
+
+	uint32_t index  = CPUGetIndex();
+	size_t   length = ~0UL;
+	size_t   count  = CPUGetCount();
+	for (size_t i = 0; i < count; ++i)
+	{
+		struct SchedulerQueue* queue = &g_SchedulerQueues[i];
+		if (!__atomic_load_n(&queue->Started, __ATOMIC_ACQUIRE))
+			continue;
+		size_t queueLength = __atomic_load_n(&queue->Length, __ATOMIC_RELAXED);
+		if (queueLength < length)
+		{
+			index  = (uint32_t) i;
+			length = queueLength;
+		}
+	}
+
+	*thread = (struct Thread) {
+		.StackPointer = SchedulerArchPrepareStack(stackTop, SchedulerThreadEntry),
+		.StackTop     = stackTop,
+		.Entry        = entry,
+		.Userdata     = userdata,
+		.State        = ThreadStateReady,
+		.CPU          = index,
+		.Idle         = false,
+		.RCUDepth     = 0,
+		.Next         = nullptr
+	};
+	__atomic_add_fetch(&g_ThreadsCreated, 1, __ATOMIC_RELAXED);
+
+	struct SchedulerQueue* queue      = &g_SchedulerQueues[index];
+	bool                   interrupts = TicketLockAcquireIRQSave(&queue->Lock);
+	SchedulerQueuePush(queue, thread);
+	TicketLockReleaseIRQRestore(&queue->Lock, interrupts);
+	IdleWake(index);
+	return thread;
+}
+
+struct Thread* ThreadGetCurrent(void)
+{
+	return CPUGetData()->CurrentThread;
+}
+
+void ThreadYield(void)
+{
+	bool                   interrupts = SaveAndDisableInterrupts();
+	struct SchedulerQueue* queue      = &g_SchedulerQueues[CPUGetIndex()];
+	if (queue->Started)
+		SchedulerSchedule(queue);
+	RestoreInterrupts(interrupts);
+}
+
+void ThreadExit(void)
+{
+	DisableInterrupts();
+	struct Thread* current = ThreadGetCurrent();
+	if (current && !current->Idle)
+	{
+		current->State = ThreadStateDead;
+		__atomic_add_fetch(&g_ThreadsExited, 1, __ATOMIC_RELAXED);
+		SchedulerSchedule(&g_SchedulerQueues[CPUGetIndex()]);
+	}
+	CPUHalt();
+}
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include "Task.h"
+#include "Build.h"
+#include "CPU.h"
+#include "Halt.h"
+#include "Idle.h"
+#include "Log.h"
+
+#define TASK_SELF_TEST_TASKS 8
+#define TASK_SELF_TEST_COUNT 4096
+#define TASK_SELF_TEST_GRAIN 64
+
+// Chase-Lev deque, the owning processor pushes and takes at the bottom while thieves take from the top
+struct TaskDeque
+{
+	alignas(64) int64_t Top;
+	alignas(64) int64_t Bottom;
+	struct Task* Tasks[TASK_DEQUE_CAPACITY];
+
+	uint64_t Spawned;
+	uint64_t Inline;
+	uint64_t Executed;
+	uint64_t Stolen;
+};
+
+struct ParallelRange
+{
+	size_t            Begin;
+	size_t            End;
+	size_t            Grain;
+	ParallelReduceFn  Fn;
+	ParallelCombineFn Combine;
+	void*             Userdata;
+	uint64_t          Result;
+};
+
+struct ParallelForShim
+{
+	ParallelForFn Fn;
+	void*         Userdata;
+};
+
+static struct TaskDeque g_TaskDeques[TASK_MAX_CPUS];
+
+static void TaskPause(void)
+{
+#if BUILD_IS_ARCH_X86_64
+	__builtin_ia32_pause();
+#endif
+}
+
+// Expects interrupts to be disabled so the calling thread stays the owner
+static bool TaskDequePush(struct TaskDeque* deque, struct Task* task)
+{
+	int64_t bottom = __atomic_load_n(&deque->Bottom, __ATOMIC_RELAXED);
+	int64_t top    = __atomic_load_n(&deque->Top, __ATOMIC_ACQUIRE);
+	if (bottom - top >= TASK_DEQUE_CAPACITY)
+		return false;
+
+	__atomic_store_n(&deque->Tasks[bottom & (TASK_DEQUE_CAPACITY - 1)], task, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&deque->Bottom, bottom + 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+// Expects interrupts to be disabled so the calling thread stays the owner
+static struct Task* TaskDequeTake(struct TaskDeque* deque)
+{
+	int64_t bottom = __atomic_load_n(&deque->Bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&deque->Bottom, bottom, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t top = __atomic_load_n(&deque->Top, __ATOMIC_RELAXED);
+	if (top > bottom)
+	{
+		__atomic_store_n(&deque->Bottom, bottom + 1, __ATOMIC_RELAXED);
+		return nullptr;
+	}
+
+	struct Task* task = __atomic_load_n(&deque->Tasks[bottom & (TASK_DEQUE_CAPACITY - 1)], __ATOMIC_RELAXED);
+	if (top == bottom)
+	{
+		// The last task is raced for against the thieves through Top
+		if (!__atomic_compare_exchange_n(&deque->Top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			task = nullptr;
+		__atomic_store_n(&deque->Bottom, bottom + 1, __ATOMIC_RELAXED);
+	}
+	return task;
+}
+
+static struct Task* TaskDequeSteal(struct TaskDeque* deque)
+{
+	int64_t top = __atomic_load_n(&deque->Top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t bottom = __atomic_load_n(&deque->Bottom, __ATOMIC_ACQUIRE);
+	if (top >= bottom)
+		return nullptr;
+
+	struct Task* task = __atomic_load_n(&deque->Tasks[top & (TASK_DEQUE_CAPACITY - 1)], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&deque->Top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return nullptr;
+	return task;
+}
+
+static void TaskExecute(struct TaskDeque* deque, struct Task* task)
+{
+	struct TaskGroup* group = task->Group;
+	task->Fn(task->Userdata);
+	if (deque)
+		__atomic_add_fetch(&deque->Executed, 1, __ATOMIC_RELAXED);
+	// The task may live in the waiter's stack frame, it is not touched once the group lets go of it
+	__atomic_sub_fetch(&group->Pending, 1, __ATOMIC_RELEASE);
+}
+
+void TaskGetStats(struct TaskStats* stats)
+{
+	if (!stats)
+		return;
+
+	*stats = (struct TaskStats) {
+		.Spawned  = 0,
+		.Inline   = 0,
+		.Executed = 0,
+		.Stolen   = 0
+	};
+	for (size_t i = 0; i < TASK_MAX_CPUS; ++i)
+	{
+		struct TaskDeque* deque  = &g_TaskDeques[i];
+		stats->Spawned          += __atomic_load_n(&deque->Spawned, __ATOMIC_RELAXED);
+		stats->Inline           += __atomic_load_n(&deque->Inline, __ATOMIC_RELAXED);
+		stats->Executed         += __atomic_load_n(&deque->Executed, __ATOMIC_RELAXED);
+		stats->Stolen           += __atomic_load_n(&deque->Stolen, __ATOMIC_RELAXED);
+	}
+}
+
+void TaskSpawn(struct TaskGroup* group, struct Task* task, TaskFn fn, void* userdata)
+{
+	if (!group || !task || !fn)
+		return;
+
+	*task = (struct Task) {
+		.Fn       = fn,
+		.Userdata = userdata,
+		.Group    = group
+	};
+	__atomic_add_fetch(&group->Pending, 1, __ATOMIC_RELAXED);
+
+	bool     interrupts = SaveAndDisableInterrupts();
+	uint32_t cpuIndex   = CPUGetIndex();
+	if (cpuIndex < TASK_MAX_CPUS)
+	{
+		struct TaskDeque* deque  = &g_TaskDeques[cpuIndex];
+		bool              stored = TaskDequePush(deque, task);
+		++deque->Spawned;
+		if (stored)
+		{
+			RestoreInterrupts(interrupts);
+			// A sleeping processor would otherwise only come looking for work on its next tick
+			IdleWakeOne();
+			return;
+		}
+		++deque->Inline;
+	}
+	RestoreInterrupts(interrupts);
+	TaskExecute(cpuIndex < TASK_MAX_CPUS ? &g_TaskDeques[cpuIndex] : nullptr, task);
+}
+
+bool TaskRunOne(void)
+{
+	bool              interrupts = SaveAndDisableInterrupts();
+	uint32_t          cpuIndex   = CPUGetIndex();
+	struct TaskDeque* own        = cpuIndex < TASK_MAX_CPUS ? &g_TaskDeques[cpuIndex] : nullptr;
+	struct Task*      task       = own ? TaskDequeTake(own) : nullptr;
+	RestoreInterrupts(interrupts);
+
+	if (!task)
+	{
+		// Victims are tried round robin from the next processor on, which spreads the thieves over the deques
+		size_t count = CPUGetCount();
+		if (count > TASK_MAX_CPUS)
+			count = TASK_MAX_CPUS;
+		for (size_t i = 1; i <= count && !task; ++i)
+			task = TaskDequeSteal(&g_TaskDeques[(cpuIndex + i) % count]);
+		if (!task)
+			return false;
+		if (own)
+			__atomic_add_fetch(&own->Stolen, 1, __ATOMIC_RELAXED);
+	}
+	TaskExecute(own, task);
+	return true;
+}
+
+void TaskGroupWait(struct TaskGroup* group)
+{
+	if (!group)
+		return;
+
+	// Helping keeps every waiter busy with queued work, so nested joins cannot run out of processors
+	while (__atomic_load_n(&group->Pending, __ATOMIC_ACQUIRE) > 0)
+	{
+		if (!TaskRunOne())
+			TaskPause();
+	}
+}
+
+static void ParallelRangeRun(void* userdata)
+{
+	struct ParallelRange* range = (struct ParallelRange*) userdata;
+	if (range->End - range->Begin <= range->Grain)
+	{
+		range->Result = range->Fn(range->Begin, range->End, range->Userdata);
+		return;
+	}
+
+	size_t               middle = range->Begin + (range->End - range->Begin) / 2;
+	struct ParallelRange upper  = *range;
+	upper.Begin                 = middle;
+	range->End                  = middle;
+
+	struct TaskGroup group = { .Pending = 0 };
+	struct Task      task;
+	TaskSpawn(&group, &task, ParallelRangeRun, &upper);
+	ParallelRangeRun(range);
+	TaskGroupWait(&group);
+	range->Result = range->Combine(range->Result, upper.Result, range->Userdata);
+	range->End    = upper.End;
+}
+
+static uint64_t ParallelForShimRun(size_t begin, size_t end, void* userdata)
+{
+	struct ParallelForShim* shim = (struct ParallelForShim*) userdata;
+	shim->Fn(begin, end, shim->Userdata);
+	return 0;
+}
+
+static uint64_t ParallelForShimCombine(uint64_t left, uint64_t right, void* userdata)
+{
+	return 0;
+}
+
+void ParallelFor(size_t begin, size_t end, size_t grain, ParallelForFn fn, void* userdata)
+{
+	if (!fn)
+		return;
+
+	struct ParallelForShim shim = {
+		.Fn       = fn,
+		.Userdata = userdata
+	};
+	ParallelReduce(begin, end, grain, 0, ParallelForShimRun, ParallelForShimCombine, &shim);
+}
+
+uint64_t ParallelReduce(size_t begin, size_t end, size_t grain, uint64_t identity, ParallelReduceFn fn, ParallelCombineFn combine, void* userdata)
+{
+	if (!fn || !combine || begin >= end)
+		return identity;
+
+	struct ParallelRange range = {
+		.Begin    = begin,
+		.End      = end,
+		.Grain    = grain > 0 ? grain : 1,
+		.Fn       = fn,
+		.Combine  = combine,
+		.Userdata = userdata,
+		.Result   = identity
+	};
+	ParallelRangeRun(&range);
+	return range.Result;
+}
+
+static void TaskSelfTestCount(void* userdata)
+{
+	__atomic_add_fetch((uint64_t*) userdata, 1, __ATOMIC_RELAXED);
+}
+
+static void TaskSelfTestSum(size_t begin, size_t end, void* userdata)
+{
+	uint64_t sum = 0;
+	for (size_t i = begin; i < end; ++i)
+		sum += i;
+	__atomic_add_fetch((uint64_t*) userdata, sum, __ATOMIC_RELAXED);
+}
+
+bool TaskSelfTest(void)
+{
+	uint64_t         executed = 0;
+	struct TaskGroup group    = { .Pending = 0 };
+	struct Task      tasks[TASK_SELF_TEST_TASKS];
+	for (size_t i = 0; i < TASK_SELF_TEST_TASKS; ++i)
+		TaskSpawn(&group, &tasks[i], TaskSelfTestCount, &executed);
+	TaskGroupWait(&group);
+
+	uint64_t sum      = 0;
+	uint64_t expected = (uint64_t) TASK_SELF_TEST_COUNT * (TASK_SELF_TEST_COUNT - 1) / 2;
+	ParallelFor(0, TASK_SELF_TEST_COUNT, TASK_SELF_TEST_GRAIN, TaskSelfTestSum, &sum);
+
+	bool passed = true;
+	if (executed != TASK_SELF_TEST_TASKS)
+	{
+		LogErrorFormatted("Task", "Self-test ran %lu of %u spawned tasks", executed, TASK_SELF_TEST_TASKS);
+		passed = false;
+	}
+	if (sum != expected)
+	{
+		LogErrorFormatted("Task", "Self-test ParallelFor sum is %lu, expected %lu", sum, expected);
+		passed = false;
+	}
+	return passed;
+}
\ No newline at end of file
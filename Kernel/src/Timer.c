@@ -0,0 +1,489 @@
+#include "Timer.h"
+#include "ACPI/ACPI.h"
+#include "Build.h"
+#include "CPU.h"
+#include "Clock.h"
+#include "Halt.h"
+#include "Heap.h"
+#include "Lock.h"
+#include "Log.h"
+#include "Scheduler.h"
+
+#if BUILD_IS_ARCH_X86_64
+	#include "x86_64/APIC.h"
+	#include "x86_64/Features.h"
+	#include "x86_64/IO.h"
+#endif
+
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK  (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_NEVER       (~0UL)
+
+#define TIMER_PM_FREQUENCY         3'579'545 // The ACPI PM timer always runs at this rate
+#define TIMER_CALIBRATION_PM_TICKS 35'795    // 10 ms
+#define TIMER_CALIBRATION_CYCLES   (1UL << 32) // A PM timer that does not count is given up on after this many cycles
+#define TIMER_FALLBACK_FREQUENCY   1'000'000'000
+
+#define TIMER_SELF_TEST_SHORT   50'000        // Fits level 0
+#define TIMER_SELF_TEST_LONG    20'000'000    // Lands in level 2 and cascades through level 1
+#define TIMER_SELF_TEST_TIMEOUT 1'000'000'000
+
+// Every processor owns a hierarchical wheel, level L slots cover 1 << (TIMER_UNIT_SHIFT + L * TIMER_WHEEL_BITS) ns
+// and are cascaded into the lower levels once the wheel reaches them
+struct TimerWheel
+{
+	alignas(64) struct TicketLock Lock;
+	uint64_t      Current;    // First unit of the wheel that has not been processed yet
+	uint64_t      Programmed; // Deadline the hardware is armed for
+	uint64_t      NextTick;
+	uint64_t      Occupied[TIMER_WHEEL_LEVELS];
+	struct Timer* Slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	struct Timer* Running; // Timer whose callback runs right now, TimerCancel waits for it
+
+	uint64_t Armed;
+	uint64_t Fired;
+	uint64_t Cancelled;
+};
+
+struct TimerState
+{
+	uint64_t APICFrequency;
+	uint64_t NanosecondsToAPIC; // 32.32 fixed point
+	bool     TSCDeadline;
+};
+
+static struct TimerState  g_TimerState;
+static struct TimerWheel* g_TimerWheels[CPU_MAX_COUNT];
+
+static void TimerPause(void)
+{
+#if BUILD_IS_ARCH_X86_64
+	__builtin_ia32_pause();
+#endif
+}
+
+// Dividing the shifted frequency in two steps keeps the intermediate value within 64 bits
+static uint64_t TimerPerNanosecond(uint64_t frequency)
+{
+	return ((frequency << 24) / 1'000'000'000) << 8;
+}
+
+static void TimerArmHardware(uint64_t deadline, uint64_t now)
+{
+#if BUILD_IS_ARCH_X86_64
+	if (g_TimerState.TSCDeadline)
+	{
+		uint64_t cycles = ClockToCycles(deadline);
+		x86_64APICTimerArmDeadline(cycles > 0 ? cycles : 1);
+		return;
+	}
+
+	uint64_t count = deadline > now ? (uint64_t) (((unsigned __int128) (deadline - now) * g_TimerState.NanosecondsToAPIC) >> 32) : 0;
+	if (count == 0)
+		count = 1;
+	else if (count > 0xFFFF'FFFF)
+		count = 0xFFFF'FFFF;
+	x86_64APICTimerArmCount((uint32_t) count);
+#endif
+}
+
+// Expects the wheel lock to be held
+static void TimerWheelInsert(struct TimerWheel* wheel, struct Timer* timer)
+{
+	uint64_t unit = timer->Deadline >> TIMER_UNIT_SHIFT;
+	if (unit < wheel->Current)
+		unit = wheel->Current;
+
+	uint8_t  level  = 0;
+	uint64_t bucket = unit;
+	if (unit - wheel->Current >= TIMER_WHEEL_SLOTS)
+	{
+		// A level L bucket is cascaded once the wheel reaches its start, so it has to start at or after the current unit
+		for (level = 1; level < TIMER_WHEEL_LEVELS; ++level)
+		{
+			uint8_t  shift = level * TIMER_WHEEL_BITS;
+			uint64_t first = (wheel->Current + (1UL << shift) - 1) >> shift;
+			bucket         = unit >> shift;
+			if (bucket - first < TIMER_WHEEL_SLOTS)
+				break;
+			if (level == TIMER_WHEEL_LEVELS - 1)
+			{
+				// Timers past the last level wait in its furthest slot and are placed again when it is cascaded
+				bucket = first + TIMER_WHEEL_SLOTS - 1;
+				break;
+			}
+		}
+	}
+
+	uint8_t        slot = bucket & TIMER_WHEEL_MASK;
+	struct Timer** head = &wheel->Slots[level][slot];
+	timer->Next         = *head;
+	if (timer->Next)
+		timer->Next->Link = &timer->Next;
+	*head                   = timer;
+	timer->Link             = head;
+	timer->Slot             = (uint16_t) (level * TIMER_WHEEL_SLOTS + slot);
+	wheel->Occupied[level] |= 1UL << slot;
+}
+
+// Expects the wheel lock to be held
+static void TimerWheelRemove(struct TimerWheel* wheel, struct Timer* timer)
+{
+	*timer->Link = timer->Next;
+	if (timer->Next)
+		timer->Next->Link = timer->Link;
+	timer->Next = nullptr;
+	timer->Link = nullptr;
+
+	uint8_t level = timer->Slot / TIMER_WHEEL_SLOTS;
+	uint8_t slot  = timer->Slot % TIMER_WHEEL_SLOTS;
+	if (!wheel->Slots[level][slot])
+		wheel->Occupied[level] &= ~(1UL << slot);
+}
+
+// Expects the wheel lock to be held, returns the next unit that has timers to fire or a slot to cascade
+static uint64_t TimerWheelNextEvent(struct TimerWheel* wheel)
+{
+	uint64_t next = TIMER_NEVER;
+	for (uint8_t level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+	{
+		uint64_t occupied = wheel->Occupied[level];
+		if (!occupied)
+			continue;
+
+		uint8_t  shift    = level * TIMER_WHEEL_BITS;
+		uint64_t first    = (wheel->Current + (1UL << shift) - 1) >> shift;
+		uint8_t  position = first & TIMER_WHEEL_MASK;
+		uint64_t rotated  = position ? (occupied >> position) | (occupied << (64 - position)) : occupied;
+		uint64_t unit     = (first + __builtin_ctzll(rotated)) << shift;
+		if (unit < next)
+			next = unit;
+	}
+	return next;
+}
+
+// Expects the wheel lock to be held
+static void TimerWheelCascade(struct TimerWheel* wheel, uint64_t unit)
+{
+	for (uint8_t level = TIMER_WHEEL_LEVELS - 1; level > 0; --level)
+	{
+		uint8_t shift = level * TIMER_WHEEL_BITS;
+		if (unit & ((1UL << shift) - 1))
+			continue;
+
+		uint8_t       slot  = (unit >> shift) & TIMER_WHEEL_MASK;
+		struct Timer* timer = wheel->Slots[level][slot];
+		if (!timer)
+			continue;
+		wheel->Slots[level][slot]  = nullptr;
+		wheel->Occupied[level]    &= ~(1UL << slot);
+		while (timer)
+		{
+			struct Timer* next = timer->Next;
+			TimerWheelInsert(wheel, timer);
+			timer = next;
+		}
+	}
+}
+
+// Expects the wheel lock to be held, the lock is dropped around every callback
+static void TimerWheelProcess(struct TimerWheel* wheel, uint64_t now)
+{
+	uint64_t target = now >> TIMER_UNIT_SHIFT;
+	while (true)
+	{
+		uint64_t unit = TimerWheelNextEvent(wheel);
+		if (unit > target)
+			break;
+
+		wheel->Current = unit;
+		TimerWheelCascade(wheel, unit);
+		uint8_t slot = unit & TIMER_WHEEL_MASK;
+		for (struct Timer* timer = wheel->Slots[0][slot]; timer;)
+		{
+			// Within the current unit only the timers that are due fire, the rest keep their exact deadline
+			if (timer->Deadline > now)
+			{
+				timer = timer->Next;
+				continue;
+			}
+
+			TimerWheelRemove(wheel, timer);
+			++wheel->Fired;
+			__atomic_store_n(&wheel->Running, timer, __ATOMIC_RELAXED);
+			TicketLockRelease(&wheel->Lock);
+			timer->Fn(timer->Userdata);
+			TicketLockAcquire(&wheel->Lock);
+			__atomic_store_n(&wheel->Running, nullptr, __ATOMIC_RELEASE);
+			timer = wheel->Slots[0][slot];
+		}
+		if (unit == target)
+			break;
+		wheel->Current = unit + 1;
+	}
+	if (wheel->Current < target)
+		wheel->Current = target;
+}
+
+// Expects the wheel lock to be held
+static void TimerWheelReprogram(struct TimerWheel* wheel, uint64_t now)
+{
+	uint64_t deadline = wheel->NextTick;
+	uint64_t unit     = TimerWheelNextEvent(wheel);
+	if (unit != TIMER_NEVER)
+	{
+		uint64_t eventDeadline = unit << TIMER_UNIT_SHIFT;
+		bool     cascade       = false;
+		for (uint8_t level = 1; level < TIMER_WHEEL_LEVELS && !cascade; ++level)
+		{
+			uint8_t shift = level * TIMER_WHEEL_BITS;
+			cascade       = !(unit & ((1UL << shift) - 1)) && (wheel->Occupied[level] & (1UL << ((unit >> shift) & TIMER_WHEEL_MASK)));
+		}
+		// A slot that only fires timers can be armed for its earliest deadline instead of the start of the slot
+		if (!cascade)
+		{
+			eventDeadline = TIMER_NEVER;
+			for (struct Timer* timer = wheel->Slots[0][unit & TIMER_WHEEL_MASK]; timer; timer = timer->Next)
+			{
+				if (timer->Deadline < eventDeadline)
+					eventDeadline = timer->Deadline;
+			}
+		}
+		if (eventDeadline < deadline)
+			deadline = eventDeadline;
+	}
+
+	if (deadline != wheel->Programmed)
+	{
+		wheel->Programmed = deadline;
+		TimerArmHardware(deadline, now);
+	}
+}
+
+void TimerInit(void)
+{
+	g_TimerState = (struct TimerState) {
+		.APICFrequency     = TIMER_FALLBACK_FREQUENCY,
+		.NanosecondsToAPIC = 0,
+		.TSCDeadline       = false
+	};
+	uint64_t tscFrequency = 0;
+
+#if BUILD_IS_ARCH_X86_64
+	g_TimerState.TSCDeadline = x86_64FeatureHasTSCDeadline();
+
+	uint8_t  pmTimerBits = 0;
+	uint16_t pmTimerPort = GetPMTimerPort(&pmTimerBits);
+	if (pmTimerPort)
+	{
+		// Both counters are measured over the same stretch of the PM timer, the APIC timer runs masked meanwhile
+		uint32_t pmTimerMask = pmTimerBits == 32 ? 0xFFFF'FFFF : 0xFF'FFFF;
+		x86_64APICTimerSetMode(APIC_TIMER_VECTOR, APIC_TIMER_ONE_SHOT | APIC_TIMER_MASKED);
+		uint64_t waitStart = CPUReadCycles();
+		uint32_t pmStart   = x86_64PortRead32(pmTimerPort);
+		uint32_t pmNow     = pmStart;
+		while (pmNow == pmStart && CPUReadCycles() - waitStart < TIMER_CALIBRATION_CYCLES)
+			pmNow = x86_64PortRead32(pmTimerPort);
+		pmStart = pmNow;
+
+		x86_64APICTimerArmCount(0xFFFF'FFFF);
+		uint64_t tscStart   = CPUReadCycles();
+		uint64_t tscElapsed = 0;
+		uint32_t pmElapsed  = 0;
+		while (pmElapsed < TIMER_CALIBRATION_PM_TICKS && tscElapsed < TIMER_CALIBRATION_CYCLES)
+		{
+			pmElapsed  = (x86_64PortRead32(pmTimerPort) - pmStart) & pmTimerMask;
+			tscElapsed = CPUReadCycles() - tscStart;
+		}
+		uint64_t apicElapsed = 0xFFFF'FFFF - x86_64APICTimerReadCount();
+		x86_64APICTimerArmCount(0);
+
+		if (pmElapsed >= TIMER_CALIBRATION_PM_TICKS && apicElapsed > 0)
+		{
+			tscFrequency               = tscElapsed * TIMER_PM_FREQUENCY / pmElapsed;
+			g_TimerState.APICFrequency = apicElapsed * TIMER_PM_FREQUENCY / pmElapsed;
+		}
+		else
+		{
+			LogWarn("Timer", "ACPI PM timer does not count, assuming 1 GHz");
+		}
+	}
+	else
+	{
+		LogWarn("Timer", "No ACPI PM timer to calibrate against, assuming 1 GHz");
+	}
+#endif
+
+	// The cycle counter rate reported by the processor is preferred over the measured one
+	ClockInit(tscFrequency);
+	g_TimerState.NanosecondsToAPIC = TimerPerNanosecond(g_TimerState.APICFrequency);
+}
+
+bool TimerInitCPU(void)
+{
+	uint32_t           index = CPUGetIndex();
+	struct TimerWheel* wheel = (struct TimerWheel*) HeapAllocZeroed(sizeof(struct TimerWheel));
+	if (!wheel)
+		return false;
+
+	uint64_t now      = ClockGetTime();
+	wheel->Current    = now >> TIMER_UNIT_SHIFT;
+	wheel->Programmed = TIMER_NEVER;
+	wheel->NextTick   = now + SCHEDULER_TICK_NS;
+
+	bool interrupts = TicketLockAcquireIRQSave(&wheel->Lock);
+	__atomic_store_n(&g_TimerWheels[index], wheel, __ATOMIC_RELEASE);
+#if BUILD_IS_ARCH_X86_64
+	x86_64APICTimerSetMode(APIC_TIMER_VECTOR, g_TimerState.TSCDeadline ? APIC_TIMER_TSC_DEADLINE : APIC_TIMER_ONE_SHOT);
+#endif
+	TimerWheelReprogram(wheel, now);
+	TicketLockReleaseIRQRestore(&wheel->Lock, interrupts);
+	return true;
+}
+
+void TimerGetStats(struct TimerStats* stats)
+{
+	if (!stats)
+		return;
+
+	*stats = (struct TimerStats) {
+		.APICFrequency = g_TimerState.APICFrequency,
+		.TSCDeadline   = g_TimerState.TSCDeadline,
+		.Armed         = 0,
+		.Fired         = 0,
+		.Cancelled     = 0
+	};
+	size_t cpuCount = CPUGetCount();
+	for (size_t i = 0; i < cpuCount; ++i)
+	{
+		struct TimerWheel* wheel = __atomic_load_n(&g_TimerWheels[i], __ATOMIC_ACQUIRE);
+		if (!wheel)
+			continue;
+		stats->Armed     += __atomic_load_n(&wheel->Armed, __ATOMIC_RELAXED);
+		stats->Fired     += __atomic_load_n(&wheel->Fired, __ATOMIC_RELAXED);
+		stats->Cancelled += __atomic_load_n(&wheel->Cancelled, __ATOMIC_RELAXED);
+	}
+}
+
+void TimerArm(struct Timer* timer, uint64_t deadline, TimerFn fn, void* userdata)
+{
+	if (!timer || !fn)
+		return;
+
+	TimerCancel(timer);
+	bool               interrupts = SaveAndDisableInterrupts();
+	uint32_t           index      = CPUGetIndex();
+	struct TimerWheel* wheel      = g_TimerWheels[index];
+	if (!wheel)
+	{
+		RestoreInterrupts(interrupts);
+		return;
+	}
+
+	TicketLockAcquire(&wheel->Lock);
+	timer->Deadline = deadline;
+	timer->Fn       = fn;
+	timer->Userdata = userdata;
+	__atomic_store_n(&timer->CPU, index, __ATOMIC_RELAXED);
+	TimerWheelInsert(wheel, timer);
+	++wheel->Armed;
+	if (deadline < wheel->Programmed)
+		TimerWheelReprogram(wheel, ClockGetTime());
+	TicketLockReleaseIRQRestore(&wheel->Lock, interrupts);
+}
+
+bool TimerCancel(struct Timer* timer)
+{
+	if (!timer)
+		return false;
+
+	while (true)
+	{
+		uint32_t           index = __atomic_load_n(&timer->CPU, __ATOMIC_RELAXED);
+		struct TimerWheel* wheel = index < CPU_MAX_COUNT ? __atomic_load_n(&g_TimerWheels[index], __ATOMIC_ACQUIRE) : nullptr;
+		if (!wheel)
+			return false;
+
+		bool interrupts = TicketLockAcquireIRQSave(&wheel->Lock);
+		if (__atomic_load_n(&timer->CPU, __ATOMIC_RELAXED) != index)
+		{
+			TicketLockReleaseIRQRestore(&wheel->Lock, interrupts);
+			continue;
+		}
+		bool pending = timer->Link != nullptr;
+		if (pending)
+		{
+			TimerWheelRemove(wheel, timer);
+			++wheel->Cancelled;
+		}
+		bool running = wheel->Running == timer && index != CPUGetIndex();
+		TicketLockReleaseIRQRestore(&wheel->Lock, interrupts);
+
+		// A callback cancelling its own timer runs on the same processor and must not wait for itself
+		while (running && __atomic_load_n(&wheel->Running, __ATOMIC_ACQUIRE) == timer)
+			TimerPause();
+		return pending;
+	}
+}
+
+void TimerHandleInterrupt(void)
+{
+	struct TimerWheel* wheel = g_TimerWheels[CPUGetIndex()];
+	if (!wheel)
+		return;
+
+	TicketLockAcquire(&wheel->Lock);
+	// The hardware only fires once per arming, so whatever gets armed next has to be written again
+	wheel->Programmed = TIMER_NEVER;
+	uint64_t now      = ClockGetTime();
+	TimerWheelProcess(wheel, now);
+	bool tick = now >= wheel->NextTick;
+	if (tick)
+	{
+		wheel->NextTick += SCHEDULER_TICK_NS;
+		if (wheel->NextTick <= now)
+			wheel->NextTick = now + SCHEDULER_TICK_NS;
+	}
+	TimerWheelReprogram(wheel, now);
+	TicketLockRelease(&wheel->Lock);
+
+	// The scheduler may switch threads, so the wheel is left in order before it runs
+	if (tick)
+		SchedulerTick();
+}
+
+static void TimerSelfTestFire(void* userdata)
+{
+	__atomic_store_n((uint64_t*) userdata, ClockGetTime(), __ATOMIC_RELEASE);
+}
+
+bool TimerSelfTest(void)
+{
+	struct Timer timers[2]    = {};
+	uint64_t     fired[2]     = { 0, 0 };
+	uint64_t     start        = ClockGetTime();
+	uint64_t     deadlines[2] = { start + TIMER_SELF_TEST_SHORT, start + TIMER_SELF_TEST_LONG };
+	for (uint8_t i = 0; i < 2; ++i)
+		TimerArm(&timers[i], deadlines[i], TimerSelfTestFire, &fired[i]);
+	while ((!__atomic_load_n(&fired[0], __ATOMIC_ACQUIRE) || !__atomic_load_n(&fired[1], __ATOMIC_ACQUIRE)) &&
+		   ClockGetTime() - start < TIMER_SELF_TEST_TIMEOUT)
+		ThreadYield();
+
+	bool passed = true;
+	for (uint8_t i = 0; i < 2; ++i)
+	{
+		// Cancelling waits for a callback that is still running, the timers live on this stack
+		uint64_t time = TimerCancel(&timers[i]) ? 0 : __atomic_load_n(&fired[i], __ATOMIC_ACQUIRE);
+		if (!time)
+		{
+			LogErrorFormatted("Timer", "Self-test timer due after %lu ns never fired", deadlines[i] - start);
+			passed = false;
+		}
+		else if (time < deadlines[i])
+		{
+			LogErrorFormatted("Timer", "Self-test timer due after %lu ns fired %lu ns early", deadlines[i] - start, deadlines[i] - time);
+			passed = false;
+		}
+	}
+	return passed;
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "x86_64/APIC.h"
+#include "KernelVMM.h"
+#include "VMM.h"
+#include "x86_64/Features.h"
+#include "x86_64/MSR.h"
+
+#define APIC_BASE_MSR     0x1B
+#define APIC_BASE_X2APIC  0x400
+#define APIC_BASE_ENABLED 0x800
+
+#define X2APIC_ICR_MSR 0x830
+
+// Register offsets are in bytes, x2APIC mode reaches the same register through MSR 0x800 + offset / 16
+#define APIC_EOI           0x0B0
+#define APIC_SVR           0x0F0
+#define APIC_LVT_TIMER     0x320
+#define APIC_TIMER_INITIAL 0x380
+#define APIC_TIMER_CURRENT 0x390
+#define APIC_TIMER_DIVIDE  0x3E0
+
+#define APIC_SVR_ENABLE     0x100
+#define APIC_TIMER_DIVIDE_1 0xB
+
+#define TSC_DEADLINE_MSR 0x6E0
+
+#define XAPIC_ESR      0xA0
+#define XAPIC_ICR_LOW  0xC0
+#define XAPIC_ICR_HIGH 0xC4
+
+static bool               g_APICUseX2APIC = false;
+static volatile uint32_t* g_APICRegisters = nullptr;
+
+static uint32_t x86_64APICRead(uint32_t offset)
+{
+	if (g_APICUseX2APIC)
+		return (uint32_t) x86_64ReadMSR(0x800 + (offset >> 4));
+	return g_APICRegisters ? g_APICRegisters[offset >> 2] : 0;
+}
+
+static void x86_64APICWrite(uint32_t offset, uint32_t value)
+{
+	if (g_APICUseX2APIC)
+		x86_64WriteMSR(0x800 + (offset >> 4), value);
+	else if (g_APICRegisters)
+		g_APICRegisters[offset >> 2] = value;
+}
+
+bool x86_64APICInit(void* lapicAddress)
+{
+	// Firmware that already entered x2APIC mode has to be followed, the xAPIC registers are gone in that mode
+	g_APICUseX2APIC = (x86_64ReadMSR(APIC_BASE_MSR) & APIC_BASE_X2APIC) || x86_64FeatureHasX2APIC();
+	if (!g_APICUseX2APIC)
+	{
+		if (!lapicAddress)
+			return false;
+
+		void*              kernelPageTable = GetKernelPageTable();
+		volatile uint32_t* registers       = (volatile uint32_t*) VMMAlloc(kernelPageTable, 1, 0, VMM_PAGE_TYPE_4KIB, VMM_PAGE_PROTECT_READ_WRITE, VMM_MEMORY_TYPE_UNCACHED);
+		if (!registers)
+			return false;
+		VMMMapLinear(kernelPageTable, (void*) registers, lapicAddress, 1, VMM_MEMORY_TYPE_UNCACHED);
+		g_APICRegisters = registers;
+	}
+	x86_64APICEnable();
+	return true;
+}
+
+void x86_64APICEnable(void)
+{
+	if (g_APICUseX2APIC)
+	{
+		// x2APIC mode can only be entered from an enabled xAPIC
+		uint64_t apicBase = x86_64ReadMSR(APIC_BASE_MSR);
+		if (!(apicBase & APIC_BASE_ENABLED))
+		{
+			apicBase |= APIC_BASE_ENABLED;
+			x86_64WriteMSR(APIC_BASE_MSR, apicBase);
+		}
+		if (!(apicBase & APIC_BASE_X2APIC))
+			x86_64WriteMSR(APIC_BASE_MSR, apicBase | APIC_BASE_X2APIC);
+	}
+	// The local APIC only delivers interrupts once it is software enabled
+	x86_64APICWrite(APIC_SVR, APIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+bool x86_64APICIsX2APIC(void)
+{
+	return g_APICUseX2APIC;
+}
+
+void x86_64APICEndOfInterrupt(void)
+{
+	x86_64APICWrite(APIC_EOI, 0);
+}
+
+void x86_64APICTimerSetMode(uint8_t vector, uint32_t mode)
+{
+	x86_64APICWrite(APIC_TIMER_DIVIDE, APIC_TIMER_DIVIDE_1);
+	x86_64APICWrite(APIC_LVT_TIMER, mode | vector);
+}
+
+void x86_64APICTimerArmCount(uint32_t count)
+{
+	x86_64APICWrite(APIC_TIMER_INITIAL, count);
+}
+
+void x86_64APICTimerArmDeadline(uint64_t deadline)
+{
+	// The MSR write is not ordered against earlier stores, which could otherwise still be in flight when the interrupt arrives
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	x86_64WriteMSR(TSC_DEADLINE_MSR, deadline);
+}
+
+uint32_t x86_64APICTimerReadCount(void)
+{
+	return x86_64APICRead(APIC_TIMER_CURRENT);
+}
+
+void x86_64APICSendIPI(uint32_t destination, uint32_t command)
+{
+	if (g_APICUseX2APIC)
+	{
+		// The whole ICR is written at once and there is no delivery status to wait on
+		x86_64WriteMSR(X2APIC_ICR_MSR, (uint64_t) destination << 32 | command);
+		return;
+	}
+
+	if (!g_APICRegisters || destination > 0xFF)
+		return;
+	g_APICRegisters[XAPIC_ESR]      = 0;
+	g_APICRegisters[XAPIC_ICR_HIGH] = (g_APICRegisters[XAPIC_ICR_HIGH] & 0x00FF'FFFF) | (destination << 24);
+	g_APICRegisters[XAPIC_ICR_LOW]  = (g_APICRegisters[XAPIC_ICR_LOW] & 0xFFF0'0000) | command;
+	while (g_APICRegisters[XAPIC_ICR_LOW] & 4096);
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+%include "x86_64/Build.asminc"
+
+GlobalLabel CPUArchGetBootID ; uint32_t CPUArchGetBootID(void)
+    push rbx
+    ; Leaf 0xB holds the full 32 bit x2APIC ID, leaf 1 only the low 8 bits
+    xor eax, eax
+    cpuid
+    cmp eax, 0xB
+    jb .LegacyID
+    mov eax, 0xB
+    xor ecx, ecx
+    cpuid
+    test bx, bx
+    jz .LegacyID
+    mov eax, edx
+    pop rbx
+    ret
+.LegacyID:
+    mov eax, 1
+    cpuid
+    shr ebx, 24
+    mov eax, ebx
+    pop rbx
+    ret
+
+GlobalLabel CPUArchSetData ; void CPUArchSetData(struct CPUData* data)
+    ; IA32_GS_BASE holds the block while the kernel runs, IA32_KERNEL_GS_BASE is what swapgs swaps it with
+    mov rax, rdi
+    mov rdx, rdi
+    shr rdx, 32
+    mov ecx, 0xC0000101
+    wrmsr
+    xor eax, eax
+    xor edx, edx
+    mov ecx, 0xC0000102
+    wrmsr
+    ret
+
+; The base registers keep default rel from turning the GS relative loads RIP relative
+GlobalLabel CPUGetData ; struct CPUData* CPUGetData(void)
+    xor eax, eax
+    mov rax, [gs:rax]
+    ret
+
+GlobalLabel GetProcessorID ; uint32_t GetProcessorID(void)
+    mov eax, 8
+    mov eax, [gs:rax]
+    ret
+
+GlobalLabel CPUGetIndex ; uint32_t CPUGetIndex(void)
+    mov eax, 12
+    mov eax, [gs:rax]
+    ret
+
+GlobalLabel CPUReadCycles ; uint64_t CPUReadCycles(void)
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+; lfence keeps rdtsc from running ahead of the loads before it
+GlobalLabel CPUReadCyclesOrdered ; uint64_t CPUReadCyclesOrdered(void)
+    lfence
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    ret
\ No newline at end of file
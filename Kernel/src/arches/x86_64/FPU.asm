@@ -0,0 +1,65 @@
+%include "x86_64/Build.asminc"
+
+GlobalLabel x86_64FPUEnable ; void x86_64FPUEnable(uint64_t xcr0)
+    mov rax, cr0
+    and rax, ~0x0C ; EM, TS
+    or rax, 0x22   ; MP, NE
+    mov cr0, rax
+
+    mov rax, cr4
+    or rax, 0x600 ; OSFXSR, OSXMMEXCPT
+    test rdi, rdi
+    jz .NoXSave
+    or rax, 0x40000 ; OSXSAVE
+    mov cr4, rax
+    mov eax, edi
+    mov rdx, rdi
+    shr rdx, 32
+    xor ecx, ecx
+    xsetbv
+    jmp x86_64FPUReset
+
+.NoXSave:
+    mov cr4, rax
+    ; Falls through, the new state starts out reset
+
+GlobalLabel x86_64FPUReset ; void x86_64FPUReset(void)
+    fninit
+    sub rsp, 8
+    mov dword [rsp], 0x1F80
+    ldmxcsr [rsp]
+    add rsp, 8
+    ret
+
+GlobalLabel x86_64FPUClearUpper ; void x86_64FPUClearUpper(void)
+    vzeroupper
+    ret
+
+GlobalLabel x86_64FPUXSave ; void x86_64FPUXSave(void* area, uint64_t mask)
+    mov eax, esi
+    mov rdx, rsi
+    shr rdx, 32
+    xsave64 [rdi]
+    ret
+
+GlobalLabel x86_64FPUXSaveOpt ; void x86_64FPUXSaveOpt(void* area, uint64_t mask)
+    mov eax, esi
+    mov rdx, rsi
+    shr rdx, 32
+    xsaveopt64 [rdi]
+    ret
+
+GlobalLabel x86_64FPUXRestore ; void x86_64FPUXRestore(const void* area, uint64_t mask)
+    mov eax, esi
+    mov rdx, rsi
+    shr rdx, 32
+    xrstor64 [rdi]
+    ret
+
+GlobalLabel x86_64FPUFXSave ; void x86_64FPUFXSave(void* area)
+    fxsave64 [rdi]
+    ret
+
+GlobalLabel x86_64FPUFXRestore ; void x86_64FPUFXRestore(const void* area)
+    fxrstor64 [rdi]
+    ret
\ No newline at end of file
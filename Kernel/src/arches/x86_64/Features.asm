@@ -4,19 +4,71 @@ GlobalLabel x86_64FeatureEnable ; bool x86_64FeatureEnable(void)
     push rbx
     mov eax, 0x80000001
     cpuid
-    shr edx, 20
-    bt edx, 0
-    jc .Valid
-    mov rax, 0
-    pop rbx
-    ret
-    
-.Valid:
+    bt edx, 20 ; NX
+    jnc .Invalid
+    mov eax, 1
+    cpuid
+    bt edx, 16 ; PAT
+    jnc .Invalid
+
     mov ecx, 0xC0000080
     rdmsr
     or eax, 0x800
     wrmsr
 
+    ; PA0-PA3 keep their power-on values (WB, WT, UC-, UC) so PAT-less entries keep their meaning, PA4 becomes WC
+    mov ecx, 0x277
+    mov eax, 0x00070406
+    mov edx, 0x00070401
+    wrmsr
+
+    mov rax, cr4
+    or rax, 0x80 ; PGE
+    mov cr4, rax
+
+    ; Without WP the kernel writes straight through read-only entries, the shared zero frame included
+    mov rax, cr0
+    or rax, 0x10000 ; WP
+    mov cr0, rax
+
     mov rax, 1
     pop rbx
+    ret
+
+.Invalid:
+    mov rax, 0
+    pop rbx
+    ret
+
+GlobalLabel x86_64FeatureHasX2APIC ; bool x86_64FeatureHasX2APIC(void)
+    push rbx
+    mov eax, 1
+    cpuid
+    xor eax, eax
+    bt ecx, 21 ; x2APIC
+    setc al
+    pop rbx
+    ret
+
+GlobalLabel x86_64FeatureHasTSCDeadline ; bool x86_64FeatureHasTSCDeadline(void)
+    push rbx
+    mov eax, 1
+    cpuid
+    xor eax, eax
+    bt ecx, 24 ; TSC-Deadline
+    setc al
+    pop rbx
+    ret
+
+GlobalLabel x86_64CPUID ; void x86_64CPUID(uint32_t leaf, uint32_t subleaf, uint32_t* registers)
+    push rbx
+    mov r8, rdx
+    mov eax, edi
+    mov ecx, esi
+    cpuid
+    mov [r8], eax
+    mov [r8 + 4], ebx
+    mov [r8 + 8], ecx
+    mov [r8 + 12], edx
+    pop rbx
     ret
\ No newline at end of file
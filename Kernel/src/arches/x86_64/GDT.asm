@@ -4,7 +4,7 @@ ExternLabel g_x86_64GDT
 
 GlobalLabel x86_64LoadGDT ; void x86_64LoadGDT(uint16_t initalCS, uint64_t initialDS)
     sub rsp, 10h
-    mov word [rsp], 4095
+    mov word [rsp], 32767 ; X86_64_GDT_ENTRIES * 8 - 1
     mov qword [rsp + 2], g_x86_64GDT
     lgdt [rsp]
     add rsp, 10h
@@ -16,11 +16,15 @@ GlobalLabel x86_64LoadGDT ; void x86_64LoadGDT(uint16_t initalCS, uint64_t initi
     mov ax, si
     mov ds, ax
     mov es, ax
+    ; Loading GS would zero the GS base, which already points at the processor data
     mov fs, ax
-    mov gs, ax
     mov ss, ax
     ret
 
 GlobalLabel x86_64LoadLDT ; void x86_64LoadLDT(uint16_t segment)
     lldt di
+    ret
+
+GlobalLabel x86_64LoadTR ; void x86_64LoadTR(uint16_t segment)
+    ltr di
     ret
\ No newline at end of file
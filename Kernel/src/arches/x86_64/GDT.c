@@ -2,7 +2,7 @@
 
 #include <string.h>
 
-alignas(16) uint64_t g_x86_64GDT[512];
+alignas(16) uint64_t g_x86_64GDT[X86_64_GDT_ENTRIES];
 
 bool x86_64GDTClearDescriptors(void)
 {
@@ -12,7 +12,7 @@ bool x86_64GDTClearDescriptors(void)
 
 bool x86_64GDTSetNullDescriptor(uint16_t descriptor)
 {
-	if (descriptor >= 512)
+	if (descriptor >= X86_64_GDT_ENTRIES)
 		return false;
 	g_x86_64GDT[descriptor] = 0;
 	return true;
@@ -20,7 +20,7 @@ bool x86_64GDTSetNullDescriptor(uint16_t descriptor)
 
 bool x86_64GDTSetCodeDescriptor(uint16_t descriptor, uint8_t privilege, bool conforming)
 {
-	if (descriptor >= 512)
+	if (descriptor >= X86_64_GDT_ENTRIES)
 		return false;
 	g_x86_64GDT[descriptor] = 0x00AF'9B00'0000'FFFFUL | ((uint64_t) (privilege & 3) << 45) | ((conforming ? 1UL : 0UL) << 42);
 	return true;
@@ -28,12 +28,22 @@ bool x86_64GDTSetCodeDescriptor(uint16_t descriptor, uint8_t privilege, bool con
 
 bool x86_64GDTSetDataDescriptor(uint16_t descriptor)
 {
-	if (descriptor >= 512)
+	if (descriptor >= X86_64_GDT_ENTRIES)
 		return false;
 	g_x86_64GDT[descriptor] = 0x00AF'9300'0000'FFFFUL;
 	return true;
 }
 
+bool x86_64GDTSetTSSDescriptor(uint16_t descriptor, void* tss, uint32_t limit)
+{
+	if (descriptor + 1 >= X86_64_GDT_ENTRIES)
+		return false;
+	uint64_t base               = (uint64_t) tss;
+	g_x86_64GDT[descriptor]     = 0x0000'8900'0000'0000UL | (limit & 0xFFFF) | ((base & 0xFF'FFFF) << 16) | ((uint64_t) ((limit >> 16) & 0xF) << 48) | ((base & 0xFF00'0000) << 32);
+	g_x86_64GDT[descriptor + 1] = base >> 32;
+	return true;
+}
+
 void* x86_64GetGDT(void)
 {
 	return g_x86_64GDT;
@@ -8,6 +8,27 @@ GlobalLabel EnableInterrupts ; void EnableInterrupts(void)
     sti
     ret
 
+GlobalLabel SaveAndDisableInterrupts ; bool SaveAndDisableInterrupts(void)
+    pushfq
+    pop rax
+    cli
+    shr eax, 9
+    and eax, 1
+    ret
+
+GlobalLabel RestoreInterrupts ; void RestoreInterrupts(bool enabled)
+    test dil, dil
+    jz .Done
+    sti
+    .Done:
+    ret
+
+; sti only takes effect after the next instruction, so an interrupt arriving in between still wakes hlt
+GlobalLabel CPUWaitForInterrupt ; void CPUWaitForInterrupt(void)
+    sti
+    hlt
+    ret
+
 GlobalLabel CPUHalt ; void CPUHalt(void)
     cli
     .loop:
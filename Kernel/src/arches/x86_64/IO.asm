@@ -0,0 +1,6 @@
+%include "x86_64/Build.asminc"
+
+GlobalLabel x86_64PortRead32 ; uint32_t x86_64PortRead32(uint16_t port)
+    mov dx, di
+    in eax, dx
+    ret
\ No newline at end of file
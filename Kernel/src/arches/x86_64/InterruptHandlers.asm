@@ -1,21 +1,72 @@
 %include "x86_64/Build.asminc"
 
+; The handlers are regular C functions, so everything the SysV ABI lets them clobber is saved around the call
+%macro PushCallerSaved 0
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+%endmacro
+
+%macro PopCallerSaved 0
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+%endmacro
+
+; The CPU aligns the stack to 16 bytes before pushing the 5 qword interrupt frame,
+; together with the 9 saved registers the stack is aligned again at the call
 %macro InterruptWrapper 1
 ExternLabel %1
 GlobalLabel %1Wrapper
-    lea rdi, [rsp]
+    PushCallerSaved
+    cld
+    lea rdi, [rsp + 72]
     call %1
+    PopCallerSaved
     iretq
 %endmacro
 
+; The error code adds a sixth qword, so the stack needs another 8 bytes to be aligned at the call
 %macro ExceptionWrapper 1
 ExternLabel %1
 GlobalLabel %1Wrapper
-    pop rsi
-    lea rdi, [rsp]
+    PushCallerSaved
+    cld
+    mov rsi, [rsp + 72]
+    lea rdi, [rsp + 80]
+    sub rsp, 8
     call %1
+    add rsp, 8
+    PopCallerSaved
+    add rsp, 8
     iretq
 %endmacro
 
+InterruptWrapper x86_64NMIHandler
+ExceptionWrapper x86_64DoubleFaultHandler
 ExceptionWrapper x86_64GPExceptionHandler
-InterruptWrapper x86_64TestInterruptHandler
\ No newline at end of file
+ExceptionWrapper x86_64PageFaultHandler
+InterruptWrapper x86_64TestInterruptHandler
+InterruptWrapper x86_64TimerInterruptHandler
+InterruptWrapper x86_64WakeupInterruptHandler
+InterruptWrapper x86_64CallInterruptHandler
+
+; Spurious interrupts must not be acknowledged, so there is nothing to call
+GlobalLabel x86_64SpuriousInterruptHandlerWrapper
+    iretq
+
+GlobalLabel x86_64ReadCR2 ; uint64_t x86_64ReadCR2(void)
+    mov rax, cr2
+    ret
\ No newline at end of file
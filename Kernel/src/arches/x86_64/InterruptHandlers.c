@@ -1,5 +1,31 @@
 #include "x86_64/InterruptHandlers.h"
+#include "CPU.h"
+#include "Halt.h"
+#include "KernelVMM.h"
 #include "Log.h"
+#include "SMPCall.h"
+#include "Timer.h"
+#include "VMM.h"
+#include "x86_64/APIC.h"
+
+void x86_64NMIHandler(const struct x86_64InterruptState* state)
+{
+	// Nothing raises NMIs on purpose yet, a stray one is only counted, the interrupted code may hold any lock
+	++CPUGetData()->Interrupts;
+}
+
+void x86_64DoubleFaultHandler(const struct x86_64InterruptState* state, uint16_t code)
+{
+	LogCriticalFormatted("DF",
+						 "e: 0x%04hX, RIP: 0x%016lX, RSP: 0x%016lX, RFLAGS: 0x%08X, CS: 0x%04hX, SS: 0x%04hX",
+						 code,
+						 state->rip,
+						 state->rsp,
+						 (uint32_t) state->rflags,
+						 state->cs,
+						 state->ss);
+	CPUHalt();
+}
 
 void x86_64GPExceptionHandler(const struct x86_64InterruptState* state, uint16_t code)
 {
@@ -13,8 +39,29 @@ void x86_64GPExceptionHandler(const struct x86_64InterruptState* state, uint16_t
 					  state->ss);
 }
 
+void x86_64PageFaultHandler(const struct x86_64InterruptState* state, uint16_t code)
+{
+	uint64_t address = x86_64ReadCR2();
+	++CPUGetData()->PageFaults;
+	// Not present pages may be held in the swap pool, writes to present pages may be the first write to a zero page
+	if (((code & 1) == 0 || (code & 3) == 3) && VMMHandlePageFault(GetKernelPageTable(), (void*) address, (code & 2) != 0))
+		return;
+
+	LogCriticalFormatted("PF",
+						 "e: 0x%04hX, Address: 0x%016lX, RIP: 0x%016lX, RSP: 0x%016lX, RFLAGS: 0x%08X, CS: 0x%04hX, SS: 0x%04hX",
+						 code,
+						 address,
+						 state->rip,
+						 state->rsp,
+						 (uint32_t) state->rflags,
+						 state->cs,
+						 state->ss);
+	CPUHalt();
+}
+
 void x86_64TestInterruptHandler(const struct x86_64InterruptState* state)
 {
+	++CPUGetData()->Interrupts;
 	LogErrorFormatted("TestInt",
 					  "RIP: 0x%016lX, RSP: 0x%016lX, RFLAGS: 0x%08X, CS: 0x%04hX, SS: 0x%04hX",
 					  state->rip,
@@ -22,4 +69,27 @@ void x86_64TestInterruptHandler(const struct x86_64InterruptState* state)
 					  (uint32_t) state->rflags,
 					  state->cs,
 					  state->ss);
+}
+
+void x86_64TimerInterruptHandler(const struct x86_64InterruptState* state)
+{
+	++CPUGetData()->Interrupts;
+	// The scheduler tick may switch to another thread before this returns, so the interrupt is acknowledged first
+	x86_64APICEndOfInterrupt();
+	TimerHandleInterrupt();
+}
+
+void x86_64WakeupInterruptHandler(const struct x86_64InterruptState* state)
+{
+	// Only pulls a processor out of hlt, the idle loop looks at its queues once this returns
+	++CPUGetData()->Interrupts;
+	x86_64APICEndOfInterrupt();
+}
+
+void x86_64CallInterruptHandler(const struct x86_64InterruptState* state)
+{
+	++CPUGetData()->Interrupts;
+	// A call queued once the drain took the list raises its own interrupt, which stays pending until this one is acknowledged
+	x86_64APICEndOfInterrupt();
+	SMPCallHandleInterrupt();
 }
\ No newline at end of file
@@ -0,0 +1,16 @@
+%include "x86_64/Build.asminc"
+
+GlobalLabel x86_64ReadMSR ; uint64_t x86_64ReadMSR(uint32_t msr)
+    mov ecx, edi
+    rdmsr
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+GlobalLabel x86_64WriteMSR ; void x86_64WriteMSR(uint32_t msr, uint64_t value)
+    mov ecx, edi
+    mov rax, rsi
+    mov rdx, rsi
+    shr rdx, 32
+    wrmsr
+    ret
\ No newline at end of file
@@ -0,0 +1,21 @@
+%include "x86_64/Build.asminc"
+
+GlobalLabel x86_64Monitor ; void x86_64Monitor(const void* address)
+    mov rax, rdi
+    xor ecx, ecx
+    xor edx, edx
+    monitor
+    ret
+
+GlobalLabel x86_64MWait ; void x86_64MWait(uint32_t hint)
+    mov eax, edi
+    xor ecx, ecx
+    mwait
+    ret
+
+GlobalLabel x86_64MWaitEnableInterrupts ; void x86_64MWaitEnableInterrupts(uint32_t hint)
+    mov eax, edi
+    xor ecx, ecx
+    sti
+    mwait
+    ret
\ No newline at end of file
@@ -0,0 +1,33 @@
+%include "x86_64/Build.asminc"
+
+; Threads are only switched through calls, so the callee saved registers are all that has to be kept
+GlobalLabel SchedulerArchSwitch ; void SchedulerArchSwitch(void** stackPointer, void* nextStackPointer)
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret
+
+; Builds the frame SchedulerArchSwitch pops, the null return address above entry keeps the stack aligned as if entry was called
+GlobalLabel SchedulerArchPrepareStack ; void* SchedulerArchPrepareStack(void* stackTop, void (*entry)(void))
+    mov qword [rdi - 8], 0
+    mov [rdi - 16], rsi
+    xor eax, eax
+    mov [rdi - 24], rax
+    mov [rdi - 32], rax
+    mov [rdi - 40], rax
+    mov [rdi - 48], rax
+    mov [rdi - 56], rax
+    mov [rdi - 64], rax
+    lea rax, [rdi - 64]
+    ret
\ No newline at end of file
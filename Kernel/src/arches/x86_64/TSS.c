@@ -0,0 +1,61 @@
+#include "x86_64/TSS.h"
+#include "Heap.h"
+#include "Stack.h"
+#include "x86_64/GDT.h"
+
+struct x86_64TSS
+{
+	uint32_t Reserved0;
+	uint64_t RSP[3];
+	uint64_t Reserved1;
+	uint64_t IST[7];
+	uint64_t Reserved2;
+	uint16_t Reserved3;
+	uint16_t IOMapBase;
+} __attribute__((packed));
+
+static bool g_x86_64TSSCreated[CPU_MAX_COUNT];
+
+bool x86_64TSSCreate(struct CPUData* cpu)
+{
+	if (!cpu || cpu->Index >= CPU_MAX_COUNT)
+		return false;
+
+	struct x86_64TSS* tss = (struct x86_64TSS*) HeapAllocZeroed(sizeof(struct x86_64TSS));
+	if (!tss)
+		return false;
+	// The stacks come with a guard page, so even an overflow on them ends in a fault instead of corrupting memory
+	for (uint8_t i = 0; i < X86_64_IST_PAGE_FAULT; ++i)
+	{
+		void* stackTop = StackAlloc();
+		if (!stackTop)
+		{
+			while (i-- > 0)
+				StackFree((void*) tss->IST[i]);
+			HeapFree(tss);
+			return false;
+		}
+		tss->IST[i] = (uint64_t) stackTop;
+	}
+	// An offset past the limit means there is no I/O permission bitmap
+	tss->IOMapBase = sizeof(struct x86_64TSS);
+	if (!x86_64GDTSetTSSDescriptor(X86_64_GDT_TSS_FIRST + cpu->Index * 2, tss, sizeof(struct x86_64TSS) - 1))
+	{
+		for (uint8_t i = 0; i < X86_64_IST_PAGE_FAULT; ++i)
+			StackFree((void*) tss->IST[i]);
+		HeapFree(tss);
+		return false;
+	}
+	g_x86_64TSSCreated[cpu->Index] = true;
+	return true;
+}
+
+bool x86_64TSSLoad(void)
+{
+	uint32_t index = CPUGetIndex();
+	if (index >= CPU_MAX_COUNT || !g_x86_64TSSCreated[index])
+		return false;
+
+	x86_64LoadTR((uint16_t) ((X86_64_GDT_TSS_FIRST + index * 2) * 8));
+	return true;
+}
\ No newline at end of file
@@ -11,12 +11,8 @@ GlobalLabel x86_64Trampoline ; void x86_64Trampoline(void)
     mov ax, 0
     mov ds, ax
     mov es, ax
-    mov byte [ADDR_OF(g_x86_64TrampolineStats.Alive)], 1
+    lock inc dword [ADDR_OF(g_x86_64TrampolineStats.Alive)]
 
-    .waitForAck:
-        cmp byte [ADDR_OF(g_x86_64TrampolineStats.Ack)], 1
-        jne .waitForAck
-    
     mov eax, cr4
     or eax, 0x20
 
@@ -42,7 +38,7 @@ GlobalLabel x86_64Trampoline ; void x86_64Trampoline(void)
     wrmsr
 
     mov eax, cr0
-    or eax, 0x80000001
+    or eax, 0x80010001 ; PG, WP, PE
     mov cr0, eax
 
     lgdt [ADDR_OF(GDTR)]
@@ -51,25 +47,48 @@ GlobalLabel x86_64Trampoline ; void x86_64Trampoline(void)
 
 bits 64
 .LongMode:
-    mov eax, 1
-    cpuid
-    shr rbx, 24
-    
     mov ax, GDT.data_64
     mov ds, ax
     mov es, ax
     mov fs, ax
     mov gs, ax
     mov ss, ax
-    mov rsp, ADDR_OF(Stack.top)
-    mov rbp, rsp
 
-    mov rcx, [ADDR_OF(g_x86_64TrampolineSettings.StackAllocFn)]
-    call rcx
-    
-    mov rdi, rbx
-    mov rsp, rax
-    mov rbp, rsp
+    ; All cores run this at once, each one finds the slot the boot processor prepared for its x2APIC ID
+    xor eax, eax
+    cpuid
+    cmp eax, 0xB
+    jb .LegacyID
+    mov eax, 0xB
+    xor ecx, ecx
+    cpuid
+    test bx, bx
+    jz .LegacyID
+    mov ebx, edx
+    jmp .HaveID
+    .LegacyID:
+        mov eax, 1
+        cpuid
+        shr ebx, 24
+    .HaveID:
+    mov rsi, [ADDR_OF(g_x86_64TrampolineSettings.Slots)]
+    mov rcx, [ADDR_OF(g_x86_64TrampolineSettings.SlotCount)]
+    .FindSlot:
+        test rcx, rcx
+        jz .NoSlot
+        cmp [rsi + x86_64TrampolineSlot.ID], ebx
+        je .FoundSlot
+        add rsi, x86_64TrampolineSlot_size
+        dec rcx
+        jmp .FindSlot
+    .NoSlot:
+        cli
+        hlt
+        jmp .NoSlot
+    .FoundSlot:
+        mov rsp, [rsi + x86_64TrampolineSlot.StackTop]
+        mov rbp, rsp
+        mov rdi, [rsi + x86_64TrampolineSlot.CPUData]
 
     mov rcx, [ADDR_OF(g_x86_64TrampolineSettings.CPUTrampolineFn)]
     jmp rcx
@@ -78,6 +97,13 @@ bits 64
 ;  Structs
 ; ---------
 
+struc x86_64TrampolineSlot
+    .ID:       resd 1
+    .Reserved: resd 1
+    .StackTop: resq 1
+    .CPUData:  resq 1
+endstruc
+
 align 16
 LocalLabel GDTR
     dw GDT.size
@@ -97,15 +123,11 @@ GlobalLabel g_x86_64TrampolineSettings ; struct x86_64TrampolineSettings
     .PageTable:         dq 0
     .PageTableSettings: dq 0
     .CPUTrampolineFn:   dq 0
-    .StackAllocFn:      dq 0
+    .Slots:             dq 0
+    .SlotCount:         dq 0
 
 align 16
 GlobalLabel g_x86_64TrampolineStats ; struct x86_64TrampolineStats
-    .Alive: db 0
-    .Ack:   db 0
+    .Alive: dd 0
 
-align 16
-LocalLabel Stack
-    .bottom:
-    times 4096 - ($ - x86_64Trampoline) db 0
-    .top:
\ No newline at end of file
+    times 4096 - ($ - x86_64Trampoline) db 0
\ No newline at end of file
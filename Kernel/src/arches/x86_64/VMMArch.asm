@@ -15,4 +15,33 @@ GlobalLabel VMMArchActivate ; void VMMArchActivate(uint64_t* pageTableRoot, uint
     mov rax, 0x000FFFFFFFFFF000
     and rdi, rax
     mov cr3, rdi
+    ret
+
+GlobalLabel VMMArchIsActive ; bool VMMArchIsActive(uint64_t* pageTableRoot)
+    mov rax, cr3
+    mov rcx, 0x000FFFFFFFFFF000
+    and rax, rcx
+    and rdi, rcx
+    cmp rax, rdi
+    sete al
+    movzx eax, al
+    ret
+
+GlobalLabel VMMArchInvalidatePage ; void VMMArchInvalidatePage(uint64_t virtualAddress)
+    invlpg [rdi]
+    ret
+
+GlobalLabel VMMArchFlushAll ; void VMMArchFlushAll(void)
+    ; Toggling CR4.PGE drops every TLB entry including global ones, without PGE a CR3 reload does the same
+    mov rax, cr4
+    test rax, 0x80
+    jz .ReloadCR3
+    mov rcx, rax
+    xor rcx, 0x80
+    mov cr4, rcx
+    mov cr4, rax
+    ret
+.ReloadCR3:
+    mov rax, cr3
+    mov cr3, rax
     ret
\ No newline at end of file
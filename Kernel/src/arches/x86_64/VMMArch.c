@@ -1,13 +1,29 @@
 #include "VMM.h"
 
-uint64_t VMMArchConstructPageTableEntry(void* physicalAddress, enum VMMPageType type, enum VMMPageProtect protect)
+// IA32_PAT is programmed by x86_64FeatureEnable as PA0 = WB, PA1 = WT, PA2 = UC-, PA3 = UC, PA4 = WC
+static uint64_t VMMArchMemoryTypeBits(enum VMMPageType type, enum VMMMemoryType memoryType)
 {
-	uint64_t entry = physicalAddress != nullptr ? 1 : 0;
+	switch (memoryType)
+	{
+	case VMM_MEMORY_TYPE_WRITE_BACK: return 0x00;
+	case VMM_MEMORY_TYPE_WRITE_THROUGH: return 0x08;
+	case VMM_MEMORY_TYPE_UNCACHED: return 0x18;
+	case VMM_MEMORY_TYPE_WRITE_COMBINING: return type == VMM_PAGE_TYPE_2MIB || type == VMM_PAGE_TYPE_1GIB ? 0x1000 : 0x80;
+	}
+	return 0x00;
+}
+
+uint64_t VMMArchConstructPageTableEntry(uint64_t physicalAddress, enum VMMPageType type, enum VMMPageProtect protect, enum VMMMemoryType memoryType, bool global)
+{
+	uint64_t entry = physicalAddress != 0 ? 1 : 0;
 	switch (type)
 	{
-	case VMM_PAGE_TYPE_4KIB: entry |= (uint64_t) physicalAddress & 0xF'FFFF'FFFF'F000UL; break;
-	case VMM_PAGE_TYPE_2MIB: entry |= (uint64_t) physicalAddress & 0xF'FFFF'FFE0'0000UL | 0x80; break;
-	case VMM_PAGE_TYPE_1GIB: entry |= (uint64_t) physicalAddress & 0xF'FFFF'C000'0000UL | 0x80; break;
+	case VMM_PAGE_TYPE_4KIB:
+	case VMM_PAGE_TYPE_AUTO:
+	case VMM_PAGE_TYPE_ZERO:
+	case VMM_PAGE_TYPE_PAGEABLE: entry |= physicalAddress & 0xF'FFFF'FFFF'F000UL; break;
+	case VMM_PAGE_TYPE_2MIB: entry |= (physicalAddress & 0xF'FFFF'FFE0'0000UL) | 0x80; break;
+	case VMM_PAGE_TYPE_1GIB: entry |= (physicalAddress & 0xF'FFFF'C000'0000UL) | 0x80; break;
 	}
 	switch (protect)
 	{
@@ -16,6 +32,9 @@ uint64_t VMMArchConstructPageTableEntry(void* physicalAddress, enum VMMPageType
 	case VMM_PAGE_PROTECT_READ_EXECUTE: entry |= 0x0000'0000'0000'0000; break;
 	case VMM_PAGE_PROTECT_READ_WRITE_EXECUTE: entry |= 0x0000'0000'0000'0002; break;
 	}
+	entry |= VMMArchMemoryTypeBits(type, memoryType);
+	if (global)
+		entry |= 0x100;
 	return entry;
 }
 
@@ -24,26 +43,26 @@ uint64_t VMMArchConstructPageTablePointer(uint64_t* subTableAddress)
 	return 0x3 | ((uint64_t) subTableAddress & 0xF'FFFF'FFFF'F000UL);
 }
 
-void VMMArchGetPageTableEntry(uint64_t entry, uint8_t level, void** physicalAddress, enum VMMPageType* type, enum VMMPageProtect* protect)
+void VMMArchGetPageTableEntry(uint64_t entry, uint8_t level, uint64_t* physicalAddress, enum VMMPageType* type, enum VMMPageProtect* protect, enum VMMMemoryType* memoryType)
 {
 	if (level == 0)
 	{
 		if (physicalAddress)
-			*physicalAddress = (void*) (entry & 0xF'FFFF'FFFF'F000UL);
+			*physicalAddress = entry & 0xF'FFFF'FFFF'F000UL;
 		if (type)
 			*type = VMM_PAGE_TYPE_4KIB;
 	}
 	else if (level == 1)
 	{
 		if (physicalAddress)
-			*physicalAddress = (void*) (entry & 0xF'FFFF'FFE0'0000UL);
+			*physicalAddress = entry & 0xF'FFFF'FFE0'0000UL;
 		if (type)
 			*type = VMM_PAGE_TYPE_2MIB;
 	}
 	else if (level == 2)
 	{
 		if (physicalAddress)
-			*physicalAddress = (void*) (entry & 0xF'FFFF'C000'0000UL);
+			*physicalAddress = entry & 0xF'FFFF'C000'0000UL;
 		if (type)
 			*type = VMM_PAGE_TYPE_1GIB;
 	}
@@ -66,9 +85,39 @@ void VMMArchGetPageTableEntry(uint64_t entry, uint8_t level, void** physicalAddr
 			*protect = VMM_PAGE_PROTECT_READ_EXECUTE;
 		}
 	}
+
+	if (memoryType)
+	{
+		bool pat = level == 0 ? (entry & 0x80) != 0 : (entry & 0x1000) != 0;
+		if (pat)
+			*memoryType = VMM_MEMORY_TYPE_WRITE_COMBINING;
+		else if ((entry & 0x18) == 0x18)
+			*memoryType = VMM_MEMORY_TYPE_UNCACHED;
+		else if (entry & 0x08)
+			*memoryType = VMM_MEMORY_TYPE_WRITE_THROUGH;
+		else
+			*memoryType = VMM_MEMORY_TYPE_WRITE_BACK;
+	}
 }
 
 uint64_t* VMMArchGetPageTablePointer(uint64_t entry)
 {
 	return (uint64_t*) (entry & 0xF'FFFF'FFFF'F000UL);
+}
+
+bool VMMArchClearAccessed(uint64_t* entry)
+{
+	// The CPU sets the accessed bit on its own, so it is cleared atomically
+	return (__atomic_fetch_and(entry, ~0x20UL, __ATOMIC_RELAXED) & 0x20) != 0;
+}
+
+// Non-present entries are ignored by the CPU, the shift keeps P clear for any handle
+uint64_t VMMArchConstructSwapEntry(void* handle)
+{
+	return (uint64_t) handle << 1;
+}
+
+void* VMMArchGetSwapEntry(uint64_t entry)
+{
+	return (void*) (entry >> 1);
 }
\ No newline at end of file